@@ -0,0 +1,86 @@
+#include "activity.hpp"
+
+#include <algorithm>
+#include <atomic>
+
+namespace pop {
+
+void ActivityCounts::reset(int slots)
+{
+    element_slots = slots;
+    swaps.assign(slots, 0);
+    changes.assign(static_cast<std::size_t>(slots) * slots, 0);
+    cells_visited = 0;
+    cells_changed = 0;
+    random_draws = 0;
+}
+
+void ActivityCounts::add(const ActivityCounts& other)
+{
+    for (std::size_t i = 0; i < swaps.size(); i++) {
+        swaps[i] += other.swaps[i];
+    }
+    for (std::size_t i = 0; i < changes.size(); i++) {
+        changes[i] += other.changes[i];
+    }
+    cells_visited += other.cells_visited;
+    cells_changed += other.cells_changed;
+    random_draws += other.random_draws;
+}
+
+uint64_t ActivityCounts::change_count(ElementId from, ElementId to) const
+{
+    return changes.at(static_cast<std::size_t>(from) * element_slots + to);
+}
+
+// Told apart by id rather than address, as counters can be freed and another allocated in the same place
+static std::atomic<uint64_t> s_next_counters_id { 1 };
+
+struct LocalCounts {
+    uint64_t counters_id = 0;
+    ActivityCounts* counts = nullptr;
+};
+
+static thread_local LocalCounts t_local {};
+
+ActivityCounters::ActivityCounters(int element_slots)
+    : m_id(s_next_counters_id.fetch_add(1, std::memory_order_relaxed))
+    , m_element_slots(element_slots)
+{
+    m_last_tick.reset(element_slots);
+}
+
+ActivityCounts& ActivityCounters::local()
+{
+    if (t_local.counters_id == m_id) {
+        return *t_local.counts;
+    }
+    std::lock_guard lock(m_mutex);
+    const std::thread::id thread = std::this_thread::get_id();
+    auto counts = std::find_if(m_threads.begin(), m_threads.end(),
+        [&](const std::unique_ptr<ThreadCounts>& thread_counts) { return thread_counts->thread == thread; });
+    if (counts == m_threads.end()) {
+        m_threads.push_back(std::make_unique<ThreadCounts>(thread, ActivityCounts {}));
+        m_threads.back()->counts.reset(m_element_slots);
+        counts = m_threads.end() - 1;
+    }
+    t_local = { .counters_id = m_id, .counts = &(*counts)->counts };
+    return *t_local.counts;
+}
+
+void ActivityCounters::merge()
+{
+    std::lock_guard lock(m_mutex);
+    m_last_tick.reset(m_element_slots);
+    for (const std::unique_ptr<ThreadCounts>& thread_counts : m_threads) {
+        m_last_tick.add(thread_counts->counts);
+        thread_counts->counts.reset(m_element_slots);
+    }
+}
+
+const ActivityCounts& ActivityCounters::last_tick() const
+{
+    return m_last_tick;
+}
+
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "elements.hpp"
+
+namespace pop {
+
+/**
+ * @brief What kernels did during a tick. Swaps are counted by the element that started them and element changes by the
+ * element they changed from and to, so reactions like water turning to steam have their own count. Changed cells count
+ * every cell written, a cell written twice counts twice. Only writes that happen are counted, moves an engine throws
+ * away after a kernel asked for them, like lost claims, are not.
+ */
+struct ActivityCounts {
+    // Element ids are below this
+    int element_slots = 0;
+    std::vector<uint64_t> swaps {};
+    // Indexed by from * element_slots + to
+    std::vector<uint64_t> changes {};
+    uint64_t cells_visited = 0;
+    uint64_t cells_changed = 0;
+    uint64_t random_draws = 0;
+
+    /**
+     * @brief Zero every count
+     */
+    void reset(int slots);
+
+    void add(const ActivityCounts& other);
+
+    [[nodiscard]] uint64_t change_count(ElementId from, ElementId to) const;
+};
+
+/**
+ * @brief Activity counts kept separately by every thread that steps the simulation, so counting takes no atomics or
+ * locks, and merged once per tick
+ */
+class ActivityCounters {
+public:
+    /**
+     * @brief Construct ActivityCounters
+     * @param element_slots - One more than the highest element id
+     */
+    explicit ActivityCounters(int element_slots);
+
+    /**
+     * @brief Get the counts of the calling thread
+     */
+    [[nodiscard]] ActivityCounts& local();
+
+    /**
+     * @brief Sum up the counts of every thread as the last tick and zero them for the next one. Must not run while
+     * other threads count.
+     */
+    void merge();
+
+    [[nodiscard]] const ActivityCounts& last_tick() const;
+
+private:
+    struct ThreadCounts {
+        std::thread::id thread;
+        ActivityCounts counts;
+    };
+
+    uint64_t m_id;
+    int m_element_slots;
+    std::mutex m_mutex {};
+    std::vector<std::unique_ptr<ThreadCounts>> m_threads {};
+    ActivityCounts m_last_tick {};
+};
+
+}
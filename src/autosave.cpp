@@ -0,0 +1,124 @@
+#include "autosave.hpp"
+
+#include <exception>
+
+#include "scene.hpp"
+#include "util/logger.hpp"
+#include "util/profiler.hpp"
+
+namespace pop {
+
+Autosave::Autosave(std::filesystem::path path, std::chrono::seconds interval, std::size_t buffer_size)
+    : m_path(std::move(path))
+    , m_interval(interval)
+    , m_buffer_size(buffer_size)
+    , m_last_start(std::chrono::steady_clock::now())
+{
+    m_thread = std::thread([this] { run(); });
+}
+
+Autosave::~Autosave()
+{
+    {
+        std::lock_guard lock(m_mutex);
+        m_stopping = true;
+    }
+    m_condition.notify_all();
+    m_thread.join();
+}
+
+bool Autosave::update(Simulation& simulation)
+{
+    const auto now = std::chrono::steady_clock::now();
+    if (now - m_last_start < m_interval) {
+        return false;
+    }
+    {
+        std::lock_guard lock(m_mutex);
+        if (m_busy) {
+            return false;
+        }
+    }
+    start(simulation);
+    return true;
+}
+
+void Autosave::save(Simulation& simulation)
+{
+    wait();
+    start(simulation);
+}
+
+void Autosave::wait()
+{
+    std::unique_lock lock(m_mutex);
+    m_condition.wait(lock, [&] { return !m_busy; });
+}
+
+uint64_t Autosave::saves() const
+{
+    std::lock_guard lock(m_mutex);
+    return m_saves;
+}
+
+uint64_t Autosave::failures() const
+{
+    std::lock_guard lock(m_mutex);
+    return m_failures;
+}
+
+void Autosave::start(Simulation& simulation)
+{
+    PROFILE_ZONE("autosave_start");
+    m_last_start = std::chrono::steady_clock::now();
+    Job job { .snapshot = simulation.snapshot(), .element_names = element_names(simulation) };
+    {
+        std::lock_guard lock(m_mutex);
+        m_job = std::move(job);
+        m_busy = true;
+    }
+    m_condition.notify_all();
+}
+
+void Autosave::run()
+{
+    PROFILE_THREAD("autosave");
+    while (true) {
+        std::optional<Job> job;
+        {
+            std::unique_lock lock(m_mutex);
+            m_condition.wait(lock, [&] { return m_stopping || m_job.has_value(); });
+            // A save in progress is finished before stopping so the file isn't left behind
+            if (!m_job.has_value()) {
+                return;
+            }
+            job = std::move(m_job);
+            m_job.reset();
+        }
+
+        const uint64_t tick = job->snapshot.tick();
+        const auto start = std::chrono::steady_clock::now();
+        bool saved = true;
+        try {
+            const std::size_t size
+                = write_scene(std::move(job->snapshot), job->element_names, m_path, m_buffer_size);
+            const std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+            POP_LOG_INFO("Autosaved tick {} to {}, {} bytes in {:.1f} ms", tick, m_path.string(), size,
+                duration.count());
+        }
+        catch (const std::exception& e) {
+            saved = false;
+            POP_LOG_ERROR("Unable to autosave: {}", e.what());
+        }
+        job.reset();
+
+        {
+            std::lock_guard lock(m_mutex);
+            (saved ? m_saves : m_failures)++;
+            m_busy = false;
+        }
+        m_condition.notify_all();
+    }
+}
+
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "simulation.hpp"
+
+namespace pop {
+
+/**
+ * @brief Saves the grid of a simulation to a scene file every so often without holding up the simulation. A save
+ * starts with a snapshot of the grid between updates, which only references its chunks. The scene is then encoded and
+ * written on a thread of its own, chunk by chunk, and each chunk is released as soon as it is encoded so the snapshot
+ * shrinks as the save goes on. Only one save runs at a time and the file is replaced atomically, so a crash leaves the
+ * last finished save.
+ */
+class Autosave {
+public:
+    /**
+     * @brief Construct Autosave and start its background thread
+     * @param interval - Time between the starts of saves
+     * @param buffer_size - Bytes of encoded chunks held before they are written out
+     */
+    Autosave(std::filesystem::path path, std::chrono::seconds interval, std::size_t buffer_size = 1 << 20);
+
+    /**
+     * @brief Finish the save in progress and stop the background thread
+     */
+    ~Autosave();
+
+    Autosave(const Autosave&) = delete;
+    Autosave& operator=(const Autosave&) = delete;
+
+    /**
+     * @brief Start a save if the interval has passed since the last one started and none is in progress. Must be called
+     * between updates.
+     * @return - True if a save was started
+     */
+    bool update(Simulation& simulation);
+
+    /**
+     * @brief Start a save now, waiting for the one in progress to finish first. Must be called between updates.
+     */
+    void save(Simulation& simulation);
+
+    /**
+     * @brief Wait for the save in progress to finish
+     */
+    void wait();
+
+    /**
+     * @brief Get the number of saves written so far
+     */
+    [[nodiscard]] uint64_t saves() const;
+
+    /**
+     * @brief Get the number of saves that failed so far
+     */
+    [[nodiscard]] uint64_t failures() const;
+
+private:
+    struct Job {
+        GridSnapshot snapshot;
+        std::vector<std::string> element_names;
+    };
+
+    const std::filesystem::path m_path;
+    const std::chrono::seconds m_interval;
+    const std::size_t m_buffer_size;
+    std::chrono::steady_clock::time_point m_last_start;
+    mutable std::mutex m_mutex {};
+    std::condition_variable m_condition {};
+    std::optional<Job> m_job {};
+    bool m_busy = false;
+    bool m_stopping = false;
+    uint64_t m_saves = 0;
+    uint64_t m_failures = 0;
+    std::thread m_thread;
+
+    void start(Simulation& simulation);
+
+    void run();
+};
+
+}
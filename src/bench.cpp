@@ -0,0 +1,98 @@
+#include "bench.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <functional>
+#include <thread>
+
+#include "powder_playground.hpp"
+#include "simulation.hpp"
+#include "util/logger.hpp"
+#include "util/rng.hpp"
+#include "util/worker_pool.hpp"
+
+namespace pop {
+
+static constexpr int k_bench_width = 320;
+static constexpr int k_bench_height = 240;
+static constexpr int k_bench_ticks = 300;
+
+struct BenchScene {
+    const char* name;
+    std::function<void(Simulation&, util::Rng&)> fill;
+};
+
+// Most of the grid moving at once, where scheduling overhead and contention matter most
+static void fill_dense(Simulation& simulation, util::Rng& rng)
+{
+    const std::array<ElementId, 4> ids { simulation.id_of("salt"), simulation.id_of("water"),
+        simulation.id_of("steam"), simulation.id_of("stone") };
+    for (int y = 0; y < simulation.height() * 2 / 3; y++) {
+        for (int x = 0; x < simulation.width(); x++) {
+            if (rng.range(0, 9) < 7) {
+                simulation.particle_at({ x, y }).element_id = ids[rng.range(0, 3)];
+            }
+        }
+    }
+}
+
+// A settled pile with a light rain on top, where most cells have nothing to do
+static void fill_sparse(Simulation& simulation, util::Rng& rng)
+{
+    const ElementId salt = simulation.id_of("salt");
+    const ElementId water = simulation.id_of("water");
+    for (int y = 0; y < simulation.height(); y++) {
+        for (int x = 0; x < simulation.width(); x++) {
+            if (y >= simulation.height() * 3 / 4) {
+                simulation.particle_at({ x, y }).element_id = salt;
+            }
+            else if (y < simulation.height() / 8 && rng.range(0, 99) < 3) {
+                simulation.particle_at({ x, y }).element_id = water;
+            }
+        }
+    }
+}
+
+static double time_engine(const BenchScene& scene, std::string_view engine_name, util::WorkerPool* pool)
+{
+    Simulation simulation(k_bench_width, k_bench_height);
+    init_elements(simulation);
+    simulation.clear_to("air");
+    simulation.set_bitsliced_powders(true);
+    simulation.set_engine(make_engine(engine_name));
+    simulation.set_worker_pool(pool);
+    util::Rng rng(1);
+    scene.fill(simulation, rng);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < k_bench_ticks; i++) {
+        simulation.update();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / k_bench_ticks;
+}
+
+void run_bench()
+{
+    const std::array<BenchScene, 2> scenes { { { "dense", fill_dense }, { "sparse", fill_sparse } } };
+    const int thread_count = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+
+    util::main_logger().set_level(spdlog::level::info);
+    POP_LOG_INFO("Benchmark: {}x{} cells, {} ticks per run", k_bench_width, k_bench_height, k_bench_ticks);
+    for (const BenchScene& scene : scenes) {
+        for (std::string_view engine_name : engine_names()) {
+            const double single = time_engine(scene, engine_name, nullptr);
+            if (!make_engine(engine_name)->parallel()) {
+                POP_LOG_INFO("{:<7} {:<11} {:8.3f} ms/tick", scene.name, engine_name, single);
+                continue;
+            }
+            util::WorkerPool pool(thread_count);
+            const double threaded = time_engine(scene, engine_name, &pool);
+            POP_LOG_INFO("{:<7} {:<11} {:8.3f} ms/tick, {:8.3f} ms/tick on {} threads", scene.name, engine_name, single,
+                threaded, thread_count);
+        }
+    }
+}
+
+}
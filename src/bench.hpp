@@ -0,0 +1,10 @@
+#pragma once
+
+namespace pop {
+
+/**
+ * @brief Time every engine on a few seeded scenes without opening a window and log the results
+ */
+void run_bench();
+
+}
@@ -0,0 +1,71 @@
+#include "bitsliced.hpp"
+
+#include <bit>
+
+#include "simulation.hpp"
+
+namespace pop {
+
+bool is_powder_segment(const Occupancy& occupancy, int row, int word_index)
+{
+    if ((occupancy.word(ElementType::e_liquid, row, word_index) | occupancy.word(ElementType::e_gas, row, word_index))
+        != 0) {
+        return false;
+    }
+    if (row + 1 >= occupancy.height()) {
+        return true;
+    }
+    uint64_t liquid_below = occupancy.word(ElementType::e_liquid, row + 1, word_index);
+    if (word_index > 0) {
+        liquid_below |= occupancy.word(ElementType::e_liquid, row + 1, word_index - 1) >> 63;
+    }
+    if (word_index + 1 < occupancy.words_per_row()) {
+        liquid_below |= occupancy.word(ElementType::e_liquid, row + 1, word_index + 1) << 63;
+    }
+    return liquid_below == 0;
+}
+
+static void move_bits(Simulation& simulation, uint64_t bits, int row, int base_x, int offset_x)
+{
+    while (bits != 0) {
+        int x = base_x + std::countr_zero(bits);
+        simulation.swap({ x, row }, { x + offset_x, row + 1 });
+        bits &= bits - 1;
+    }
+}
+
+void step_powder_segment(Simulation& simulation, int row, int word_index, util::WideRng& rng)
+{
+    const Occupancy& occupancy = simulation.occupancy();
+    const uint64_t powder = occupancy.word(ElementType::e_powder, row, word_index);
+    if (powder == 0 || row + 1 >= occupancy.height()) {
+        return;
+    }
+
+    const int below = row + 1;
+    uint64_t empty = occupancy.word(ElementType::e_null, below, word_index);
+    const uint64_t empty_left = word_index > 0 ? occupancy.word(ElementType::e_null, below, word_index - 1) : 0;
+    const uint64_t empty_right
+        = word_index + 1 < occupancy.words_per_row() ? occupancy.word(ElementType::e_null, below, word_index + 1) : 0;
+
+    const std::array<uint64_t, util::WideRng::lanes> rand1 = rng.next();
+    const std::array<uint64_t, util::WideRng::lanes> rand2 = rng.next();
+    // A powder with air below stays put with probability 5/32, close to the 1/6 of the per-cell kernel
+    const uint64_t held = rand1[0] & rand1[1] & (rand1[2] | (rand1[3] & rand2[0]));
+    const uint64_t go_right = rand2[1];
+
+    // Claim targets in the row below in order: straight falls, then left slides, then right slides
+    const uint64_t fall = powder & empty & ~held;
+    const uint64_t blocked = powder & ~empty;
+    empty &= ~fall;
+    const uint64_t slide_left = blocked & ~go_right & ((empty << 1) | (empty_left >> 63));
+    empty &= ~(slide_left >> 1);
+    const uint64_t slide_right = blocked & go_right & ((empty >> 1) | (empty_right << 63));
+
+    const int base_x = word_index * 64;
+    move_bits(simulation, fall, row, base_x, 0);
+    move_bits(simulation, slide_left, row, base_x, -1);
+    move_bits(simulation, slide_right, row, base_x, 1);
+}
+
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "occupancy.hpp"
+#include "util/rng.hpp"
+
+namespace pop {
+
+class Simulation;
+
+/**
+ * @brief Check if a 64 cell row segment can be stepped by step_powder_segment. It must only hold powders, air and
+ * walls and have no liquid below it for its powders to sink into.
+ */
+[[nodiscard]] bool is_powder_segment(const Occupancy& occupancy, int row, int word_index);
+
+/**
+ * @brief Apply the powder fall and diagonal slide rules to all 64 cells of a row segment at once. Cells move into the
+ * row below, so rows have to be stepped from the bottom up like the per-cell kernels.
+ */
+void step_powder_segment(Simulation& simulation, int row, int word_index, util::WideRng& rng);
+
+}
@@ -0,0 +1,151 @@
+#include "brush.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <utility>
+
+#include "util/profiler.hpp"
+#include "util/rng.hpp"
+
+namespace pop {
+
+// A spray paints about one in this many of the cells it covers each time it is dragged over them
+inline constexpr uint64_t k_spray_sparseness = 16;
+
+/**
+ * @brief Get random bits for a cell of a stroke, the same for the same seed and cell wherever they are drawn
+ */
+static uint64_t cell_bits(uint32_t seed, Vector2i pos)
+{
+    return util::mix64(static_cast<uint64_t>(seed) << 32 ^ util::mix64(static_cast<uint64_t>(pos.y) << 32
+                                                             | static_cast<uint32_t>(pos.x)));
+}
+
+std::vector<BrushSpan> stroke_spans(const Brush& brush, Vector2i from, Vector2i to, uint32_t seed, Vector2i size)
+{
+    const int radius = std::clamp(brush.radius, 0, k_max_brush_radius);
+    // Half width of the brush on each row from its center
+    std::vector<int> half_widths(static_cast<std::size_t>(radius * 2 + 1));
+    for (int dy = -radius; dy <= radius; dy++) {
+        half_widths[dy + radius] = brush.shape == BrushShape::e_square
+            ? radius
+            : static_cast<int>(std::sqrt(static_cast<float>(radius * radius - dy * dy)) + 0.5f);
+    }
+
+    // The brush is convex, so the rows of it swept a cell at a time are each a single run
+    const int top = std::max(std::min(from.y, to.y) - radius, 0);
+    const int bottom = std::min(std::max(from.y, to.y) + radius, size.y - 1);
+    if (top > bottom) {
+        return {};
+    }
+    // Leftmost and rightmost cell swept on each row
+    const std::pair<int, int> unswept { std::numeric_limits<int>::max(), std::numeric_limits<int>::min() };
+    std::vector<std::pair<int, int>> rows(static_cast<std::size_t>(bottom - top + 1), unswept);
+    // Centers a cell apart along the line, merged into a run of centers for each row they are on
+    const int steps = std::max(std::abs(to.x - from.x), std::abs(to.y - from.y));
+    std::vector<std::pair<int, std::pair<int, int>>> center_runs;
+    for (int step = 0; step <= steps; step++) {
+        const Vector2i center = steps == 0 ? from
+                                           : Vector2i { from.x + (to.x - from.x) * step / steps,
+                                                 from.y + (to.y - from.y) * step / steps };
+        if (!center_runs.empty() && center_runs.back().first == center.y) {
+            auto& [left, right] = center_runs.back().second;
+            left = std::min(left, center.x);
+            right = std::max(right, center.x);
+        }
+        else {
+            center_runs.push_back({ center.y, { center.x, center.x } });
+        }
+    }
+    for (const auto& [center_y, centers] : center_runs) {
+        for (int dy = -radius; dy <= radius; dy++) {
+            const int y = center_y + dy;
+            if (y < top || y > bottom) {
+                continue;
+            }
+            auto& [left, right] = rows[y - top];
+            left = std::min(left, centers.first - half_widths[dy + radius]);
+            right = std::max(right, centers.second + half_widths[dy + radius]);
+        }
+    }
+
+    std::vector<BrushSpan> spans;
+    for (int y = top; y <= bottom; y++) {
+        const int left = std::max(rows[y - top].first, 0);
+        const int right = std::min(rows[y - top].second, size.x - 1);
+        if (left > right) {
+            continue;
+        }
+        if (brush.shape != BrushShape::e_spray) {
+            spans.push_back({ .start = { left, y }, .length = right - left + 1 });
+            continue;
+        }
+        for (int x = left; x <= right; x++) {
+            if (cell_bits(seed, { x, y }) % k_spray_sparseness != 0) {
+                continue;
+            }
+            if (!spans.empty() && spans.back().start.y == y && spans.back().start.x + spans.back().length == x) {
+                spans.back().length++;
+            }
+            else {
+                spans.push_back({ .start = { x, y }, .length = 1 });
+            }
+        }
+    }
+    return spans;
+}
+
+void paint_spans(Simulation& simulation, std::span<const BrushSpan> spans, ElementId element_id,
+    std::optional<float> shade, uint32_t seed, util::WorkerPool* pool)
+{
+    PROFILE_ZONE("paint_spans");
+    // Spans cut at chunk edges, by chunk and then in the order they are painted
+    const int chunks_x = (simulation.width() + k_chunk_size - 1) / k_chunk_size;
+    std::vector<std::pair<int, BrushSpan>> pieces;
+    for (const BrushSpan& span : spans) {
+        for (int x = span.start.x; x < span.start.x + span.length;) {
+            const int end = std::min((x / k_chunk_size + 1) * k_chunk_size, span.start.x + span.length);
+            const int chunk = span.start.y / k_chunk_size * chunks_x + x / k_chunk_size;
+            pieces.push_back({ chunk, { .start = { x, span.start.y }, .length = end - x } });
+            x = end;
+        }
+    }
+    std::stable_sort(
+        pieces.begin(), pieces.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    std::vector<std::size_t> chunk_starts;
+    for (std::size_t i = 0; i < pieces.size(); i++) {
+        if (i == 0 || pieces[i].first != pieces[i - 1].first) {
+            chunk_starts.push_back(i);
+        }
+    }
+    chunk_starts.push_back(pieces.size());
+
+    const int chunk_count = static_cast<int>(chunk_starts.size()) - 1;
+    // Strokes that stay in one chunk aren't worth waking workers for
+    util::parallel_for(chunk_count > 1 ? pool : nullptr, 0, chunk_count, [&](int start, int end, int) {
+        for (int c = start; c < end; c++) {
+            const int chunk = pieces[chunk_starts[c]].first;
+            const Vector2i origin { chunk % chunks_x * k_chunk_size, chunk / chunks_x * k_chunk_size };
+            // Writing through particle_at() copies the chunk if a snapshot shares it and marks it changed
+            Particle* cells = &simulation.particle_at(origin);
+            for (std::size_t i = chunk_starts[c]; i < chunk_starts[c + 1]; i++) {
+                const BrushSpan& piece = pieces[i].second;
+                Particle* row = cells + (piece.start.y - origin.y) * k_chunk_size + (piece.start.x - origin.x);
+                if (!shade.has_value()) {
+                    std::fill_n(row, piece.length, Particle { .element_id = element_id, .shade = 1.0f });
+                    continue;
+                }
+                for (int x = 0; x < piece.length; x++) {
+                    // Top 24 bits as a fraction
+                    const float t = static_cast<float>(cell_bits(~seed, { piece.start.x + x, piece.start.y }) >> 40)
+                        / static_cast<float>(1 << 24);
+                    row[x] = { .element_id = element_id, .shade = shade.value() + (1.0f - shade.value()) * t };
+                }
+            }
+        }
+    });
+}
+
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "simulation.hpp"
+#include "util/worker_pool.hpp"
+
+namespace pop {
+
+inline constexpr int k_max_brush_radius = 64;
+
+enum class BrushShape : uint8_t { e_circle, e_square, e_spray };
+
+struct Brush {
+    BrushShape shape = BrushShape::e_circle;
+    // Cells painted around the center in each direction, 0 paints a single cell
+    int radius = 0;
+};
+
+/**
+ * @brief Cells of a row painted by a stroke, from start to the right
+ */
+struct BrushSpan {
+    Vector2i start;
+    int length;
+};
+
+/**
+ * @brief Get the cells a brush covers when dragged along a line, as spans in row order that don't overlap. The line is
+ * stepped a cell at a time so fast strokes leave no gaps, and each row is a single span of the rows the brush swept
+ * except for spray, which only paints a scattered few of its cells picked by the seed.
+ * @param from - Start of the line, in the grid
+ * @param to - End of the line, in the grid
+ * @param size - Size of the grid, spans are clipped to it
+ */
+[[nodiscard]] std::vector<BrushSpan> stroke_spans(
+    const Brush& brush, Vector2i from, Vector2i to, uint32_t seed, Vector2i size);
+
+/**
+ * @brief Paint spans of cells with an element between updates. Spans are cut at chunk edges and the chunks painted in
+ * parallel, each chunk in one go with the spans it holds in order, and painted chunks are marked changed.
+ * @param shade - Lowest shade painted, each cell gets a shade between it and 1 picked by the seed. None paints every
+ * cell with shade 1, which fills a span like memset.
+ * @param pool - Pool to paint chunks on, or nullptr to paint them on the calling thread
+ */
+void paint_spans(Simulation& simulation, std::span<const BrushSpan> spans, ElementId element_id,
+    std::optional<float> shade, uint32_t seed, util::WorkerPool* pool);
+
+}
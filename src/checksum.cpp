@@ -0,0 +1,99 @@
+#include "checksum.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+
+#include "simulation.hpp"
+#include "util/profiler.hpp"
+#include "util/rng.hpp"
+
+namespace pop {
+
+ChunkHashes::ChunkHashes(int width, int height)
+    : m_chunks_x((width + k_chunk_size - 1) / k_chunk_size)
+    , m_chunks_y((height + k_chunk_size - 1) / k_chunk_size)
+{
+    m_dirty.resize(m_chunks_x * m_chunks_y, true);
+    m_hashes.resize(m_chunks_x * m_chunks_y);
+    for (int chunk = 0; chunk < chunk_count(); chunk++) {
+        m_checksum += contribution(chunk);
+    }
+}
+
+void ChunkHashes::mark_dirty(Vector2i pos)
+{
+    std::atomic_ref<uint8_t> dirty(m_dirty[(pos.y / k_chunk_size) * m_chunks_x + pos.x / k_chunk_size]);
+    dirty.store(true, std::memory_order_relaxed);
+}
+
+void ChunkHashes::mark_all_dirty()
+{
+    std::fill(m_dirty.begin(), m_dirty.end(), true);
+}
+
+static uint64_t hash_chunk(const Simulation& simulation, int chunk_x, int chunk_y)
+{
+    const int start_x = chunk_x * k_chunk_size;
+    const int end_x = std::min(start_x + k_chunk_size, simulation.width());
+    const int start_y = chunk_y * k_chunk_size;
+    const int end_y = std::min(start_y + k_chunk_size, simulation.height());
+    uint64_t hash = 0;
+    for (int y = start_y; y < end_y; y++) {
+        for (int x = start_x; x < end_x; x++) {
+            const Particle& particle = simulation.particle_at({ x, y });
+            const uint64_t bits = (static_cast<uint64_t>(particle.element_id) << 32)
+                | std::bit_cast<uint32_t>(particle.shade);
+            hash = util::mix64(hash ^ bits);
+        }
+    }
+    return hash;
+}
+
+uint64_t ChunkHashes::update(const Simulation& simulation, util::WorkerPool* pool)
+{
+    std::vector<int> dirty_chunks;
+    for (int chunk = 0; chunk < chunk_count(); chunk++) {
+        if (m_dirty[chunk]) {
+            dirty_chunks.push_back(chunk);
+            m_checksum -= contribution(chunk);
+        }
+    }
+
+    util::parallel_for(pool, 0, static_cast<int>(dirty_chunks.size()), [&](int start, int end, int) {
+        PROFILE_ZONE("hash_chunks");
+        for (int i = start; i < end; i++) {
+            const int chunk = dirty_chunks[i];
+            m_hashes[chunk] = hash_chunk(simulation, chunk % m_chunks_x, chunk / m_chunks_x);
+        }
+    });
+
+    for (int chunk : dirty_chunks) {
+        m_dirty[chunk] = false;
+        m_checksum += contribution(chunk);
+    }
+    return m_checksum;
+}
+
+uint64_t ChunkHashes::checksum() const
+{
+    return m_checksum;
+}
+
+int ChunkHashes::chunk_count() const
+{
+    return m_chunks_x * m_chunks_y;
+}
+
+uint64_t ChunkHashes::chunk_hash(int chunk) const
+{
+    return m_hashes.at(chunk);
+}
+
+// Mixed with the chunk index so identical chunks in different places don't cancel out
+uint64_t ChunkHashes::contribution(int chunk) const
+{
+    return util::mix64(m_hashes[chunk] ^ util::mix64(static_cast<uint64_t>(chunk)));
+}
+
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "common.hpp"
+#include "util/worker_pool.hpp"
+
+namespace pop {
+
+class Simulation;
+
+/**
+ * @brief Hashes of the grid kept per k_chunk_size square chunk. Writes mark their chunk dirty and only dirty chunks are
+ * rehashed, the checksum of the whole grid is combined from the chunk hashes so it doesn't depend on the order chunks
+ * are hashed in and is updated by swapping the old contribution of a chunk for the new one.
+ */
+class ChunkHashes {
+public:
+    ChunkHashes(int width, int height);
+
+    /**
+     * @brief Mark the chunk holding a cell as changed, safe to call from several threads at once
+     */
+    void mark_dirty(Vector2i pos);
+
+    void mark_all_dirty();
+
+    /**
+     * @brief Rehash every dirty chunk
+     * @param pool - Pool to hash chunks on, or nullptr to hash them on the calling thread
+     * @return - Checksum of the whole grid
+     */
+    uint64_t update(const Simulation& simulation, util::WorkerPool* pool);
+
+    [[nodiscard]] uint64_t checksum() const;
+
+    [[nodiscard]] int chunk_count() const;
+
+    [[nodiscard]] uint64_t chunk_hash(int chunk) const;
+
+private:
+    int m_chunks_x;
+    int m_chunks_y;
+    std::vector<uint8_t> m_dirty {};
+    std::vector<uint64_t> m_hashes {};
+    uint64_t m_checksum = 0;
+
+    [[nodiscard]] uint64_t contribution(int chunk) const;
+};
+
+}
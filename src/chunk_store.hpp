@@ -0,0 +1,40 @@
+#pragma once
+
+#include <optional>
+#include <span>
+
+#include "simulation.hpp"
+
+namespace pop {
+
+/**
+ * @brief Where a world keeps the k_chunk_size square chunks outside the window a simulation steps. Several threads may
+ * use a store at once as long as no two of them use the same chunk.
+ */
+class ChunkStore {
+public:
+    virtual ~ChunkStore() = default;
+
+    /**
+     * @brief Read the cells of a chunk, k_chunk_size rows of k_chunk_size cells
+     */
+    virtual void read(Vector2i chunk, std::span<Particle> cells) = 0;
+
+    /**
+     * @brief Write the cells of a chunk, k_chunk_size rows of k_chunk_size cells
+     */
+    virtual void write(Vector2i chunk, std::span<const Particle> cells) = 0;
+
+    /**
+     * @brief Wait for written chunks to be persisted, if the store persists them
+     */
+    virtual void flush() = 0;
+
+    /**
+     * @brief Get the size of the world in chunks, chunks are at 0 to size - 1. Nothing if the world is unbounded and
+     * chunks may be at any coordinates.
+     */
+    [[nodiscard]] virtual std::optional<Vector2i> size() const = 0;
+};
+
+}
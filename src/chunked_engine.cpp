@@ -0,0 +1,84 @@
+#include "chunked_engine.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+#include <span>
+#include <vector>
+
+#include "optimistic_engine.hpp"
+#include "simulation.hpp"
+#include "util/profiler.hpp"
+#include "util/rng.hpp"
+
+namespace pop {
+
+static void step_chunk(Simulation& simulation, const CellClaims& claims, int chunk_x, int chunk_y, int chunk_size,
+    std::span<int> rand_indices, util::Rng& rng)
+{
+    PROFILE_ZONE("step_chunk");
+    const int start_x = chunk_x * chunk_size;
+    const int end_x = std::min(start_x + chunk_size, simulation.width());
+    const int start_y = chunk_y * chunk_size;
+    const int end_y = std::min(start_y + chunk_size, simulation.height());
+
+    const int count = end_x - start_x;
+    std::iota(rand_indices.begin(), rand_indices.begin() + count, start_x);
+
+    for (int y = end_y - 1; y >= start_y; y--) {
+        for (int i = count - 1; i > 0; i--) {
+            std::swap(rand_indices[i], rand_indices[rng.range(0, i)]);
+        }
+        for (int i = 0; i < count; i++) {
+            const Vector2i pos { rand_indices[i], y };
+            // Claimed cells hold a particle that already moved this tick, possibly from a chunk stepped earlier
+            if (!claims.is_claimed(simulation.index_at(pos))) {
+                simulation.update_particle(pos);
+            }
+        }
+    }
+}
+
+void step_chunked(Simulation& simulation, CellClaims& claims, util::WorkerPool* pool, int chunk_size)
+{
+    assert(chunk_size > 0 && chunk_size % k_chunk_size == 0);
+    const int chunks_x = (simulation.width() + chunk_size - 1) / chunk_size;
+    const int chunks_y = (simulation.height() + chunk_size - 1) / chunk_size;
+    const uint64_t tick_seed = simulation.tick_seed();
+    claims.resize(simulation.width() * simulation.height());
+    claims.next_stamp();
+
+    std::vector<Vector2i> chunks;
+    chunks.reserve((chunks_x / 2 + 1) * (chunks_y / 2 + 1));
+    // Without a pool every chunk is stepped on the calling thread, which needs only one buffer
+    std::vector<int> serial_indices(pool == nullptr ? chunk_size : 0);
+    simulation.set_cell_claims(&claims);
+    // Four passes of chunks two apart on both axes, starting with the passes holding the bottom row of chunks
+    for (int pass = 0; pass < 4; pass++) {
+        const int parity_y = (chunks_y - 1 + pass / 2) % 2;
+        const int parity_x = pass % 2;
+        chunks.clear();
+        for (int chunk_y = parity_y; chunk_y < chunks_y; chunk_y += 2) {
+            for (int chunk_x = parity_x; chunk_x < chunks_x; chunk_x += 2) {
+                chunks.push_back({ chunk_x, chunk_y });
+            }
+        }
+
+        util::parallel_for(pool, 0, static_cast<int>(chunks.size()), [&](int start, int end, int worker) {
+            PROFILE_ZONE("chunk_batch");
+            const std::span<int> rand_indices
+                = pool != nullptr ? pool->scratch(worker).allocate<int>(chunk_size) : std::span<int>(serial_indices);
+            util::Rng rng;
+            Simulation::set_thread_rng(&rng);
+            for (int i = start; i < end; i++) {
+                const auto [chunk_x, chunk_y] = chunks[i];
+                rng.seed(util::mix64(tick_seed ^ static_cast<uint64_t>(chunk_y * chunks_x + chunk_x)));
+                step_chunk(simulation, claims, chunk_x, chunk_y, chunk_size, rand_indices, rng);
+            }
+            Simulation::set_thread_rng(nullptr);
+        });
+    }
+    simulation.set_cell_claims(nullptr);
+}
+
+}
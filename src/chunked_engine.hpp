@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+
+#include "common.hpp"
+#include "util/worker_pool.hpp"
+
+namespace pop {
+
+class CellClaims;
+class Simulation;
+
+/**
+ * @brief Step the simulation in square chunks of chunk_size cells. Chunks are stepped in four passes, each of chunks
+ * two apart on both axes, starting with the passes holding the bottom row of chunks. Chunks stepped at the same time
+ * never reach the same cells, and the occupancy words they share are updated atomically. Swaps claim their cells like
+ * in the optimistic engine, so a particle that moves into a chunk stepped later in the tick isn't stepped twice.
+ * Within a chunk rows go bottom up in a shuffled order like the serial engine, drawing from a generator seeded per
+ * chunk and tick, so the result doesn't depend on how chunks are split between threads.
+ * @param claims - Claim words of the cells, kept between ticks
+ * @param pool - Pool to step the chunks of a pass on, or nullptr to run on the calling thread
+ * @param chunk_size - Side of the chunks, a multiple of k_chunk_size
+ */
+void step_chunked(Simulation& simulation, CellClaims& claims, util::WorkerPool* pool, int chunk_size = k_chunk_size);
+
+}
@@ -10,6 +10,13 @@ struct Vector2i {
     int y;
 };
 
+namespace pop {
+
+// Side of a chunk in cells, one occupancy word wide
+inline constexpr int k_chunk_size = 64;
+
+}
+
 template <typename T>
 T inline pick_rand(std::vector<T>& vals)
 {
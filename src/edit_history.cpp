@@ -0,0 +1,327 @@
+#include "edit_history.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <limits>
+#include <stdexcept>
+
+#include "util/bytes.hpp"
+#include "util/logger.hpp"
+
+namespace pop {
+
+inline constexpr int k_chunk_cells = k_chunk_size * k_chunk_size;
+static_assert(k_chunk_size == 64, "Strokes keep a word of written cells for each row of a chunk");
+
+// Rough size of a chunk of the open stroke, with the node of the map around it
+inline constexpr std::size_t k_stroke_chunk_bytes = sizeof(Particle) * k_chunk_cells + k_chunk_cells / 8 + 64;
+
+static bool same_particle(const Particle& a, const Particle& b)
+{
+    return a.element_id == b.element_id && std::bit_cast<uint32_t>(a.shade) == std::bit_cast<uint32_t>(b.shade);
+}
+
+void CellDiffWriter::add(uint32_t index, const Particle& particle)
+{
+    if (m_values.empty() || index != m_run_end) {
+        close_run();
+        m_run_start = index;
+        m_values.emplace_back(1, particle);
+    }
+    else if (same_particle(m_values.back().second, particle)) {
+        m_values.back().first++;
+    }
+    else {
+        m_values.emplace_back(1, particle);
+    }
+    m_run_end = index + 1;
+}
+
+std::vector<uint8_t> CellDiffWriter::finish()
+{
+    close_run();
+    m_previous_end = 0;
+    return std::move(m_data);
+}
+
+void CellDiffWriter::close_run()
+{
+    if (m_values.empty()) {
+        return;
+    }
+    util::put_varint(m_data, m_run_start - m_previous_end);
+    util::put_varint(m_data, m_run_end - m_run_start);
+    for (const auto& [repeat, particle] : m_values) {
+        util::put_varint(m_data, repeat);
+        util::put_varint(m_data, particle.element_id);
+        util::put_u32(m_data, std::bit_cast<uint32_t>(particle.shade));
+    }
+    m_previous_end = m_run_end;
+    m_values.clear();
+}
+
+/**
+ * @brief Call func(index, particle) for every cell of a diff, throws if the diff is corrupt
+ */
+template <typename F>
+static void for_each_cell(std::span<const uint8_t> diff, uint64_t cell_count, uint32_t element_count, F&& func)
+{
+    util::ByteReader reader(diff, "Cell diff");
+    uint64_t index = 0;
+    while (!reader.at_end()) {
+        index += reader.varint();
+        const uint32_t length = reader.varint();
+        if (length == 0 || index + length > cell_count) {
+            throw std::runtime_error("Cell diff runs past the grid");
+        }
+        for (uint32_t covered = 0; covered < length;) {
+            const uint32_t repeat = reader.varint();
+            const uint32_t element = reader.varint();
+            const float shade = std::bit_cast<float>(reader.u32());
+            if (repeat == 0 || repeat > length - covered || element > element_count) {
+                throw std::runtime_error("Cell diff is corrupt");
+            }
+            const Particle particle { .element_id = static_cast<ElementId>(element), .shade = shade };
+            for (uint32_t i = 0; i < repeat; i++) {
+                func(static_cast<uint32_t>(index + covered + i), particle);
+            }
+            covered += repeat;
+        }
+        index += length;
+    }
+}
+
+static uint64_t cell_count(const Simulation& simulation)
+{
+    return static_cast<uint64_t>(simulation.width()) * simulation.height();
+}
+
+void apply_cell_diff(Simulation& simulation, std::span<const uint8_t> diff)
+{
+    const uint64_t cells = cell_count(simulation);
+    const auto element_count = static_cast<uint32_t>(simulation.element_count());
+    for_each_cell(diff, cells, element_count, [](uint32_t, const Particle&) {});
+    const int width = simulation.width();
+    for_each_cell(diff, cells, element_count, [&](uint32_t index, const Particle& particle) {
+        simulation.set_particle({ static_cast<int>(index) % width, static_cast<int>(index) / width }, particle);
+    });
+}
+
+std::vector<uint8_t> read_cell_diff(const Simulation& simulation, std::span<const uint8_t> diff)
+{
+    const int width = simulation.width();
+    CellDiffWriter writer;
+    for_each_cell(diff, cell_count(simulation), static_cast<uint32_t>(simulation.element_count()),
+        [&](uint32_t index, const Particle&) {
+            const Vector2i pos { static_cast<int>(index) % width, static_cast<int>(index) / width };
+            writer.add(index, simulation.particle_at(pos));
+        });
+    return writer.finish();
+}
+
+std::vector<uint8_t> map_cell_diff(std::span<const uint8_t> diff, std::span<const ElementId> ids)
+{
+    CellDiffWriter writer;
+    for_each_cell(diff, std::numeric_limits<uint32_t>::max(), static_cast<uint32_t>(ids.size() - 1),
+        [&](uint32_t index, Particle particle) {
+            particle.element_id = ids[particle.element_id];
+            writer.add(index, particle);
+        });
+    return writer.finish();
+}
+
+EditHistory::EditHistory(std::size_t budget)
+    : m_budget(budget)
+{
+}
+
+void EditHistory::record(const Simulation& simulation, Vector2i start, int length)
+{
+    check_size(simulation);
+    for (int x = start.x; x < start.x + length && !m_overflowed;) {
+        const int end = std::min((x / k_chunk_size + 1) * k_chunk_size, start.x + length);
+        const int chunk = start.y / k_chunk_size * m_chunks_x + x / k_chunk_size;
+        auto [it, added] = m_stroke.try_emplace(chunk);
+        if (added) {
+            if (!fit_stroke()) {
+                return;
+            }
+            it->second.cells.resize(k_chunk_cells);
+        }
+        // A row of a chunk is a word of written
+        StrokeChunk& stroke_chunk = it->second;
+        const int row = start.y % k_chunk_size;
+        const int first = x % k_chunk_size;
+        const int count = end - x;
+        uint64_t& written = stroke_chunk.written[row];
+        const uint64_t cells = (count == 64 ? ~uint64_t(0) : (uint64_t(1) << count) - 1) << first;
+        const Particle* source = &simulation.particle_at({ x, start.y }) - first;
+        Particle* before = stroke_chunk.cells.data() + row * k_chunk_size;
+        if ((written & cells) == 0) {
+            std::copy_n(source + first, count, before + first);
+        }
+        else {
+            for (uint64_t unwritten = cells & ~written; unwritten != 0; unwritten &= unwritten - 1) {
+                const int i = std::countr_zero(unwritten);
+                before[i] = source[i];
+            }
+        }
+        written |= cells;
+        x = end;
+    }
+}
+
+bool EditHistory::fit_stroke()
+{
+    while (m_bytes + stroke_bytes() > m_budget && !m_undo.empty()) {
+        m_bytes -= m_undo.front().size();
+        m_undo.pop_front();
+    }
+    if (stroke_bytes() > m_budget) {
+        POP_LOG_WARN("Stroke is too large to undo");
+        m_stroke.clear();
+        m_overflowed = true;
+        return false;
+    }
+    return true;
+}
+
+void EditHistory::record_grid(const Simulation& simulation)
+{
+    end_stroke();
+    check_size(simulation);
+    CellDiffWriter writer;
+    for (int y = 0; y < m_height; y++) {
+        for (int x = 0; x < m_width; x++) {
+            writer.add(static_cast<uint32_t>(y * m_width + x), simulation.particle_at({ x, y }));
+        }
+    }
+    for (const std::vector<uint8_t>& diff : m_redo) {
+        m_bytes -= diff.size();
+    }
+    m_redo.clear();
+    push(m_undo, writer.finish());
+}
+
+void EditHistory::end_stroke()
+{
+    if (m_stroke.empty() && !m_overflowed) {
+        return;
+    }
+    // Undoing what came before a stroke that wasn't recorded still works cell by cell, but redoing past it doesn't
+    for (const std::vector<uint8_t>& diff : m_redo) {
+        m_bytes -= diff.size();
+    }
+    m_redo.clear();
+    m_overflowed = false;
+    if (m_stroke.empty()) {
+        return;
+    }
+
+    // Cells go into the diff by index, a row of chunks at a time and a row of cells of each chunk at a time
+    std::vector<int> chunks;
+    chunks.reserve(m_stroke.size());
+    for (const auto& [chunk, stroke_chunk] : m_stroke) {
+        chunks.push_back(chunk);
+    }
+    std::sort(chunks.begin(), chunks.end());
+    CellDiffWriter writer;
+    for (auto row_start = chunks.begin(); row_start != chunks.end();) {
+        const int chunk_y = *row_start / m_chunks_x;
+        const auto row_end
+            = std::find_if(row_start, chunks.end(), [&](int chunk) { return chunk / m_chunks_x != chunk_y; });
+        for (int y = 0; y < k_chunk_size; y++) {
+            for (auto chunk = row_start; chunk != row_end; chunk++) {
+                const StrokeChunk& stroke_chunk = m_stroke.at(*chunk);
+                const Vector2i origin { *chunk % m_chunks_x * k_chunk_size, chunk_y * k_chunk_size + y };
+                const uint32_t row_index = static_cast<uint32_t>(origin.y * m_width + origin.x);
+                for (uint64_t written = stroke_chunk.written[y]; written != 0; written &= written - 1) {
+                    const int x = std::countr_zero(written);
+                    writer.add(row_index + x, stroke_chunk.cells[y * k_chunk_size + x]);
+                }
+            }
+        }
+        row_start = row_end;
+    }
+    m_stroke.clear();
+    push(m_undo, writer.finish());
+}
+
+std::optional<Edit> EditHistory::undo(const Simulation& simulation)
+{
+    end_stroke();
+    check_size(simulation);
+    return move_top(simulation, m_undo, m_redo);
+}
+
+std::optional<Edit> EditHistory::redo(const Simulation& simulation)
+{
+    end_stroke();
+    check_size(simulation);
+    return move_top(simulation, m_redo, m_undo);
+}
+
+std::size_t EditHistory::undo_count() const
+{
+    return m_undo.size();
+}
+
+std::size_t EditHistory::redo_count() const
+{
+    return m_redo.size();
+}
+
+std::size_t EditHistory::memory_bytes() const
+{
+    return m_bytes + stroke_bytes();
+}
+
+void EditHistory::check_size(const Simulation& simulation)
+{
+    if (simulation.width() == m_width && simulation.height() == m_height) {
+        return;
+    }
+    m_undo.clear();
+    m_redo.clear();
+    m_bytes = 0;
+    m_stroke.clear();
+    m_overflowed = false;
+    m_width = simulation.width();
+    m_height = simulation.height();
+    m_chunks_x = (m_width + k_chunk_size - 1) / k_chunk_size;
+}
+
+std::size_t EditHistory::stroke_bytes() const
+{
+    return m_stroke.size() * k_stroke_chunk_bytes;
+}
+
+void EditHistory::push(std::deque<std::vector<uint8_t>>& stack, std::vector<uint8_t> diff)
+{
+    diff.shrink_to_fit();
+    m_bytes += diff.size();
+    stack.push_back(std::move(diff));
+    while (m_bytes + stroke_bytes() > m_budget) {
+        std::deque<std::vector<uint8_t>>& oldest = m_undo.empty() ? m_redo : m_undo;
+        if (oldest.empty()) {
+            break;
+        }
+        m_bytes -= oldest.front().size();
+        oldest.pop_front();
+    }
+}
+
+std::optional<Edit> EditHistory::move_top(
+    const Simulation& simulation, std::deque<std::vector<uint8_t>>& from, std::deque<std::vector<uint8_t>>& to)
+{
+    if (from.empty()) {
+        return std::nullopt;
+    }
+    std::vector<uint8_t> diff = std::move(from.back());
+    from.pop_back();
+    m_bytes -= diff.size();
+    push(to, read_cell_diff(simulation, diff));
+    return Edit { .type = EditType::e_cells, .cells = std::move(diff) };
+}
+
+}
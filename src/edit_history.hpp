@@ -0,0 +1,152 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "replay.hpp"
+#include "simulation.hpp"
+
+namespace pop {
+
+/**
+ * @brief Builds a cell diff: some cells of a grid, by index y * width + x, as a sparse run-length list. Runs of
+ * consecutive cells are stored as the cells skipped since the last run and the length of the run, followed by the
+ * values of the run as repeats of equal cells, so painting over a uniform area takes a few bytes.
+ */
+class CellDiffWriter {
+public:
+    /**
+     * @brief Add a cell, after any cell of a lower index
+     */
+    void add(uint32_t index, const Particle& particle);
+
+    [[nodiscard]] std::vector<uint8_t> finish();
+
+private:
+    std::vector<uint8_t> m_data {};
+    uint32_t m_run_start = 0;
+    uint32_t m_run_end = 0;
+    uint32_t m_previous_end = 0;
+    // Values of the open run, as repeats of equal cells
+    std::vector<std::pair<uint32_t, Particle>> m_values {};
+
+    void close_run();
+};
+
+/**
+ * @brief Write the cells of a diff into a simulation between updates, throws if the diff is corrupt or runs past the
+ * grid. Cells are checked before any is written.
+ */
+void apply_cell_diff(Simulation& simulation, std::span<const uint8_t> diff);
+
+/**
+ * @brief Get a diff of the cells of a simulation at the positions of another diff, as they are now
+ */
+[[nodiscard]] std::vector<uint8_t> read_cell_diff(const Simulation& simulation, std::span<const uint8_t> diff);
+
+/**
+ * @brief Get a diff with the elements of its cells swapped for the ids they map to, throws if the diff is corrupt
+ * @param ids - Id each element of the diff maps to, by element
+ */
+[[nodiscard]] std::vector<uint8_t> map_cell_diff(std::span<const uint8_t> diff, std::span<const ElementId> ids);
+
+/**
+ * @brief Undo and redo stacks of the cells edits overwrote. Cells are recorded as they were before the first write of
+ * a stroke, into a copy of each chunk it writes with a bit per cell written, and the stroke is stored as a cell diff
+ * once it ends, so it holds only the cells it overwrote. Undoing an
+ * edit writes those cells back and nothing else, so the rest of the grid keeps running. The cells it replaces go onto
+ * the redo stack in turn. The stacks are kept under a byte budget by dropping the oldest edits, and a stroke that
+ * grows past the budget stops being recorded and can't be undone.
+ */
+class EditHistory {
+public:
+    /**
+     * @param budget - Bytes the stacks and the open stroke take at most
+     */
+    explicit EditHistory(std::size_t budget);
+
+    /**
+     * @brief Record a row of cells before an edit writes them, opening a stroke if none is open. Only the first write
+     * of a cell in a stroke is kept.
+     * @param length - Cells from start to the right, all in the grid
+     */
+    void record(const Simulation& simulation, Vector2i start, int length = 1);
+
+    /**
+     * @brief Record every cell before an edit writes the whole grid, as an edit of its own
+     */
+    void record_grid(const Simulation& simulation);
+
+    /**
+     * @brief End the open stroke, if any, and push it onto the undo stack. Clears the redo stack.
+     */
+    void end_stroke();
+
+    /**
+     * @brief Take the last edit off the undo stack and move the cells it overwrote, as they are now, onto the redo
+     * stack. Ends the open stroke first.
+     * @return - An edit writing back the cells the edit overwrote, none if there is nothing to undo
+     */
+    [[nodiscard]] std::optional<Edit> undo(const Simulation& simulation);
+
+    /**
+     * @brief Take the last undone edit off the redo stack and move the cells it writes, as they are now, back onto the
+     * undo stack
+     * @return - An edit writing the cells back, none if there is nothing to redo
+     */
+    [[nodiscard]] std::optional<Edit> redo(const Simulation& simulation);
+
+    [[nodiscard]] std::size_t undo_count() const;
+
+    [[nodiscard]] std::size_t redo_count() const;
+
+    [[nodiscard]] std::size_t memory_bytes() const;
+
+private:
+    const std::size_t m_budget;
+    std::deque<std::vector<uint8_t>> m_undo {};
+    std::deque<std::vector<uint8_t>> m_redo {};
+    /**
+     * @brief Cells of a k_chunk_size square chunk as they were before the open stroke wrote them
+     */
+    struct StrokeChunk {
+        std::vector<Particle> cells {};
+        // Bit per cell of cells, set once the stroke wrote it, a word for each row
+        std::array<uint64_t, k_chunk_size> written {};
+    };
+
+    std::size_t m_bytes = 0;
+    // Chunks the open stroke wrote, by index
+    std::unordered_map<int, StrokeChunk> m_stroke {};
+    // Whether the open stroke grew past the budget and is no longer recorded
+    bool m_overflowed = false;
+    int m_width = 0;
+    int m_height = 0;
+    int m_chunks_x = 0;
+
+    void check_size(const Simulation& simulation);
+
+    [[nodiscard]] std::size_t stroke_bytes() const;
+
+    /**
+     * @brief Drop the oldest edits until the open stroke fits in the budget, or stop recording it if it can't
+     * @return - False if the stroke no longer fits
+     */
+    bool fit_stroke();
+
+    /**
+     * @brief Push an edit onto a stack and drop the oldest edits until everything fits in the budget
+     */
+    void push(std::deque<std::vector<uint8_t>>& stack, std::vector<uint8_t> diff);
+
+    std::optional<Edit> move_top(const Simulation& simulation, std::deque<std::vector<uint8_t>>& from,
+        std::deque<std::vector<uint8_t>>& to);
+};
+
+}
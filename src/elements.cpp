@@ -1,138 +1,123 @@
 #include "elements.hpp"
 
+#include <utility>
+
 #include "simulation.hpp"
 
 namespace pop {
 
-void update_salt(Simulation& simulation, Vector2i particle_pos)
+/**
+ * @brief Turn the particle into another element if any of its neighbors is of the given liquid element. The neighbors
+ * are only looked up when the liquid plane says one is there.
+ */
+static bool react_with_neighbor(
+    Simulation& simulation, Vector2i particle_pos, const std::string& neighbor_name, const std::string& result_name)
 {
-    Vector2i bottom_pos { particle_pos.x, particle_pos.y + 1 };
-    if (simulation.in_bounds(bottom_pos)) {
-        int rand_val;
-        if (simulation.type_at(bottom_pos) == ElementType::e_null) {
-            rand_val = GetRandomValue(0, 5);
-            if (rand_val <= 4) {
-                simulation.swap(particle_pos, bottom_pos);
-            }
-            return;
+    uint8_t liquid = simulation.neighbor_mask(particle_pos, ElementType::e_liquid);
+    for (int bit = 0; liquid != 0; bit++, liquid >>= 1) {
+        if ((liquid & 1) == 0) {
+            continue;
         }
-        if (simulation.type_at(bottom_pos) == ElementType::e_liquid) {
-            rand_val = GetRandomValue(0, 20);
-            if (rand_val < 5) {
-                simulation.swap(particle_pos, bottom_pos);
-            }
-            return;
+        Vector2i pos { particle_pos.x + neighbor::offsets[bit].x, particle_pos.y + neighbor::offsets[bit].y };
+        if (simulation.id_at(pos) == simulation.id_of(neighbor_name)) {
+            simulation.change_element(particle_pos, result_name);
+            return true;
         }
     }
-
-    int rand_side = GetRandomValue(0, 1);
-    if (rand_side == 0) {
-        rand_side = -1;
-    }
-    Vector2i side_pos { particle_pos.x + rand_side, particle_pos.y + 1 };
-    if (simulation.in_bounds(side_pos)
-        && (simulation.type_at(side_pos) == ElementType::e_null
-            || simulation.type_at(side_pos) == ElementType::e_liquid)) {
-        simulation.swap(particle_pos, side_pos);
-        return;
-    }
+    return false;
 }
 
-void update_water(Simulation& simulation, Vector2i particle_pos)
+static void flow_liquid(Simulation& simulation, Vector2i particle_pos)
 {
-    for (int x = -1; x <= 1; x++) {
-        for (int y = -1; y <= 1; y++) {
-            if (x == 0 && y == 0) {
-                continue;
-            }
-            if (!simulation.in_bounds({ particle_pos.x + x, particle_pos.y + y })) {
-                continue;
-            }
-            if (simulation.element_at({ particle_pos.x + x, particle_pos.y + y }).name == "lava") {
-                simulation.change_element(particle_pos, "steam");
-                return;
-            }
-        }
+    uint8_t empty = simulation.neighbor_mask(particle_pos, ElementType::e_null);
+    if ((empty & (neighbor::bottom_row | neighbor::left | neighbor::right)) == 0) {
+        return;
     }
 
-    Vector2i bottom_pos { particle_pos.x, particle_pos.y + 1 };
-    if (simulation.in_bounds(bottom_pos) && simulation.type_at(bottom_pos) == ElementType::e_null) {
-        if (GetRandomValue(0, 5) < 5) {
-            simulation.swap(particle_pos, bottom_pos);
+    if (empty & neighbor::bottom) {
+        if (simulation.random(0, 5) < 5) {
+            simulation.swap(particle_pos, { particle_pos.x, particle_pos.y + 1 });
         }
         return;
     }
 
-    std::vector<int> sides = { -1, 1 };
-    simple_shuffle<int>(sides);
+    std::array<int, 2> sides = { -1, 1 };
+    if (simulation.random(0, 1) == 0) {
+        std::swap(sides[0], sides[1]);
+    }
 
     for (int side : sides) {
-        Vector2i side_below_pos { particle_pos.x + side, particle_pos.y + 1 };
-        if (simulation.in_bounds(side_below_pos) && simulation.type_at(side_below_pos) == ElementType::e_null) {
-            simulation.swap(particle_pos, side_below_pos);
+        if (empty & (side < 0 ? neighbor::bottom_left : neighbor::bottom_right)) {
+            simulation.swap(particle_pos, { particle_pos.x + side, particle_pos.y + 1 });
             return;
         }
     }
 
-    int rand_side = sides.at(0);
-
-    Vector2i side_pos { particle_pos.x + rand_side, particle_pos.y };
-    if (simulation.in_bounds(side_pos) && simulation.type_at(side_pos) == ElementType::e_null) {
-        simulation.swap(particle_pos, side_pos);
+    int rand_side = sides[0];
+    if (empty & (rand_side < 0 ? neighbor::left : neighbor::right)) {
+        simulation.swap(particle_pos, { particle_pos.x + rand_side, particle_pos.y });
         return;
     }
 }
 
-void update_lava(Simulation& simulation, Vector2i particle_pos)
+void update_salt(Simulation& simulation, Vector2i particle_pos)
 {
-    for (int x = -1; x <= 1; x++) {
-        for (int y = -1; y <= 1; y++) {
-            if (x == 0 && y == 0) {
-                continue;
-            }
-            if (!simulation.in_bounds({ particle_pos.x + x, particle_pos.y + y })) {
-                continue;
-            }
-            if (simulation.element_at({ particle_pos.x + x, particle_pos.y + y }).name == "water") {
-                simulation.change_element(particle_pos, "stone");
-                return;
-            }
-        }
+    uint8_t empty = simulation.neighbor_mask(particle_pos, ElementType::e_null);
+    uint8_t liquid = simulation.neighbor_mask(particle_pos, ElementType::e_liquid);
+    if (((empty | liquid) & neighbor::bottom_row) == 0) {
+        return;
     }
 
     Vector2i bottom_pos { particle_pos.x, particle_pos.y + 1 };
-    if (simulation.in_bounds(bottom_pos) && simulation.type_at(bottom_pos) == ElementType::e_null) {
-        if (GetRandomValue(0, 5) < 5) {
+    int rand_val;
+    if (empty & neighbor::bottom) {
+        rand_val = simulation.random(0, 5);
+        if (rand_val <= 4) {
             simulation.swap(particle_pos, bottom_pos);
         }
         return;
     }
-
-    std::vector<int> sides = { -1, 1 };
-    simple_shuffle<int>(sides);
-
-    for (int side : sides) {
-        Vector2i side_below_pos { particle_pos.x + side, particle_pos.y + 1 };
-        if (simulation.in_bounds(side_below_pos) && simulation.type_at(side_below_pos) == ElementType::e_null) {
-            simulation.swap(particle_pos, side_below_pos);
-            return;
+    if (liquid & neighbor::bottom) {
+        rand_val = simulation.random(0, 20);
+        if (rand_val < 5) {
+            simulation.swap(particle_pos, bottom_pos);
         }
+        return;
     }
 
-    int rand_side = sides.at(0);
+    int rand_side = simulation.random(0, 1);
+    uint8_t side_bit = neighbor::bottom_right;
+    if (rand_side == 0) {
+        rand_side = -1;
+        side_bit = neighbor::bottom_left;
+    }
+    if ((empty | liquid) & side_bit) {
+        simulation.swap(particle_pos, { particle_pos.x + rand_side, particle_pos.y + 1 });
+        return;
+    }
+}
+
+void update_water(Simulation& simulation, Vector2i particle_pos)
+{
+    if (react_with_neighbor(simulation, particle_pos, "lava", "steam")) {
+        return;
+    }
+    flow_liquid(simulation, particle_pos);
+}
 
-    Vector2i side_pos { particle_pos.x + rand_side, particle_pos.y };
-    if (simulation.in_bounds(side_pos) && simulation.type_at(side_pos) == ElementType::e_null) {
-        simulation.swap(particle_pos, side_pos);
+void update_lava(Simulation& simulation, Vector2i particle_pos)
+{
+    if (react_with_neighbor(simulation, particle_pos, "water", "stone")) {
         return;
     }
+    flow_liquid(simulation, particle_pos);
 }
 
 void update_steam(Simulation& simulation, Vector2i particle_pos)
 {
-    std::vector<int> rand_sides = { -1, 0, 1 };
-    std::vector<int> rand_vert = { -1, -1, -1, 0, 1 };
-    Vector2i rand_rel { pick_rand<int>(rand_sides), pick_rand<int>(rand_vert) };
+    static constexpr std::array<int, 3> rand_sides = { -1, 0, 1 };
+    static constexpr std::array<int, 5> rand_vert = { -1, -1, -1, 0, 1 };
+    Vector2i rand_rel { rand_sides.at(simulation.random(0, 2)), rand_vert.at(simulation.random(0, 4)) };
     if (rand_rel.x == 0 && rand_rel.y == 0) {
         return;
     }
@@ -142,7 +127,7 @@ void update_steam(Simulation& simulation, Vector2i particle_pos)
         return;
     }
 
-    Particle& p = simulation.particle_at(rand_pos);
+    const Particle& p = std::as_const(simulation).particle_at(rand_pos);
 
     if (simulation.type_of(p.element_id) == ElementType::e_liquid) {
         if (rand_rel.y != 0 && rand_rel.y != 1) {
@@ -151,9 +136,9 @@ void update_steam(Simulation& simulation, Vector2i particle_pos)
         }
     }
 
-    if (simulation.element_of(p.element_id).type == ElementType::e_null
+    if (simulation.type_of(p.element_id) == ElementType::e_null
         || simulation.type_of(p.element_id) == ElementType::e_gas) {
-        if (GetRandomValue(0, 4) < 1) {
+        if (simulation.random(0, 4) < 1) {
             simulation.swap(particle_pos, rand_pos);
         }
         return;
@@ -162,34 +147,37 @@ void update_steam(Simulation& simulation, Vector2i particle_pos)
 
 void update_stone(Simulation& simulation, Vector2i particle_pos)
 {
+    uint8_t empty = simulation.neighbor_mask(particle_pos, ElementType::e_null);
+    uint8_t liquid = simulation.neighbor_mask(particle_pos, ElementType::e_liquid);
+    if (((empty | liquid) & neighbor::bottom_row) == 0) {
+        return;
+    }
+
     Vector2i bottom_pos { particle_pos.x, particle_pos.y + 1 };
-    if (simulation.in_bounds(bottom_pos)) {
-        int rand_val;
-        if (simulation.type_at(bottom_pos) == ElementType::e_null) {
-            rand_val = GetRandomValue(0, 5);
-            if (rand_val <= 4) {
-                simulation.swap(particle_pos, bottom_pos);
-            }
-            return;
+    int rand_val;
+    if (empty & neighbor::bottom) {
+        rand_val = simulation.random(0, 5);
+        if (rand_val <= 4) {
+            simulation.swap(particle_pos, bottom_pos);
         }
-        if (simulation.type_at(bottom_pos) == ElementType::e_liquid) {
-            rand_val = GetRandomValue(0, 20);
-            if (rand_val < 5) {
-                simulation.swap(particle_pos, bottom_pos);
-            }
-            return;
+        return;
+    }
+    if (liquid & neighbor::bottom) {
+        rand_val = simulation.random(0, 20);
+        if (rand_val < 5) {
+            simulation.swap(particle_pos, bottom_pos);
         }
+        return;
     }
 
-    int rand_side = GetRandomValue(0, 1);
+    int rand_side = simulation.random(0, 1);
+    uint8_t side_bit = neighbor::bottom_right;
     if (rand_side == 0) {
         rand_side = -1;
+        side_bit = neighbor::bottom_left;
     }
-    Vector2i side_pos { particle_pos.x + rand_side, particle_pos.y + 1 };
-    if (simulation.in_bounds(side_pos)
-        && (simulation.type_at(side_pos) == ElementType::e_null
-            || simulation.type_at(side_pos) == ElementType::e_liquid)) {
-        simulation.swap(particle_pos, side_pos);
+    if ((empty | liquid) & side_bit) {
+        simulation.swap(particle_pos, { particle_pos.x + rand_side, particle_pos.y + 1 });
         return;
     }
 }
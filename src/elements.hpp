@@ -12,6 +12,8 @@ namespace pop {
 
 class Simulation;
 
+using ElementId = uint32_t;
+
 enum class ElementType {
     e_null,
     e_powder,
@@ -37,6 +39,8 @@ struct Element {
     ElementType type;
     std::function<void(Simulation&, Vector2i)> update_func;
     rl::Color color;
+    // Powder that follows the salt/stone rules, or air/wall that does nothing, so the bitsliced fast path may step it
+    bool bitsliced = false;
 };
 
 std::string to_string(Element type);
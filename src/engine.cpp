@@ -0,0 +1,170 @@
+#include "engine.hpp"
+
+#include "chunked_engine.hpp"
+#include "intent_engine.hpp"
+#include "margolus.hpp"
+#include "optimistic_engine.hpp"
+#include "simulation.hpp"
+
+namespace pop {
+
+class SerialEngine : public Engine {
+public:
+    [[nodiscard]] std::string_view name() const override
+    {
+        return "serial";
+    }
+
+    [[nodiscard]] bool parallel() const override
+    {
+        return false;
+    }
+
+    [[nodiscard]] bool deterministic() const override
+    {
+        return true;
+    }
+
+    void step(Simulation& simulation, uint64_t, util::WorkerPool*) override
+    {
+        simulation.step_serial();
+    }
+};
+
+class ChunkedEngine : public Engine {
+public:
+    explicit ChunkedEngine(int chunk_size)
+        : m_chunk_size(chunk_size)
+    {
+    }
+
+    [[nodiscard]] std::string_view name() const override
+    {
+        return "chunked";
+    }
+
+    [[nodiscard]] bool parallel() const override
+    {
+        return true;
+    }
+
+    [[nodiscard]] bool deterministic() const override
+    {
+        return true;
+    }
+
+    void step(Simulation& simulation, uint64_t, util::WorkerPool* pool) override
+    {
+        step_chunked(simulation, m_claims, pool, m_chunk_size);
+    }
+
+private:
+    int m_chunk_size;
+    CellClaims m_claims {};
+};
+
+class OptimisticEngine : public Engine {
+public:
+    [[nodiscard]] std::string_view name() const override
+    {
+        return "optimistic";
+    }
+
+    [[nodiscard]] bool parallel() const override
+    {
+        return true;
+    }
+
+    [[nodiscard]] bool deterministic() const override
+    {
+        return false;
+    }
+
+    void step(Simulation& simulation, uint64_t, util::WorkerPool* pool) override
+    {
+        step_optimistic(simulation, m_claims, pool);
+    }
+
+private:
+    CellClaims m_claims {};
+};
+
+class IntentEngine : public Engine {
+public:
+    [[nodiscard]] std::string_view name() const override
+    {
+        return "intent";
+    }
+
+    [[nodiscard]] bool parallel() const override
+    {
+        return true;
+    }
+
+    [[nodiscard]] bool deterministic() const override
+    {
+        return true;
+    }
+
+    void step(Simulation& simulation, uint64_t, util::WorkerPool* pool) override
+    {
+        step_intents(simulation, m_intents, pool);
+    }
+
+private:
+    Intents m_intents {};
+};
+
+class MargolusEngine : public Engine {
+public:
+    [[nodiscard]] std::string_view name() const override
+    {
+        return "margolus";
+    }
+
+    [[nodiscard]] bool parallel() const override
+    {
+        return true;
+    }
+
+    [[nodiscard]] bool deterministic() const override
+    {
+        return true;
+    }
+
+    void step(Simulation& simulation, uint64_t tick, util::WorkerPool* pool) override
+    {
+        step_margolus(simulation, m_rules, tick, pool);
+    }
+
+private:
+    MargolusRules m_rules {};
+};
+
+const std::vector<std::string_view>& engine_names()
+{
+    static const std::vector<std::string_view> names { "serial", "chunked", "optimistic", "intent", "margolus" };
+    return names;
+}
+
+std::unique_ptr<Engine> make_engine(std::string_view name, int chunk_size)
+{
+    if (name == "serial") {
+        return std::make_unique<SerialEngine>();
+    }
+    if (name == "chunked") {
+        return std::make_unique<ChunkedEngine>(chunk_size);
+    }
+    if (name == "optimistic") {
+        return std::make_unique<OptimisticEngine>();
+    }
+    if (name == "intent") {
+        return std::make_unique<IntentEngine>();
+    }
+    if (name == "margolus") {
+        return std::make_unique<MargolusEngine>();
+    }
+    return nullptr;
+}
+
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "common.hpp"
+#include "util/worker_pool.hpp"
+
+namespace pop {
+
+class Simulation;
+
+/**
+ * @brief Strategy that steps every cell of a simulation once per tick. Engines hold whatever buffers they need between
+ * ticks; the simulation owns the engine it steps with.
+ */
+class Engine {
+public:
+    virtual ~Engine() = default;
+
+    /**
+     * @brief Name the engine is selected by
+     */
+    [[nodiscard]] virtual std::string_view name() const = 0;
+
+    /**
+     * @brief Whether the engine makes use of a thread pool
+     */
+    [[nodiscard]] virtual bool parallel() const = 0;
+
+    /**
+     * @brief Whether the engine steps to the same grid for the same seed no matter the threads it runs on
+     */
+    [[nodiscard]] virtual bool deterministic() const = 0;
+
+    /**
+     * @brief Step the simulation by one tick
+     * @param pool - Pool to run on, or nullptr to run on the calling thread
+     */
+    virtual void step(Simulation& simulation, uint64_t tick, util::WorkerPool* pool) = 0;
+};
+
+/**
+ * @brief Names of every engine make_engine() knows, the serial engine first
+ */
+[[nodiscard]] const std::vector<std::string_view>& engine_names();
+
+/**
+ * @brief Create an engine by name
+ * @param chunk_size - Side of the chunks of engines that step in chunks, a multiple of k_chunk_size
+ * @return - The engine, or nullptr if no engine has the name
+ */
+[[nodiscard]] std::unique_ptr<Engine> make_engine(std::string_view name, int chunk_size = k_chunk_size);
+
+}
@@ -0,0 +1,113 @@
+#include "frame_graph.hpp"
+
+#include <algorithm>
+#include <vector>
+
+#include <raylib-cpp.hpp>
+
+#include "game_state.hpp"
+#include "hud.hpp"
+#include "util/profiler.hpp"
+#include "util/task_graph.hpp"
+
+namespace rl = raylib;
+
+namespace pop {
+
+static void stage_tile(const rl::Image& image, const Tile& tile, std::vector<::Color>& staging)
+{
+    const int width = tile.end.x - tile.start.x;
+    const auto* pixels = static_cast<const ::Color*>(image.data);
+    for (int y = tile.start.y; y < tile.end.y; y++) {
+        std::copy_n(pixels + y * image.width + tile.start.x, width,
+            staging.begin() + static_cast<std::ptrdiff_t>(y - tile.start.y) * width);
+    }
+}
+
+static void upload_tile(GameState& game_state, const Tile& tile)
+{
+    if (!tile.dirty) {
+        return;
+    }
+    PROFILE_ZONE("upload");
+    const rl::Rectangle rect((float)tile.start.x, (float)tile.start.y, (float)(tile.end.x - tile.start.x),
+        (float)(tile.end.y - tile.start.y));
+    game_state.powder_texture.Update(rect, tile.powder_staging.data());
+    game_state.gas_texture.Update(rect, tile.gas_staging.data());
+}
+
+static void compose(GameState& game_state)
+{
+    PROFILE_ZONE("compose");
+    const Simulation& simulation = game_state.simulation;
+
+    BeginDrawing();
+    ClearBackground(rl::Color(15, 15, 15));
+
+    game_state.powder_texture.Draw(rl::Rectangle(0, 0, (float)simulation.width(), (float)simulation.height()),
+        rl::Rectangle(0, 0, (float)game_state.screen_width, (float)game_state.screen_height));
+
+    game_state.gas_render_texture.BeginMode();
+    ClearBackground(rl::Color().Alpha(0));
+    game_state.gas_texture.Draw(rl::Rectangle(0, 0, (float)simulation.width(), (float)simulation.height()),
+        rl::Rectangle(0, 0, (float)game_state.screen_width, (float)game_state.screen_height));
+    game_state.gas_render_texture.EndMode();
+
+    game_state.blur_shader.BeginMode();
+    game_state.gas_render_texture.GetTexture().Draw();
+    game_state.blur_shader.EndMode();
+}
+
+void build_frame_graph(GameState& game_state)
+{
+    using Affinity = util::TaskGraph::Affinity;
+    util::TaskGraph& graph = game_state.frame_graph;
+
+    const util::TaskGraph::TaskId input = graph.add("input", [&]() { apply_input(game_state); }, Affinity::e_main);
+    const util::TaskGraph::TaskId snapshot = graph.add(
+        "snapshot",
+        [&]() {
+            game_state.frame_snapshot = game_state.simulation.snapshot();
+            game_state.palette = draw_palette(game_state.simulation);
+        },
+        Affinity::e_main);
+    graph.depend(snapshot, input);
+    const util::TaskGraph::TaskId simulation
+        = graph.add("simulate", [&]() { simulate(game_state); }, Affinity::e_main);
+    graph.depend(simulation, snapshot);
+    const util::TaskGraph::TaskId composition = graph.add("compose", [&]() { compose(game_state); }, Affinity::e_main);
+    graph.depend(composition, simulation);
+
+    for (Tile& tile : game_state.tiles) {
+        const util::TaskGraph::TaskId raster = graph.add("raster", [&]() {
+            tile.dirty = draw_region(game_state.powder_image, game_state.gas_image, game_state.frame_snapshot,
+                game_state.palette, tile.start, tile.end);
+            game_state.frame_snapshot.release_chunk({ tile.start.x / k_tile_size, tile.start.y / k_tile_size });
+        });
+        const util::TaskGraph::TaskId stage = graph.add("stage", [&]() {
+            if (tile.dirty) {
+                stage_tile(game_state.powder_image, tile, tile.powder_staging);
+                stage_tile(game_state.gas_image, tile, tile.gas_staging);
+            }
+        });
+        const util::TaskGraph::TaskId upload
+            = graph.add("upload", [&]() { upload_tile(game_state, tile); }, Affinity::e_main);
+        graph.depend(raster, snapshot);
+        graph.depend(stage, raster);
+        graph.depend(upload, stage);
+        graph.depend(composition, upload);
+    }
+
+    const util::TaskGraph::TaskId hud = graph.add("hud", [&]() { draw_hud(game_state); }, Affinity::e_main);
+    graph.depend(hud, composition);
+    const util::TaskGraph::TaskId present = graph.add(
+        "present",
+        []() {
+            PROFILE_ZONE("present");
+            EndDrawing();
+        },
+        Affinity::e_main);
+    graph.depend(present, hud);
+}
+
+}
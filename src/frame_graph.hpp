@@ -0,0 +1,16 @@
+#pragma once
+
+namespace pop {
+
+struct GameState;
+
+/**
+ * @brief Build the tasks of a frame. Input runs first, then the grid is snapshot at the tick boundary. The main thread
+ * steps the simulation on its own pool while workers rasterize and stage tiles of the snapshot alongside it, releasing
+ * each chunk once its tile is drawn so the step only copies chunks it writes before then. Tiles are uploaded on the
+ * main thread once it is done stepping, as graphics calls have to stay on it. The frame shows the grid as it was before
+ * its ticks.
+ */
+void build_frame_graph(GameState& game_state);
+
+}
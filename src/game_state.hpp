@@ -0,0 +1,138 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <BS_thread_pool.hpp>
+#include <raylib-cpp.hpp>
+
+#include "autosave.hpp"
+#include "brush.hpp"
+#include "chunk_store.hpp"
+#include "common.hpp"
+#include "edit_history.hpp"
+#include "hud.hpp"
+#include "metrics.hpp"
+#include "replay.hpp"
+#include "rewind.hpp"
+#include "simulation.hpp"
+#include "util/fixed_loop.hpp"
+#include "util/metrics_server.hpp"
+#include "util/task_graph.hpp"
+#include "util/worker_pool.hpp"
+#include "world_view.hpp"
+
+namespace pop {
+
+// Tiles line up with chunks, so each raster task can release its chunk of the frame's snapshot
+inline constexpr int k_tile_size = k_chunk_size;
+
+/**
+ * @brief Part of the screen that is rasterized and uploaded as its own tasks
+ */
+struct Tile {
+    Vector2i start;
+    Vector2i end;
+    bool dirty = false;
+    // Rows of the tile packed together for uploading
+    std::vector<::Color> powder_staging {};
+    std::vector<::Color> gas_staging {};
+};
+
+/**
+ * @brief Time spent in the tasks of one name during a frame
+ */
+struct TaskTime {
+    std::string name;
+    double total_ms;
+    int count;
+};
+
+struct GameState {
+    int screen_width;
+    int screen_height;
+
+    Simulation simulation;
+
+    util::FixedLoop fixed_loop;
+    BS::thread_pool thread_pool;
+    std::unique_ptr<util::WorkerPool> worker_pool;
+    util::WorkerPool render_pool;
+
+    ElementId selected_element = 0;
+    // Looked up once rather than by name every frame
+    ElementId air_id = 0;
+    ElementId salt_id = 0;
+
+    Brush brush;
+    // Last stroke painted while a mouse button is held, so the next one carries on from where it ended
+    std::optional<Edit> last_stroke;
+    uint32_t stroke_seed = 0;
+
+    raylib::Image powder_image;
+    raylib::Image gas_image;
+    raylib::Texture2D powder_texture;
+    raylib::Texture2D gas_texture;
+    raylib::Shader blur_shader;
+    raylib::RenderTexture2D gas_render_texture;
+
+    std::vector<Tile> tiles;
+    // Grid as of the start of the frame's ticks and the element colors its tiles are drawn with
+    GridSnapshot frame_snapshot;
+    DrawPalette palette;
+    util::TaskGraph frame_graph;
+    // From the previous frame
+    std::vector<TaskTime> frame_times;
+    PerfHud hud;
+
+    Metrics metrics;
+    std::unique_ptr<util::MetricsServer> metrics_server;
+    // Zero to write no metrics lines
+    std::chrono::seconds metrics_interval;
+    std::chrono::steady_clock::time_point last_metrics_line;
+    std::chrono::steady_clock::time_point frame_start;
+
+    // Open with --world or --sparse-world
+    std::unique_ptr<ChunkStore> world_store;
+    std::unique_ptr<WorldView> world_view;
+
+    // Made with --autosave
+    std::unique_ptr<Autosave> autosave;
+
+    // Made with --record, saved to record_path on exit
+    std::unique_ptr<ReplayRecorder> recorder;
+    std::string record_path;
+
+    // History to rewind through, none with --rewind 0
+    std::unique_ptr<Rewind> rewind;
+    // Tick shown while rewinding, during which the simulation doesn't step
+    std::optional<uint64_t> rewind_tick;
+
+    // Cells edits overwrote, none in worlds
+    std::unique_ptr<EditHistory> history;
+};
+
+
+/**
+ * @brief Handle the keys and mouse for a frame, applying edits between ticks
+ */
+void apply_input(GameState& game_state);
+
+/**
+ * @brief Step the ticks that are due by the fixed loop
+ */
+void simulate(GameState& game_state);
+
+/**
+ * @brief Get the index of the running engine in engine_names()
+ */
+[[nodiscard]] int engine_index(const Simulation& simulation);
+
+void switch_engine(GameState& game_state, std::string_view name, int chunk_size);
+
+}
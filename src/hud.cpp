@@ -0,0 +1,203 @@
+#include "hud.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <raylib-cpp.hpp>
+
+#include <raygui.h>
+
+#include "engine.hpp"
+#include "game_state.hpp"
+#include "util/logger.hpp"
+
+namespace rl = raylib;
+
+namespace pop {
+
+int redrawn_tile_count(const GameState& game_state)
+{
+    return static_cast<int>(
+        std::count_if(game_state.tiles.begin(), game_state.tiles.end(), [](const Tile& tile) { return tile.dirty; }));
+}
+
+double frame_time(const GameState& game_state, std::string_view name)
+{
+    auto time = std::find_if(game_state.frame_times.begin(), game_state.frame_times.end(),
+        [&](const TaskTime& t) { return t.name == name; });
+    return time == game_state.frame_times.end() ? 0.0 : time->total_ms;
+}
+
+/**
+ * @brief Show what kernels did during the last tick, with the elements that swapped most and every element change
+ */
+template <typename Stat>
+static void draw_activity(const Simulation& simulation, const ActivityCounts& activity, Stat&& stat)
+{
+    stat(TextFormat("Cells: %llu visited, %llu changed", static_cast<unsigned long long>(activity.cells_visited),
+        static_cast<unsigned long long>(activity.cells_changed)));
+    stat(TextFormat("Random draws: %llu", static_cast<unsigned long long>(activity.random_draws)));
+
+    std::vector<ElementId> swapping;
+    for (ElementId id = 1; id < static_cast<ElementId>(activity.element_slots); id++) {
+        if (activity.swaps[id] != 0) {
+            swapping.push_back(id);
+        }
+    }
+    std::sort(swapping.begin(), swapping.end(),
+        [&](ElementId a, ElementId b) { return activity.swaps[a] > activity.swaps[b]; });
+    std::string swaps = "Swaps:";
+    for (std::size_t i = 0; i < std::min<std::size_t>(swapping.size(), 3); i++) {
+        swaps += TextFormat(" %s %llu", simulation.element_of(swapping[i]).name.c_str(),
+            static_cast<unsigned long long>(activity.swaps[swapping[i]]));
+    }
+    stat(swaps.c_str());
+
+    std::string changes = "Reactions:";
+    for (ElementId from = 1; from < static_cast<ElementId>(activity.element_slots); from++) {
+        for (ElementId to = 1; to < static_cast<ElementId>(activity.element_slots); to++) {
+            if (const uint64_t count = activity.change_count(from, to); count != 0) {
+                changes += TextFormat(" %s>%s %llu", simulation.element_of(from).name.c_str(),
+                    simulation.element_of(to).name.c_str(), static_cast<unsigned long long>(count));
+            }
+        }
+    }
+    stat(changes.c_str());
+}
+
+static void draw_perf_hud(GameState& game_state)
+{
+    const Simulation& simulation = game_state.simulation;
+    PerfHud& hud = game_state.hud;
+
+    const int redrawn_tiles = redrawn_tile_count(game_state);
+    // Activity starts being counted the frame after the panel is shown
+    const ActivityCounts* activity = simulation.activity();
+    const double cell_updates = activity == nullptr ? 0.0 : hud.ticks_per_second * activity->cells_visited;
+
+    GuiPanel(k_hud_bounds, nullptr);
+    const float x = k_hud_bounds.x + 10;
+    float y = k_hud_bounds.y + 10;
+    auto stat = [&](const char* text) {
+        GuiLabel({ x, y, k_hud_bounds.width - 20, 20 }, text);
+        y += 25;
+    };
+    stat(TextFormat("Ticks: %.0f/s at %.2f ms", hud.ticks_per_second, hud.ms_per_tick));
+    stat(TextFormat("Cell updates: %.1fM/s", cell_updates / 1e6));
+    stat(TextFormat("Redrawn tiles: %d of %d", redrawn_tiles, static_cast<int>(game_state.tiles.size())));
+    stat(TextFormat("Render: %.2f ms", frame_time(game_state, "raster") + frame_time(game_state, "stage")));
+    stat(TextFormat("Upload: %.2f ms", frame_time(game_state, "upload")));
+    stat(TextFormat("Dropped ticks: %lld", static_cast<long long>(game_state.fixed_loop.dropped_steps())));
+    if (activity != nullptr) {
+        draw_activity(simulation, *activity, stat);
+    }
+
+    y += 10;
+    const ::Rectangle label { x, y, 160, 30 };
+    const ::Rectangle control { x + 170, y, 150, 30 };
+    auto row = [&](int index) {
+        const float offset = static_cast<float>(index) * 40;
+        return std::pair<::Rectangle, ::Rectangle> { { label.x, label.y + offset, label.width, label.height },
+            { control.x, control.y + offset, control.width, control.height } };
+    };
+
+    auto [workers_label, workers_control] = row(0);
+    GuiLabel(workers_label, "Workers");
+    if (GuiSpinner(workers_control, nullptr, &hud.worker_count, 1, 64, hud.worker_count_edit)) {
+        hud.worker_count_edit = !hud.worker_count_edit;
+    }
+
+    auto [rate_label, rate_control] = row(1);
+    GuiLabel(rate_label, TextFormat("Tick rate: %.0f", hud.tick_rate));
+    hud.tick_rate = std::round(GuiSliderBar(rate_control, nullptr, nullptr, hud.tick_rate, 30.0f, 480.0f));
+
+    auto [chunk_label, chunk_control] = row(2);
+    GuiLabel(chunk_label, TextFormat("Chunk size: %d", hud.chunk_words * k_chunk_size));
+    if (GuiSpinner(chunk_control, nullptr, &hud.chunk_words, 1, 4, hud.chunk_words_edit)) {
+        hud.chunk_words_edit = !hud.chunk_words_edit;
+    }
+
+    static const std::string engine_list = [] {
+        std::string list;
+        for (std::string_view name : engine_names()) {
+            list += (list.empty() ? "" : ";") + std::string(name);
+        }
+        return list;
+    }();
+    auto [engine_label, engine_control] = row(3);
+    GuiLabel(engine_label, "Engine");
+    hud.engine_index = GuiComboBox(engine_control, engine_list.c_str(), engine_index(simulation));
+
+    y = k_hud_bounds.y + k_hud_bounds.height + 10;
+    for (const TaskTime& time : game_state.frame_times) {
+        rl::DrawText(TextFormat("%s: %.2f ms (%d)", time.name.c_str(), time.total_ms, time.count), 10, (int)y, 20,
+            rl::Color::Gray());
+        y += 25;
+    }
+}
+
+void draw_hud(GameState& game_state)
+{
+    const Simulation& simulation = game_state.simulation;
+
+    DrawFPS(10, 10);
+
+    rl::DrawText(simulation.element_of(game_state.selected_element).friendly_name, 10, 50, 20, rl::Color::Yellow());
+    rl::DrawText(std::string(simulation.engine().name()), 10, 75, 20, rl::Color::Gray());
+    const Brush& brush = game_state.brush;
+    const char* shape = brush.shape == BrushShape::e_circle ? "Circle"
+        : brush.shape == BrushShape::e_square                ? "Square"
+                                                             : "Spray";
+    rl::DrawText(TextFormat("%s brush, radius %d", shape, brush.radius), 200, 50, 20, rl::Color::Gray());
+    if (game_state.world_view != nullptr) {
+        const Vector2i origin = game_state.world_view->origin();
+        rl::DrawText(TextFormat("World chunk %d, %d", origin.x, origin.y), game_state.screen_width - 240, 10, 20,
+            rl::Color::Gray());
+    }
+    if (game_state.rewind_tick.has_value()) {
+        const auto ticks_back = static_cast<double>(game_state.rewind->newest_tick() - game_state.rewind_tick.value());
+        rl::DrawText(TextFormat("Rewound %.2f s", ticks_back / game_state.fixed_loop.rate()),
+            game_state.screen_width - 240, 10, 20, rl::Color::Yellow());
+    }
+
+    if (game_state.hud.visible) {
+        draw_perf_hud(game_state);
+    }
+}
+
+void apply_hud(GameState& game_state)
+{
+    Simulation& simulation = game_state.simulation;
+    PerfHud& hud = game_state.hud;
+
+    // Activity is only counted while someone looks at it
+    simulation.set_activity_counters(hud.visible);
+    if (hud.worker_count != game_state.worker_pool->worker_count()) {
+        game_state.worker_pool = std::make_unique<util::WorkerPool>(hud.worker_count);
+        simulation.set_worker_pool(game_state.worker_pool.get());
+        POP_LOG_INFO("Running on {} workers", hud.worker_count);
+    }
+    if (std::abs(hud.tick_rate - game_state.fixed_loop.rate()) >= 0.5f) {
+        game_state.fixed_loop.set_rate(hud.tick_rate);
+    }
+    const std::string_view engine_name = engine_names().at(hud.engine_index);
+    if (engine_name != simulation.engine().name() || hud.chunk_words * k_chunk_size != hud.chunk_size) {
+        hud.chunk_size = hud.chunk_words * k_chunk_size;
+        switch_engine(game_state, engine_name, hud.chunk_size);
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    const double window_seconds = std::chrono::duration<double>(now - hud.window_start).count();
+    if (window_seconds >= 1.0) {
+        hud.ticks_per_second = hud.window_ticks / window_seconds;
+        hud.ms_per_tick = hud.window_ticks == 0 ? 0.0 : hud.window_tick_ms / hud.window_ticks;
+        hud.window_start = now;
+        hud.window_ticks = 0;
+        hud.window_tick_ms = 0.0;
+    }
+}
+
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <chrono>
+#include <string_view>
+
+#include <raylib-cpp.hpp>
+
+#include "common.hpp"
+
+namespace pop {
+
+struct GameState;
+
+inline constexpr ::Rectangle k_hud_bounds { 10, 105, 400, 445 };
+
+/**
+ * @brief Performance panel shown with F3. Stats are averaged over about a second and changes to the controls take
+ * effect between frames.
+ */
+struct PerfHud {
+    bool visible = false;
+
+    int worker_count = 1;
+    float tick_rate = 240.0f;
+    // Multiples of k_chunk_size
+    int chunk_words = 1;
+    int engine_index = 0;
+    // Of the running engine
+    int chunk_size = k_chunk_size;
+    bool worker_count_edit = false;
+    bool chunk_words_edit = false;
+
+    std::chrono::steady_clock::time_point window_start = std::chrono::steady_clock::now();
+    int window_ticks = 0;
+    double window_tick_ms = 0.0;
+    double ticks_per_second = 0.0;
+    double ms_per_tick = 0.0;
+};
+
+/**
+ * @brief Draw the selected element, engine and brush, and the performance panel if it is shown
+ */
+void draw_hud(GameState& game_state);
+
+/**
+ * @brief Apply what changed on the performance panel, while nothing runs on the worker pool
+ */
+void apply_hud(GameState& game_state);
+
+/**
+ * @brief Get the number of tiles whose pixels changed during the last frame
+ */
+[[nodiscard]] int redrawn_tile_count(const GameState& game_state);
+
+/**
+ * @brief Get the time spent in the tasks of a name during the last frame, in milliseconds
+ */
+[[nodiscard]] double frame_time(const GameState& game_state, std::string_view name);
+
+}
@@ -0,0 +1,109 @@
+#include "intent_engine.hpp"
+
+#include <algorithm>
+#include <atomic>
+
+#include "simulation.hpp"
+#include "util/profiler.hpp"
+#include "util/rng.hpp"
+
+namespace pop {
+
+void Intents::resize(int cell_count)
+{
+    targets.resize(cell_count);
+    elements.resize(cell_count);
+    claims.resize(cell_count);
+}
+
+static void claim(std::vector<uint64_t>& claims, int cell, uint64_t value)
+{
+    std::atomic_ref<uint64_t> slot(claims[cell]);
+    uint64_t current = slot.load(std::memory_order_relaxed);
+    while (current < value && !slot.compare_exchange_weak(current, value, std::memory_order_relaxed)) { }
+}
+
+static uint64_t claim_value(uint64_t tick_seed, int cell)
+{
+    return (util::mix64(tick_seed ^ static_cast<uint64_t>(cell)) & 0xffffffff00000000) | static_cast<uint32_t>(cell);
+}
+
+void step_intents(Simulation& simulation, Intents& intents, util::WorkerPool* pool)
+{
+    const int width = simulation.width();
+    const int height = simulation.height();
+    intents.resize(width * height);
+    const uint64_t kernel_seed = simulation.tick_seed();
+    const uint64_t claim_seed = util::mix64(kernel_seed);
+
+    // Intent: kernels read the frozen grid and record what they want to do
+    simulation.set_intents(&intents);
+    util::parallel_for(pool, 0, height, [&](int start, int end, int) {
+        PROFILE_ZONE("intent_propose");
+        util::Rng rng;
+        Simulation::set_thread_rng(&rng);
+        for (int y = start; y < end; y++) {
+            std::fill_n(intents.targets.begin() + y * width, width, -1);
+            std::fill_n(intents.elements.begin() + y * width, width, 0);
+            std::fill_n(intents.claims.begin() + y * width, width, 0);
+            rng.seed(util::mix64(kernel_seed ^ static_cast<uint64_t>(y)));
+            for (int x = 0; x < width; x++) {
+                simulation.update_particle({ x, y });
+            }
+        }
+        Simulation::set_thread_rng(nullptr);
+    });
+    simulation.set_intents(nullptr);
+
+    // Resolve: every intent claims the cells it touches, the highest priority claim on a cell wins
+    util::parallel_for(pool, 0, height, [&](int start, int end, int) {
+        PROFILE_ZONE("intent_resolve");
+        for (int i = start * width; i < end * width; i++) {
+            if (intents.elements[i] != 0) {
+                claim(intents.claims, i, claim_value(claim_seed, i));
+            }
+            else if (intents.targets[i] != -1) {
+                uint64_t value = claim_value(claim_seed, i);
+                claim(intents.claims, i, value);
+                claim(intents.claims, intents.targets[i], value);
+            }
+        }
+    });
+
+    // Commit: intents holding all of their claims touch disjoint cells and are applied as is
+    util::parallel_for(pool, 0, height, [&](int start, int end, int) {
+        PROFILE_ZONE("intent_commit");
+        ActivityCounts* activity = simulation.local_activity();
+        for (int i = start * width; i < end * width; i++) {
+            if (intents.elements[i] == 0 && intents.targets[i] == -1) {
+                continue;
+            }
+            const uint64_t value = claim_value(claim_seed, i);
+            if (intents.claims[i] != value) {
+                continue;
+            }
+            // Cells are only taken to write once they will be written, which marks their chunks changed
+            const Vector2i pos = simulation.pos_at(i);
+            if (intents.elements[i] != 0) {
+                Particle& particle = simulation.particle_at(pos);
+                if (activity != nullptr) {
+                    activity->changes[particle.element_id * activity->element_slots + intents.elements[i]]++;
+                    activity->cells_changed++;
+                }
+                particle.element_id = intents.elements[i];
+            }
+            else if (intents.claims[intents.targets[i]] == value) {
+                Particle& particle = simulation.particle_at(pos);
+                if (activity != nullptr) {
+                    activity->swaps[particle.element_id]++;
+                    activity->cells_changed += 2;
+                }
+                std::swap(particle, simulation.particle_at(simulation.pos_at(intents.targets[i])));
+            }
+        }
+    });
+
+    simulation.rebuild_occupancy();
+}
+
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "elements.hpp"
+#include "util/worker_pool.hpp"
+
+namespace pop {
+
+class Simulation;
+
+/**
+ * @brief Flat per-cell buffers of what kernels want to do. While set on a simulation, swap() and change_element()
+ * record into these instead of changing the grid.
+ */
+struct Intents {
+    // Index of the cell to swap with, -1 for none
+    std::vector<int32_t> targets {};
+    // Element to change into, 0 for none. Takes precedence over a swap.
+    std::vector<ElementId> elements {};
+    // Highest priority claim on each cell, the priority in the high 32 bits and the claiming cell in the low 32 bits
+    std::vector<uint64_t> claims {};
+
+    void resize(int cell_count);
+};
+
+/**
+ * @brief Step the simulation in three phases. Every kernel runs on the frozen grid and records an intent, then each
+ * intent claims the cells it touches with a priority hashed from the tick and its cell, then intents holding all of
+ * their claims are applied. Kernels draw from a generator seeded per row and tick, so with the hashed priorities the
+ * result doesn't depend on how rows are split between threads.
+ * @param pool - Pool to run the phases on, or nullptr to run them on the calling thread
+ */
+void step_intents(Simulation& simulation, Intents& intents, util::WorkerPool* pool);
+
+}
@@ -1,18 +1,104 @@
+#include <algorithm>
 #include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
 
+#include "bench.hpp"
+#include "engine.hpp"
 #include "powder_playground.hpp"
+#include "replay.hpp"
+#include "validate.hpp"
 
 #include "util/logger.hpp"
 
-int main()
+int main(int argc, char* argv[])
 {
-    util::init_logger();
+    util::init_logger(std::find(argv + 1, argv + argc, std::string_view("--async-log")) != argv + argc);
 
     try {
-        pop::run();
+        std::string mode;
+        std::string engine_name;
+        std::string replay_path;
+        pop::RunOptions options;
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--bench" || arg == "--validate") {
+                mode = arg;
+            }
+            else if (arg == "--replay" && i + 1 < argc) {
+                mode = arg;
+                replay_path = argv[++i];
+            }
+            else if (arg == "--record" && i + 1 < argc) {
+                options.record_path = argv[++i];
+            }
+            else if (arg == "--rewind" && i + 1 < argc) {
+                options.rewind_seconds = std::stoi(argv[++i]);
+            }
+            else if (arg == "--engine" && i + 1 < argc) {
+                engine_name = argv[++i];
+            }
+            else if (arg == "--seed" && i + 1 < argc) {
+                options.seed = std::stoull(argv[++i]);
+            }
+            else if (arg == "--async-log") {
+                // Already applied when the logger was set up
+            }
+            else if (arg == "--sparse-world") {
+                options.sparse_world = true;
+            }
+            else if (arg == "--deterministic") {
+                options.deterministic = true;
+            }
+            else if (arg == "--metrics" && i + 1 < argc) {
+                options.metrics_interval = std::stoi(argv[++i]);
+            }
+            else if (arg == "--metrics-port" && i + 1 < argc) {
+                options.metrics_port = std::stoi(argv[++i]);
+            }
+            else if (arg == "--scene" && i + 1 < argc) {
+                options.scene_path = argv[++i];
+            }
+            else if (arg == "--autosave" && i + 1 < argc) {
+                options.autosave_interval = std::stoi(argv[++i]);
+            }
+            else if (arg == "--world" && i + 1 < argc) {
+                options.world_path = argv[++i];
+            }
+            else {
+                throw std::runtime_error("Unknown argument: " + arg);
+            }
+        }
+        if (!engine_name.empty() && pop::make_engine(engine_name) == nullptr) {
+            throw std::runtime_error("Unknown engine: " + engine_name);
+        }
+        // Metrics time frames of the playground, the other modes report on their own
+        if (!mode.empty() && (options.metrics_interval != 0 || options.metrics_port != 0)) {
+            throw std::runtime_error("--metrics and --metrics-port can't be used with " + mode);
+        }
+
+        if (mode == "--bench") {
+            pop::run_bench();
+        }
+        else if (mode == "--validate") {
+            if (engine_name.empty()) {
+                return pop::run_validation(pop::engine_names()) ? EXIT_SUCCESS : EXIT_FAILURE;
+            }
+            return pop::run_validation({ engine_name }) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        else if (mode == "--replay") {
+            return pop::run_replay(replay_path) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        else {
+            if (!engine_name.empty()) {
+                options.engine_name = engine_name;
+            }
+            pop::run(options);
+        }
     }
     catch (std::exception& e) {
-        LOG->error(e.what());
+        POP_LOG_ERROR(e.what());
         return EXIT_FAILURE;
     }
 
@@ -0,0 +1,267 @@
+#include "mapped_chunk_store.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "scene.hpp"
+
+namespace pop {
+
+inline constexpr std::array<char, 8> k_world_magic { 'P', 'O', 'P', 'W', 'O', 'R', 'L', 'D' };
+inline constexpr uint32_t k_world_version = 1;
+// Holds the header and the element names, slots start after it
+inline constexpr std::size_t k_world_header_size = 65536;
+
+/**
+ * @brief Start of a world file, in host byte order. Followed by the element names, each a uint16_t size and the name,
+ * the name at index i being the element with id i + 1 in the file.
+ */
+struct WorldHeader {
+    std::array<char, 8> magic;
+    uint32_t version;
+    uint32_t chunks_x;
+    uint32_t chunks_y;
+    uint32_t chunk_size;
+    uint32_t slot_size;
+    uint32_t fill;
+    uint32_t element_count;
+};
+
+#if defined(_WIN32)
+
+MappedChunkStore::MappedChunkStore(const std::filesystem::path&, const Simulation&, Vector2i, int resident_budget,
+    const std::string&)
+    : m_resident_budget(resident_budget)
+{
+    throw std::runtime_error("Worlds are not supported on this platform");
+}
+
+MappedChunkStore::~MappedChunkStore() = default;
+
+void MappedChunkStore::read(Vector2i, std::span<Particle>)
+{
+}
+
+void MappedChunkStore::write(Vector2i, std::span<const Particle>)
+{
+}
+
+void MappedChunkStore::flush()
+{
+}
+
+uint8_t* MappedChunkStore::slot(Vector2i) const
+{
+    return nullptr;
+}
+
+void MappedChunkStore::touch(Vector2i)
+{
+}
+
+#else
+
+MappedChunkStore::MappedChunkStore(const std::filesystem::path& path, const Simulation& simulation, Vector2i size,
+    int resident_budget, const std::string& fill_element)
+    : m_resident_budget(std::max(resident_budget, 1))
+{
+    const auto page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    const std::size_t slot_bytes = sizeof(uint32_t) + max_encoded_chunk_size(k_chunk_size * k_chunk_size, true);
+    m_slot_size = (slot_bytes + page_size - 1) / page_size * page_size;
+
+    const bool exists = std::filesystem::exists(path);
+    m_file = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (m_file < 0) {
+        throw std::runtime_error("Unable to open world: " + path.string());
+    }
+    auto fail = [&](const std::string& message) {
+        close(m_file);
+        throw std::runtime_error(message + ": " + path.string());
+    };
+
+    WorldHeader header {};
+    std::vector<std::string> names;
+    if (exists) {
+        std::vector<uint8_t> data(k_world_header_size);
+        if (pread(m_file, data.data(), data.size(), 0) != static_cast<ssize_t>(data.size())) {
+            fail("World is too short");
+        }
+        std::memcpy(&header, data.data(), sizeof(header));
+        if (header.magic != k_world_magic || header.version > k_world_version) {
+            fail("Not a world this build reads");
+        }
+        if (header.chunk_size != k_chunk_size || header.slot_size != m_slot_size) {
+            fail("World was created with different chunks");
+        }
+        std::size_t offset = sizeof(header);
+        for (uint32_t i = 0; i < header.element_count; i++) {
+            uint16_t name_size = 0;
+            if (offset + sizeof(name_size) > data.size()) {
+                fail("World has a malformed header");
+            }
+            std::memcpy(&name_size, data.data() + offset, sizeof(name_size));
+            offset += sizeof(name_size);
+            if (offset + name_size > data.size()) {
+                fail("World has a malformed header");
+            }
+            names.emplace_back(reinterpret_cast<const char*>(data.data()) + offset, name_size);
+            offset += name_size;
+        }
+    }
+    else {
+        header.magic = k_world_magic;
+        header.version = k_world_version;
+        header.chunks_x = static_cast<uint32_t>(size.x);
+        header.chunks_y = static_cast<uint32_t>(size.y);
+        header.chunk_size = k_chunk_size;
+        header.slot_size = static_cast<uint32_t>(m_slot_size);
+    }
+    m_size = { static_cast<int>(header.chunks_x), static_cast<int>(header.chunks_y) };
+
+    m_from_file.assign(names.size() + 1, 0);
+    for (std::size_t i = 0; i < names.size(); i++) {
+        if (!simulation.has_element(names[i])) {
+            fail("World holds an element this build doesn't have: " + names[i]);
+        }
+        m_from_file[i + 1] = simulation.id_of(names[i]);
+    }
+    m_to_file.assign(simulation.element_count() + 1, 0);
+    for (ElementId id = 1; id <= static_cast<ElementId>(simulation.element_count()); id++) {
+        const std::string name = simulation.element_of(id).name;
+        auto known = std::find(names.begin(), names.end(), name);
+        if (known == names.end()) {
+            names.push_back(name);
+            m_from_file.push_back(id);
+            known = names.end() - 1;
+        }
+        m_to_file[id] = static_cast<ElementId>(known - names.begin() + 1);
+    }
+    if (!exists) {
+        header.fill = m_to_file[simulation.id_of(fill_element)];
+    }
+    if (header.fill == 0 || header.fill >= m_from_file.size()) {
+        fail("World has a malformed header");
+    }
+    m_fill.element_id = m_from_file[header.fill];
+
+    header.element_count = static_cast<uint32_t>(names.size());
+    std::vector<uint8_t> data(sizeof(header));
+    std::memcpy(data.data(), &header, sizeof(header));
+    for (const std::string& name : names) {
+        const auto name_size = static_cast<uint16_t>(name.size());
+        data.insert(data.end(), reinterpret_cast<const uint8_t*>(&name_size),
+            reinterpret_cast<const uint8_t*>(&name_size) + sizeof(name_size));
+        data.insert(data.end(), name.begin(), name.end());
+    }
+    if (data.size() > k_world_header_size) {
+        fail("Too many elements for the world header");
+    }
+    if (pwrite(m_file, data.data(), data.size(), 0) != static_cast<ssize_t>(data.size())) {
+        fail("Unable to write the world header");
+    }
+
+    // Slots that were never written stay holes in the file
+    m_mapping_size = k_world_header_size + static_cast<std::size_t>(m_size.x) * m_size.y * m_slot_size;
+    struct stat status {};
+    if (fstat(m_file, &status) != 0
+        || (static_cast<std::size_t>(status.st_size) < m_mapping_size
+            && ftruncate(m_file, static_cast<off_t>(m_mapping_size)) != 0)) {
+        fail("Unable to size the world");
+    }
+    void* mapping = mmap(nullptr, m_mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_file, 0);
+    if (mapping == MAP_FAILED) {
+        fail("Unable to map the world");
+    }
+    m_mapping = static_cast<uint8_t*>(mapping);
+}
+
+MappedChunkStore::~MappedChunkStore()
+{
+    flush();
+    munmap(m_mapping, m_mapping_size);
+    close(m_file);
+}
+
+void MappedChunkStore::read(Vector2i chunk, std::span<Particle> cells)
+{
+    thread_local ChunkCodecScratch scratch;
+    touch(chunk);
+    const uint8_t* data = slot(chunk);
+    uint32_t size = 0;
+    std::memcpy(&size, data, sizeof(size));
+    if (size == 0) {
+        std::fill(cells.begin(), cells.end(), m_fill);
+        return;
+    }
+    if (size > m_slot_size - sizeof(size)) {
+        throw std::runtime_error("World chunk is corrupt");
+    }
+    decode_chunk({ data + sizeof(size), size }, true, cells, scratch, &m_from_file);
+}
+
+void MappedChunkStore::write(Vector2i chunk, std::span<const Particle> cells)
+{
+    thread_local ChunkCodecScratch scratch;
+    thread_local std::vector<uint8_t> encoded;
+    encoded.clear();
+    encode_chunk(cells, true, encoded, scratch, &m_to_file);
+    touch(chunk);
+    uint8_t* data = slot(chunk);
+    const auto size = static_cast<uint32_t>(encoded.size());
+    std::memcpy(data + sizeof(size), encoded.data(), encoded.size());
+    std::memcpy(data, &size, sizeof(size));
+}
+
+void MappedChunkStore::flush()
+{
+    msync(m_mapping, m_mapping_size, MS_SYNC);
+}
+
+uint8_t* MappedChunkStore::slot(Vector2i chunk) const
+{
+    const auto index = static_cast<std::size_t>(chunk.y) * m_size.x + chunk.x;
+    return m_mapping + k_world_header_size + index * m_slot_size;
+}
+
+void MappedChunkStore::touch(Vector2i chunk)
+{
+    const int index = chunk.y * m_size.x + chunk.x;
+    std::lock_guard lock(m_mutex);
+    if (auto resident = m_resident.find(index); resident != m_resident.end()) {
+        m_lru.splice(m_lru.begin(), m_lru, resident->second);
+        return;
+    }
+    m_lru.push_front(index);
+    m_resident.emplace(index, m_lru.begin());
+    if (static_cast<int>(m_lru.size()) > m_resident_budget) {
+        // Written pages stay in the page cache and reach the file, only the mapping of them is dropped
+        const int evicted = m_lru.back();
+        m_lru.pop_back();
+        m_resident.erase(evicted);
+        madvise(slot({ evicted % m_size.x, evicted / m_size.x }), m_slot_size, MADV_DONTNEED);
+    }
+}
+
+#endif
+
+std::optional<Vector2i> MappedChunkStore::size() const
+{
+    return m_size;
+}
+
+int MappedChunkStore::resident_slots() const
+{
+    std::lock_guard lock(m_mutex);
+    return static_cast<int>(m_lru.size());
+}
+
+}
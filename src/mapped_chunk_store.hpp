@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "chunk_store.hpp"
+#include "simulation.hpp"
+
+namespace pop {
+
+/**
+ * @brief World of k_chunk_size square chunks kept in a memory-mapped file, for worlds larger than RAM. Every chunk has
+ * a slot of fixed size in the file holding it compressed with the scene codec, slots that were never written read as a
+ * fill element and take no disk space. Once more slots than a budget have been touched, the least recently used are
+ * dropped from memory and the kernel writes them back, so memory follows the chunks in use rather than the size of the
+ * world.
+ */
+class MappedChunkStore final : public ChunkStore {
+public:
+    /**
+     * @brief Open a world file, or create it if there is none. Elements are matched up with the ones the world was
+     * created with by name, and elements it hasn't seen are added to it, so elements must be pushed before.
+     * @param size - Size of the world in chunks if it is created, the size of an existing world is kept
+     * @param resident_budget - Number of slots kept in memory
+     * @param fill_element - Element that chunks never written are full of, if the world is created
+     */
+    MappedChunkStore(const std::filesystem::path& path, const Simulation& simulation, Vector2i size,
+        int resident_budget, const std::string& fill_element = "air");
+
+    /**
+     * @brief Flush and close the file
+     */
+    ~MappedChunkStore() override;
+
+    MappedChunkStore(const MappedChunkStore&) = delete;
+    MappedChunkStore& operator=(const MappedChunkStore&) = delete;
+
+    /**
+     * @brief Throws if the slot is corrupt
+     */
+    void read(Vector2i chunk, std::span<Particle> cells) override;
+
+    void write(Vector2i chunk, std::span<const Particle> cells) override;
+
+    /**
+     * @brief Wait for every written slot to reach the disk
+     */
+    void flush() override;
+
+    [[nodiscard]] std::optional<Vector2i> size() const override;
+
+    /**
+     * @brief Get the number of slots currently counted against the budget
+     */
+    [[nodiscard]] int resident_slots() const;
+
+private:
+    int m_file = -1;
+    uint8_t* m_mapping = nullptr;
+    std::size_t m_mapping_size = 0;
+    std::size_t m_slot_size = 0;
+    Vector2i m_size {};
+    Particle m_fill {};
+    // Ids of the simulation to ids in the file and back
+    std::vector<ElementId> m_to_file {};
+    std::vector<ElementId> m_from_file {};
+
+    mutable std::mutex m_mutex {};
+    const int m_resident_budget;
+    // Most recently used first
+    std::list<int> m_lru {};
+    std::unordered_map<int, std::list<int>::iterator> m_resident {};
+
+    [[nodiscard]] uint8_t* slot(Vector2i chunk) const;
+
+    /**
+     * @brief Count a slot as used, dropping the least recently used slot from memory if over budget
+     */
+    void touch(Vector2i chunk);
+};
+
+}
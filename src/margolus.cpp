@@ -0,0 +1,173 @@
+#include "margolus.hpp"
+
+#include "occupancy.hpp"
+#include "simulation.hpp"
+#include "util/profiler.hpp"
+#include "util/rng.hpp"
+
+namespace pop {
+
+// Block cells
+static constexpr int k_top_left = 0;
+static constexpr int k_top_right = 1;
+static constexpr int k_bottom_left = 2;
+static constexpr int k_bottom_right = 3;
+
+static constexpr int k_state_count = k_element_type_count * k_element_type_count * k_element_type_count
+    * k_element_type_count;
+
+static int state_of(const std::array<ElementType, 4>& cells)
+{
+    int state = 0;
+    for (int i = 3; i >= 0; i--) {
+        state = state * k_element_type_count + static_cast<int>(cells[i]);
+    }
+    return state;
+}
+
+// Heavier cells sink below lighter ones, solids never move
+static int density_of(ElementType type)
+{
+    switch (type) {
+    case ElementType::e_gas:
+        return 0;
+    case ElementType::e_null:
+        return 1;
+    case ElementType::e_liquid:
+        return 2;
+    case ElementType::e_powder:
+        return 3;
+    default:
+        return -1;
+    }
+}
+
+/**
+ * @brief Work out the move of a block by applying gravity, toppling and spreading in turn, moving each cell at most
+ * once. Bit 0 of the variant picks which side goes first and bit 1 holds back slow moves.
+ */
+static MargolusRules::Move derive_move(std::array<ElementType, 4> cells, int variant)
+{
+    MargolusRules::Move move;
+    std::array<bool, 4> moved {};
+    const bool right_first = (variant & 1) != 0;
+    const bool hold = (variant & 2) != 0;
+
+    auto movable = [&](int cell) { return !moved[cell] && density_of(cells[cell]) >= 0; };
+    auto lighter = [&](int cell, int than) {
+        return movable(cell) && density_of(cells[cell]) < density_of(cells[than]);
+    };
+    auto swap = [&](int cell1, int cell2) {
+        move.swaps[move.swap_count++] = { static_cast<uint8_t>(cell1), static_cast<uint8_t>(cell2) };
+        std::swap(cells[cell1], cells[cell2]);
+        moved[cell1] = true;
+        moved[cell2] = true;
+    };
+
+    for (int top : { k_top_left, k_top_right }) {
+        const int bottom = top + 2;
+        if (!movable(top) || !lighter(bottom, top)) {
+            continue;
+        }
+        // Sinking through liquid and gas rising are slower than falling through air
+        bool sink = cells[top] == ElementType::e_powder && cells[bottom] == ElementType::e_liquid;
+        bool rise = cells[bottom] == ElementType::e_gas;
+        if ((sink && variant != 0) || (rise && hold)) {
+            continue;
+        }
+        swap(top, bottom);
+    }
+
+    std::array<int, 2> tops = { k_top_left, k_top_right };
+    if (right_first) {
+        std::swap(tops[0], tops[1]);
+    }
+    for (int top : tops) {
+        const int side = top == k_top_left ? k_top_right : k_top_left;
+        const int below = top + 2;
+        const int diagonal = side + 2;
+        const bool falls = cells[top] == ElementType::e_powder || cells[top] == ElementType::e_liquid;
+        if (!falls || !movable(top) || lighter(below, top)) {
+            continue;
+        }
+        const bool side_open = density_of(cells[side]) >= 0 && density_of(cells[side]) < density_of(cells[top]);
+        if (side_open && lighter(diagonal, top)) {
+            swap(top, diagonal);
+        }
+    }
+
+    for (int row : { k_top_left, k_bottom_left }) {
+        int left = row;
+        int right = row + 1;
+        if (right_first) {
+            std::swap(left, right);
+        }
+        const bool spreads = cells[left] == ElementType::e_liquid || cells[left] == ElementType::e_gas;
+        if (!spreads || !movable(left) || !lighter(right, left) || hold) {
+            continue;
+        }
+        // Liquids in the top row only spread when resting on something
+        if (row == k_top_left && cells[left] == ElementType::e_liquid && lighter(left + 2, left)) {
+            continue;
+        }
+        swap(left, right);
+    }
+
+    return move;
+}
+
+MargolusRules::MargolusRules()
+{
+    m_moves.resize(k_state_count * variant_count);
+    for (int state = 0; state < k_state_count; state++) {
+        std::array<ElementType, 4> cells {};
+        int rest = state;
+        for (ElementType& cell : cells) {
+            cell = static_cast<ElementType>(rest % k_element_type_count);
+            rest /= k_element_type_count;
+        }
+        for (int variant = 0; variant < variant_count; variant++) {
+            m_moves[state * variant_count + variant] = derive_move(cells, variant);
+        }
+    }
+}
+
+const MargolusRules::Move& MargolusRules::move(const std::array<ElementType, 4>& cells, int variant) const
+{
+    return m_moves[state_of(cells) * variant_count + variant];
+}
+
+void step_margolus(Simulation& simulation, const MargolusRules& rules, uint64_t tick, util::WorkerPool* pool)
+{
+    // Odd ticks shift blocks up and left by one, blocks hanging over the edges see out of bounds cells as solid
+    const int offset = static_cast<int>(tick & 1);
+    const int block_rows = (simulation.height() + offset + 1) / 2;
+    const int block_cols = (simulation.width() + offset + 1) / 2;
+    const uint64_t tick_seed = simulation.tick_seed();
+
+    // Each block row only touches its own two rows, so rows can be stepped in parallel
+    util::parallel_for(pool, 0, block_rows, [&](int start, int end, int) {
+        PROFILE_ZONE("margolus_rows");
+        for (int block_row = start; block_row < end; block_row++) {
+            const int y = block_row * 2 - offset;
+            const uint64_t row_seed = util::mix64(tick_seed ^ static_cast<uint64_t>(block_row));
+            for (int block_col = 0; block_col < block_cols; block_col++) {
+                const int x = block_col * 2 - offset;
+                const std::array<Vector2i, 4> positions { { { x, y }, { x + 1, y }, { x, y + 1 }, { x + 1, y + 1 } } };
+                std::array<ElementType, 4> cells {};
+                for (int i = 0; i < 4; i++) {
+                    cells[i] = simulation.in_bounds(positions[i]) ? simulation.type_at(positions[i])
+                                                                  : ElementType::e_solid;
+                }
+                const int variant
+                    = static_cast<int>(util::mix64(row_seed + block_col) % MargolusRules::variant_count);
+                const MargolusRules::Move& move = rules.move(cells, variant);
+                for (int i = 0; i < move.swap_count; i++) {
+                    simulation.swap(positions[move.swaps[i][0]], positions[move.swaps[i][1]]);
+                }
+            }
+        }
+    });
+}
+
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "elements.hpp"
+#include "util/worker_pool.hpp"
+
+namespace pop {
+
+class Simulation;
+
+/**
+ * @brief Rules of the Margolus engine. A 2x2 block is keyed on the element types of its cells (top-left, top-right,
+ * bottom-left, bottom-right) and has one rearrangement per variant, picked between with random bits.
+ */
+class MargolusRules {
+public:
+    static constexpr int variant_count = 4;
+
+    struct Move {
+        uint8_t swap_count = 0;
+        // Pairs of block cells to swap, in order
+        std::array<std::array<uint8_t, 2>, 2> swaps {};
+    };
+
+    MargolusRules();
+
+    [[nodiscard]] const Move& move(const std::array<ElementType, 4>& cells, int variant) const;
+
+private:
+    std::vector<Move> m_moves {};
+};
+
+/**
+ * @brief Step the simulation by transforming every 2x2 block independently. Blocks are offset by one cell every other
+ * tick so that particles can cross block borders. Each block draws its random bits from a hash of its position and
+ * the tick, so the result doesn't depend on how block rows are split between threads. Blocks only move particles,
+ * elements don't react with each other in this engine.
+ * @param pool - Pool to transform block rows on, or nullptr to run on the calling thread
+ */
+void step_margolus(Simulation& simulation, const MargolusRules& rules, uint64_t tick, util::WorkerPool* pool);
+
+}
@@ -0,0 +1,145 @@
+#include "metrics.hpp"
+
+#include <array>
+#include <bit>
+#include <fstream>
+
+#include <spdlog/fmt/fmt.h>
+
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+#include "simulation.hpp"
+
+namespace pop {
+
+inline constexpr std::array<double, 5> k_metrics_quantiles { 0.5, 0.9, 0.99, 0.999, 1.0 };
+
+void Metrics::Series::record(std::chrono::nanoseconds duration)
+{
+    const auto micros = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+    interval.record(micros);
+    total.record(micros);
+}
+
+void Metrics::record_tick(std::chrono::nanoseconds duration)
+{
+    std::lock_guard lock(m_mutex);
+    m_tick.record(duration);
+    m_ticks++;
+}
+
+void Metrics::record_frame(std::chrono::nanoseconds duration)
+{
+    std::lock_guard lock(m_mutex);
+    m_frame.record(duration);
+}
+
+void Metrics::record_render(std::chrono::nanoseconds duration)
+{
+    std::lock_guard lock(m_mutex);
+    m_render.record(duration);
+}
+
+void Metrics::update_gauges(const Simulation& simulation, int redrawn_tiles, int64_t dropped_ticks)
+{
+    const Occupancy& occupancy = simulation.occupancy();
+    int64_t occupied = 0;
+    const std::array<ElementType, 4> occupying { ElementType::e_powder, ElementType::e_solid, ElementType::e_liquid,
+        ElementType::e_gas };
+    for (ElementType type : occupying) {
+        for (int y = 0; y < simulation.height(); y++) {
+            for (int w = 0; w < occupancy.words_per_row(); w++) {
+                occupied += std::popcount(occupancy.word(type, y, w));
+            }
+        }
+    }
+    const int64_t resident = resident_memory_bytes();
+
+    std::lock_guard lock(m_mutex);
+    m_occupied_cells = occupied;
+    m_redrawn_tiles = redrawn_tiles;
+    m_dropped_ticks = dropped_ticks;
+    m_resident_bytes = resident;
+}
+
+static std::string histogram_json(const util::Histogram& histogram)
+{
+    // Recorded in microseconds, written in milliseconds
+    return fmt::format(
+        R"({{"count":{},"min":{:.3f},"mean":{:.3f},"p50":{:.3f},"p90":{:.3f},"p99":{:.3f},"p999":{:.3f},)"
+        R"("max":{:.3f}}})",
+        histogram.count(), static_cast<double>(histogram.min()) / 1e3, histogram.mean() / 1e3,
+        static_cast<double>(histogram.value_at(0.5)) / 1e3, static_cast<double>(histogram.value_at(0.9)) / 1e3,
+        static_cast<double>(histogram.value_at(0.99)) / 1e3, static_cast<double>(histogram.value_at(0.999)) / 1e3,
+        static_cast<double>(histogram.max()) / 1e3);
+}
+
+void Metrics::write_json_line(spdlog::logger& logger)
+{
+    std::string line;
+    {
+        std::lock_guard lock(m_mutex);
+        const auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch());
+        line = fmt::format(
+            R"({{"time_ms":{},"ticks":{},"tick_ms":{},"frame_ms":{},"render_ms":{},"occupied_cells":{},)"
+            R"("redrawn_tiles":{},"dropped_ticks":{},"resident_bytes":{}}})",
+            now.count(), m_ticks, histogram_json(m_tick.interval), histogram_json(m_frame.interval),
+            histogram_json(m_render.interval), m_occupied_cells, m_redrawn_tiles, m_dropped_ticks, m_resident_bytes);
+        m_tick.interval.reset();
+        m_frame.interval.reset();
+        m_render.interval.reset();
+    }
+    logger.info(line);
+}
+
+static void append_summary(std::string& text, const char* name, const char* help, const util::Histogram& histogram)
+{
+    text += fmt::format("# HELP {} {}\n# TYPE {} summary\n", name, help, name);
+    for (double quantile : k_metrics_quantiles) {
+        text += fmt::format(
+            "{}{{quantile=\"{}\"}} {:.6f}\n", name, quantile, static_cast<double>(histogram.value_at(quantile)) / 1e6);
+    }
+    text += fmt::format("{}_sum {:.6f}\n{}_count {}\n", name, histogram.sum() / 1e6, name, histogram.count());
+}
+
+static void append_value(std::string& text, const char* name, const char* type, const char* help, int64_t value)
+{
+    text += fmt::format("# HELP {} {}\n# TYPE {} {}\n{} {}\n", name, help, name, type, name, value);
+}
+
+std::string Metrics::prometheus_text() const
+{
+    std::lock_guard lock(m_mutex);
+    std::string text;
+    append_summary(text, "pop_tick_seconds", "Time to step the simulation by one tick.", m_tick.total);
+    append_summary(
+        text, "pop_frame_seconds", "Time from the start of one frame to the start of the next.", m_frame.total);
+    append_summary(text, "pop_render_seconds", "Time spent drawing the grid into images in a frame.", m_render.total);
+    append_value(text, "pop_ticks_total", "counter", "Ticks stepped.", static_cast<int64_t>(m_ticks));
+    append_value(text, "pop_dropped_ticks_total", "counter", "Ticks dropped because the simulation fell behind.",
+        m_dropped_ticks);
+    append_value(text, "pop_occupied_cells", "gauge", "Cells holding anything but air.", m_occupied_cells);
+    append_value(
+        text, "pop_redrawn_tiles", "gauge", "Tiles of the screen redrawn during the last frame.", m_redrawn_tiles);
+    append_value(text, "pop_resident_memory_bytes", "gauge", "Memory the process holds in RAM.", m_resident_bytes);
+    return text;
+}
+
+int64_t resident_memory_bytes()
+{
+#if defined(__linux__)
+    // Second field is the resident size in pages
+    std::ifstream statm("/proc/self/statm");
+    int64_t size = 0;
+    int64_t resident = 0;
+    if (statm >> size >> resident) {
+        return resident * sysconf(_SC_PAGESIZE);
+    }
+#endif
+    return 0;
+}
+
+}
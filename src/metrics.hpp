@@ -0,0 +1,70 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include <spdlog/spdlog.h>
+
+#include "util/histogram.hpp"
+
+namespace pop {
+
+class Simulation;
+
+/**
+ * @brief Latency histograms and gauges of a run. Each histogram is kept twice: since the last JSON line, and since the
+ * start for scrapes. Values are recorded on one thread, and scrapes may come from another.
+ */
+class Metrics {
+public:
+    void record_tick(std::chrono::nanoseconds duration);
+
+    void record_frame(std::chrono::nanoseconds duration);
+
+    void record_render(std::chrono::nanoseconds duration);
+
+    /**
+     * @brief Update the gauges from the state of a simulation
+     * @param redrawn_tiles - Tiles of the screen whose pixels changed during the last frame
+     * @param dropped_ticks - Ticks dropped so far because the simulation fell behind
+     */
+    void update_gauges(const Simulation& simulation, int redrawn_tiles, int64_t dropped_ticks);
+
+    /**
+     * @brief Log everything recorded since the last line as a line of JSON and start a new interval
+     */
+    void write_json_line(spdlog::logger& logger);
+
+    /**
+     * @brief Get everything recorded since the start in the Prometheus text exposition format
+     */
+    [[nodiscard]] std::string prometheus_text() const;
+
+private:
+    struct Series {
+        util::Histogram interval {};
+        util::Histogram total {};
+
+        void record(std::chrono::nanoseconds duration);
+    };
+
+    mutable std::mutex m_mutex {};
+    Series m_tick {};
+    Series m_frame {};
+    Series m_render {};
+    uint64_t m_ticks = 0;
+    int64_t m_occupied_cells = 0;
+    int64_t m_redrawn_tiles = 0;
+    int64_t m_dropped_ticks = 0;
+    int64_t m_resident_bytes = 0;
+};
+
+/**
+ * @brief Get the memory the process holds in RAM
+ * @return - Size in bytes, or 0 where it isn't known
+ */
+[[nodiscard]] int64_t resident_memory_bytes();
+
+}
@@ -0,0 +1,145 @@
+#include "occupancy.hpp"
+
+#include <algorithm>
+#include <atomic>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define POP_OCCUPANCY_SSE2
+#endif
+
+namespace pop {
+
+static uint64_t pack_bits(const uint8_t* types, int count, uint8_t type)
+{
+    uint64_t bits = 0;
+    int i = 0;
+#ifdef POP_OCCUPANCY_SSE2
+    const __m128i type_vec = _mm_set1_epi8(static_cast<char>(type));
+    for (; i + 16 <= count; i += 16) {
+        __m128i vals = _mm_loadu_si128(reinterpret_cast<const __m128i*>(types + i));
+        auto mask = static_cast<uint64_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(vals, type_vec)));
+        bits |= mask << i;
+    }
+#endif
+    for (; i < count; i++) {
+        bits |= static_cast<uint64_t>(types[i] == type) << i;
+    }
+    return bits;
+}
+
+Occupancy::Occupancy(int width, int height)
+    : m_width(width)
+    , m_height(height)
+    , m_words_per_row((width + 63) / 64)
+{
+    for (std::vector<uint64_t>& plane : m_planes) {
+        plane.resize(m_words_per_row * m_height);
+    }
+}
+
+void Occupancy::rebuild_row(int row, const uint8_t* types)
+{
+    for (int w = 0; w < m_words_per_row; w++) {
+        int count = std::min(64, m_width - w * 64);
+        for (int type = 0; type < k_element_type_count; type++) {
+            m_planes[type][row * m_words_per_row + w] = pack_bits(types + w * 64, count, static_cast<uint8_t>(type));
+        }
+    }
+}
+
+void Occupancy::set(Vector2i pos, ElementType from, ElementType to)
+{
+    if (from == to) {
+        return;
+    }
+    int word_index = pos.y * m_words_per_row + (pos.x >> 6);
+    uint64_t bit = uint64_t(1) << (pos.x & 63);
+    m_planes[static_cast<int>(from)][word_index] &= ~bit;
+    m_planes[static_cast<int>(to)][word_index] |= bit;
+}
+
+void Occupancy::swap(Vector2i pos1, ElementType type1, Vector2i pos2, ElementType type2)
+{
+    if (type1 == type2) {
+        return;
+    }
+    set(pos1, type1, type2);
+    set(pos2, type2, type1);
+}
+
+void Occupancy::set_shared(Vector2i pos, ElementType from, ElementType to)
+{
+    if (from == to) {
+        return;
+    }
+    int word_index = pos.y * m_words_per_row + (pos.x >> 6);
+    uint64_t bit = uint64_t(1) << (pos.x & 63);
+    std::atomic_ref(m_planes[static_cast<int>(from)][word_index]).fetch_and(~bit, std::memory_order_relaxed);
+    std::atomic_ref(m_planes[static_cast<int>(to)][word_index]).fetch_or(bit, std::memory_order_relaxed);
+}
+
+void Occupancy::swap_shared(Vector2i pos1, ElementType type1, Vector2i pos2, ElementType type2)
+{
+    if (type1 == type2) {
+        return;
+    }
+    set_shared(pos1, type1, type2);
+    set_shared(pos2, type2, type1);
+}
+
+uint64_t Occupancy::window(const std::vector<uint64_t>& plane, int row, int x) const
+{
+    // Relaxed loads compile to plain ones, and keep reads defined while swap_shared() writes the word
+    uint64_t* words = const_cast<uint64_t*>(plane.data()) + row * m_words_per_row;
+    auto load = [&](int w) { return std::atomic_ref(words[w]).load(std::memory_order_relaxed); };
+    int start = x - 1;
+    if (start < 0) {
+        return (load(0) << 1) & 0b111;
+    }
+    int w = start >> 6;
+    int offset = start & 63;
+    uint64_t bits = load(w) >> offset;
+    if (offset > 61 && w + 1 < m_words_per_row) {
+        bits |= load(w + 1) << (64 - offset);
+    }
+    return bits & 0b111;
+}
+
+uint8_t Occupancy::neighbor_mask(Vector2i pos, ElementType type) const
+{
+    const std::vector<uint64_t>& plane = m_planes[static_cast<int>(type)];
+    uint64_t mask = 0;
+    if (pos.y > 0) {
+        mask |= window(plane, pos.y - 1, pos.x);
+    }
+    uint64_t middle = window(plane, pos.y, pos.x);
+    mask |= (middle & 0b001) << 3;
+    mask |= (middle & 0b100) << 2;
+    if (pos.y + 1 < m_height) {
+        mask |= window(plane, pos.y + 1, pos.x) << 5;
+    }
+    return static_cast<uint8_t>(mask);
+}
+
+uint64_t Occupancy::word(ElementType type, int row, int word_index) const
+{
+    return m_planes[static_cast<int>(type)][row * m_words_per_row + word_index];
+}
+
+int Occupancy::words_per_row() const
+{
+    return m_words_per_row;
+}
+
+int Occupancy::width() const
+{
+    return m_width;
+}
+
+int Occupancy::height() const
+{
+    return m_height;
+}
+
+}
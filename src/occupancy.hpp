@@ -0,0 +1,89 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "common.hpp"
+#include "elements.hpp"
+
+namespace pop {
+
+/**
+ * @brief Bits of an 8-neighbor mask as returned by Occupancy::neighbor_mask
+ */
+namespace neighbor {
+inline constexpr uint8_t top_left = 1 << 0;
+inline constexpr uint8_t top = 1 << 1;
+inline constexpr uint8_t top_right = 1 << 2;
+inline constexpr uint8_t left = 1 << 3;
+inline constexpr uint8_t right = 1 << 4;
+inline constexpr uint8_t bottom_left = 1 << 5;
+inline constexpr uint8_t bottom = 1 << 6;
+inline constexpr uint8_t bottom_right = 1 << 7;
+
+inline constexpr uint8_t top_row = top_left | top | top_right;
+inline constexpr uint8_t bottom_row = bottom_left | bottom | bottom_right;
+
+// Offset of the neighbor at each bit
+inline constexpr std::array<Vector2i, 8> offsets {
+    { { -1, -1 }, { 0, -1 }, { 1, -1 }, { -1, 0 }, { 1, 0 }, { -1, 1 }, { 0, 1 }, { 1, 1 } }
+};
+}
+
+inline constexpr int k_element_type_count = 5;
+
+/**
+ * @brief Packed per-row bitplanes, one per ElementType, with one bit per cell. Bit x % 64 of word x / 64 of a row is
+ * set if the cell at x is of that type. Out of bounds cells are never set in any plane. Words are read atomically, so
+ * masks may be taken while other threads swap cells through swap_shared().
+ */
+class Occupancy {
+public:
+    Occupancy(int width, int height);
+
+    /**
+     * @brief Rebuild the planes of a row
+     * @param types - Element type of each cell in the row, one byte per cell
+     */
+    void rebuild_row(int row, const uint8_t* types);
+
+    void set(Vector2i pos, ElementType from, ElementType to);
+
+    void swap(Vector2i pos1, ElementType type1, Vector2i pos2, ElementType type2);
+
+    /**
+     * @brief Change the type of a cell like set(), with atomic updates so threads may change cells sharing words at the
+     * same time
+     */
+    void set_shared(Vector2i pos, ElementType from, ElementType to);
+
+    /**
+     * @brief Swap two cells like swap(), with atomic updates so threads may swap cells sharing words at the same time
+     */
+    void swap_shared(Vector2i pos1, ElementType type1, Vector2i pos2, ElementType type2);
+
+    /**
+     * @brief Get which of the 8 neighbors of a cell are of a type
+     * @return - Mask made of neighbor:: bits
+     */
+    [[nodiscard]] uint8_t neighbor_mask(Vector2i pos, ElementType type) const;
+
+    [[nodiscard]] uint64_t word(ElementType type, int row, int word_index) const;
+
+    [[nodiscard]] int words_per_row() const;
+
+    [[nodiscard]] int width() const;
+
+    [[nodiscard]] int height() const;
+
+private:
+    const int m_width;
+    const int m_height;
+    const int m_words_per_row;
+    std::array<std::vector<uint64_t>, k_element_type_count> m_planes {};
+
+    [[nodiscard]] uint64_t window(const std::vector<uint64_t>& plane, int row, int x) const;
+};
+
+}
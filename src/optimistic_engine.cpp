@@ -0,0 +1,100 @@
+#include "optimistic_engine.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <numeric>
+
+#include "simulation.hpp"
+#include "util/profiler.hpp"
+#include "util/rng.hpp"
+
+namespace pop {
+
+// Cells per batch, batches are contiguous runs of cells stepped in a shuffled order
+static constexpr int k_batch_size = 256;
+
+void CellClaims::resize(int cell_count)
+{
+    m_words.resize(cell_count);
+}
+
+void CellClaims::next_stamp()
+{
+    m_stamp++;
+}
+
+bool CellClaims::try_claim(int cell)
+{
+    std::atomic_ref<uint64_t> word(m_words[cell]);
+    uint64_t current = word.load(std::memory_order_acquire);
+    while (current != m_stamp) {
+        if (word.compare_exchange_weak(current, m_stamp, std::memory_order_acq_rel)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void CellClaims::release(int cell)
+{
+    // Stamps only grow, so the one before never matches
+    std::atomic_ref<uint64_t>(m_words[cell]).store(m_stamp - 1, std::memory_order_release);
+}
+
+bool CellClaims::is_claimed(int cell) const
+{
+    return std::atomic_ref<uint64_t>(const_cast<uint64_t&>(m_words[cell])).load(std::memory_order_acquire) == m_stamp;
+}
+
+void step_optimistic(Simulation& simulation, CellClaims& claims, util::WorkerPool* pool)
+{
+    const int cell_count = simulation.width() * simulation.height();
+    const int batch_count = (cell_count + k_batch_size - 1) / k_batch_size;
+    claims.resize(cell_count);
+    claims.next_stamp();
+
+    const uint64_t tick_seed = simulation.tick_seed();
+    util::Rng order_rng(tick_seed);
+    // Batches go from the bottom of the grid up, shuffled among those starting on the same row, so workers mostly step
+    // particles after the ones below them have moved out of the way, like the serial engine
+    std::vector<int> batches(batch_count);
+    std::iota(batches.rbegin(), batches.rend(), 0);
+    const int width = simulation.width();
+    for (auto row_start = batches.begin(); row_start != batches.end();) {
+        const int row = *row_start * k_batch_size / width;
+        const auto row_end = std::find_if(
+            row_start, batches.end(), [&](int batch) { return batch * k_batch_size / width != row; });
+        for (auto i = row_end - row_start - 1; i > 0; i--) {
+            std::swap(row_start[i], row_start[order_rng.range(0, static_cast<int>(i))]);
+        }
+        row_start = row_end;
+    }
+
+    simulation.set_cell_claims(&claims);
+    util::parallel_for(pool, 0, batch_count, [&](int start, int end, int) {
+        PROFILE_ZONE("optimistic_batches");
+        util::Rng rng;
+        Simulation::set_thread_rng(&rng);
+        for (int b = start; b < end; b++) {
+            const int batch_start = batches[b] * k_batch_size;
+            const int size = std::min(k_batch_size, cell_count - batch_start);
+            rng.seed(util::mix64(tick_seed ^ static_cast<uint64_t>(batches[b])));
+            // An odd stride visits every cell of a full batch exactly once
+            const int stride = size == k_batch_size ? rng.range(0, k_batch_size / 2 - 1) * 2 + 1 : 1;
+            const int offset = rng.range(0, size - 1);
+            for (int i = 0; i < size; i++) {
+                const int cell = batch_start + (offset + i * stride) % size;
+                // Claimed cells hold a particle that already moved this tick
+                if (!claims.is_claimed(cell)) {
+                    simulation.update_particle(simulation.pos_at(cell));
+                }
+            }
+        }
+        Simulation::set_thread_rng(nullptr);
+    });
+    simulation.set_cell_claims(nullptr);
+
+    simulation.rebuild_occupancy();
+}
+
+}
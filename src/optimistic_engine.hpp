@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "util/worker_pool.hpp"
+
+namespace pop {
+
+class Simulation;
+
+/**
+ * @brief Per-cell claim words of the optimistic engine. A cell is claimed for a tick by swapping the tick's stamp into
+ * its word, a particle in a claimed cell has already moved or been moved onto this tick.
+ */
+class CellClaims {
+public:
+    void resize(int cell_count);
+
+    /**
+     * @brief Start a new tick, releasing every claim without touching the words
+     */
+    void next_stamp();
+
+    /**
+     * @brief Claim a cell for the current tick
+     * @return - False if another worker claimed the cell first
+     */
+    bool try_claim(int cell);
+
+    /**
+     * @brief Give up the claim on a cell, so other particles may move into it this tick
+     */
+    void release(int cell);
+
+    /**
+     * @brief Check if a cell has been claimed this tick
+     */
+    [[nodiscard]] bool is_claimed(int cell) const;
+
+private:
+    std::vector<uint64_t> m_words {};
+    uint64_t m_stamp = 0;
+};
+
+/**
+ * @brief Step the simulation by running kernels live on batches of cells in parallel. Batches are taken from the bottom
+ * of the grid up, shuffled among batches starting on the same row, and their cells in a shuffled order. A swap claims
+ * both of its cells first and is skipped if another worker claimed either, and cells already claimed this tick aren't
+ * stepped, so a particle moves at most once a tick. Air a particle leaves behind is released again, so a particle can
+ * follow another down in the same tick like in the serial engine. The occupancy planes kernels read are updated with
+ * atomic operations as cells change. Reactions may see neighbors changed by other workers mid-tick, and the result
+ * depends on scheduling.
+ * @param pool - Pool to step batches on, or nullptr to run on the calling thread
+ */
+void step_optimistic(Simulation& simulation, CellClaims& claims, util::WorkerPool* pool);
+
+}
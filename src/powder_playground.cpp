@@ -1,40 +1,255 @@
 #include "powder_playground.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <optional>
 #include <random>
+#include <stdexcept>
 
 #include <BS_thread_pool.hpp>
 #include <raylib-cpp.hpp>
 
 #include "util/fixed_loop.hpp"
 #define LOGGER_RAYLIB
+#include "autosave.hpp"
+#include "brush.hpp"
 #include "common.hpp"
+#include "edit_history.hpp"
+#include "frame_graph.hpp"
+#include "game_state.hpp"
+#include "hud.hpp"
+#include "mapped_chunk_store.hpp"
+#include "metrics.hpp"
+#include "replay.hpp"
+#include "rewind.hpp"
+#include "scene.hpp"
 #include "simulation.hpp"
+#include "sparse_chunk_store.hpp"
+#include "util/file.hpp"
 #include "util/logger.hpp"
+#include "util/metrics_server.hpp"
+#include "util/profiler.hpp"
+#include "util/task_graph.hpp"
+#include "util/worker_pool.hpp"
+#include "world_view.hpp"
+
+#define RAYGUI_IMPLEMENTATION
+#include <raygui.h>
 
 namespace rl = raylib;
 
 namespace pop {
 
-struct GameState {
-    int screen_width;
-    int screen_height;
+// Saved with F5 and loaded with F9
+inline constexpr const char* k_scene_path = "scene.pop";
 
-    Simulation simulation;
+// Saved every few seconds with --autosave
+inline constexpr const char* k_autosave_path = "autosave.pop";
 
-    util::FixedLoop fixed_loop;
-    BS::thread_pool thread_pool;
+// Threads of the pool frames run on, the main thread among them. Tiles are rasterized on the others while the main
+// thread steps the simulation on its own pool.
+inline constexpr int k_render_workers = 3;
 
-    ElementId selected_element = 0;
+// Most memory the history kept to rewind through takes, however many seconds are asked for
+inline constexpr std::size_t k_rewind_budget = std::size_t(256) << 20;
 
-    rl::Image powder_image;
-    rl::Image gas_image;
-    rl::Texture2D powder_texture;
-    rl::Texture2D gas_texture;
-    rl::Shader blur_shader;
-    rl::RenderTexture2D gas_render_texture;
-};
+// Most memory the undo and redo stacks take
+inline constexpr std::size_t k_undo_budget = std::size_t(64) << 20;
 
-void main_loop(GameState& game_state)
+// Size of worlds created with --world, 65536x65536 cells
+inline constexpr Vector2i k_world_chunks { 1024, 1024 };
+inline constexpr int k_world_resident_slots = 4096;
+
+/**
+ * @brief Apply an edit made by the player, keeping the cells it overwrites to undo and recording it if a replay is
+ * being recorded
+ */
+void make_edit(GameState& game_state, Edit edit)
+{
+    const Simulation& simulation = game_state.simulation;
+    // Worked out once for the history and for painting
+    std::vector<BrushSpan> spans;
+    if (edit.type == EditType::e_stroke) {
+        spans = stroke_spans(edit.brush, edit.from, edit.pos, edit.seed, { simulation.width(), simulation.height() });
+    }
+    if (game_state.history != nullptr) {
+        switch (edit.type) {
+        case EditType::e_paint:
+            game_state.history->record(game_state.simulation, edit.pos);
+            break;
+        case EditType::e_stroke:
+            for (const BrushSpan& span : spans) {
+                game_state.history->record(simulation, span.start, span.length);
+            }
+            break;
+        case EditType::e_clear:
+        case EditType::e_scene:
+            game_state.history->record_grid(game_state.simulation);
+            break;
+        default:
+            break;
+        }
+    }
+    const std::vector<BrushSpan>* painted = edit.type == EditType::e_stroke ? &spans : nullptr;
+    if (game_state.recorder != nullptr) {
+        game_state.recorder->apply(game_state.simulation, std::move(edit), game_state.worker_pool.get(), painted);
+    }
+    else {
+        apply_edit(game_state.simulation, edit, game_state.worker_pool.get(), painted);
+    }
+}
+
+void toggle_table_driven(GameState& game_state)
+{
+    const Simulation& simulation = game_state.simulation;
+    bool enabled = false;
+    for (ElementId id = 1; id <= static_cast<ElementId>(simulation.element_count()); id++) {
+        enabled |= simulation.table_driven(id);
+    }
+    enabled = !enabled;
+    make_edit(game_state, { .type = EditType::e_table_driven, .enabled = enabled });
+    for (ElementId id = 1; id <= static_cast<ElementId>(simulation.element_count()); id++) {
+        const RuleTable* table = simulation.rule_table(id);
+        if (table == nullptr || !table->can_move()) {
+            continue;
+        }
+        if (enabled) {
+            int mismatches = table->cross_validate(simulation, id, 1000);
+            POP_LOG_INFO("Rule table of {}: {} mismatches against kernel", simulation.element_of(id).name, mismatches);
+        }
+    }
+}
+
+int engine_index(const Simulation& simulation)
+{
+    const std::vector<std::string_view>& names = engine_names();
+    auto current = std::find(names.begin(), names.end(), simulation.engine().name());
+    return current == names.end() ? 0 : static_cast<int>(current - names.begin());
+}
+
+void switch_engine(GameState& game_state, std::string_view name, int chunk_size)
+{
+    make_edit(game_state,
+        { .type = EditType::e_engine, .engine_name = std::string(name), .chunk_size = chunk_size });
+    // The panel only reads the engine back while it is shown, and would switch back to what it last showed otherwise
+    game_state.hud.engine_index = engine_index(game_state.simulation);
+    const Engine& engine = game_state.simulation.engine();
+    if (game_state.simulation.deterministic() && !engine.deterministic()) {
+        POP_LOG_INFO("Steps aren't deterministic while the {} engine runs, it depends on scheduling", engine.name());
+    }
+    POP_LOG_INFO("Switched to the {} engine", engine.name());
+}
+
+void cycle_engine(GameState& game_state)
+{
+    const std::vector<std::string_view>& names = engine_names();
+    switch_engine(game_state, names[(engine_index(game_state.simulation) + 1) % names.size()],
+        game_state.hud.chunk_size);
+}
+
+void toggle_rewind(GameState& game_state)
+{
+    if (game_state.rewind == nullptr || game_state.rewind->empty()) {
+        return;
+    }
+    if (game_state.rewind_tick.has_value()) {
+        // Stepping on from an earlier tick drops the ticks after it
+        game_state.rewind_tick.reset();
+        return;
+    }
+    game_state.rewind_tick = game_state.simulation.tick();
+    const Rewind& rewind = *game_state.rewind;
+    POP_LOG_INFO("Rewinding through ticks {} to {}, {:.1f} MB", rewind.oldest_tick(), rewind.newest_tick(),
+        static_cast<double>(rewind.memory_bytes()) / (1 << 20));
+}
+
+/**
+ * @brief Move the rewound grid a tick per frame while the left or right arrow is held, or a second with shift
+ */
+void scrub(GameState& game_state)
+{
+    const int direction = IsKeyDown(KEY_RIGHT) - IsKeyDown(KEY_LEFT);
+    if (direction == 0) {
+        return;
+    }
+    const bool fast = IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT);
+    const auto step = static_cast<int64_t>(fast ? std::lround(game_state.fixed_loop.rate()) : 1);
+    const Rewind& rewind = *game_state.rewind;
+    const auto tick = static_cast<uint64_t>(std::clamp(static_cast<int64_t>(game_state.rewind_tick.value())
+            + direction * step,
+        static_cast<int64_t>(rewind.oldest_tick()), static_cast<int64_t>(rewind.newest_tick())));
+    if (tick != game_state.rewind_tick.value()) {
+        game_state.rewind->restore(game_state.simulation, tick, game_state.worker_pool.get());
+        game_state.rewind_tick = tick;
+    }
+}
+
+/**
+ * @brief Undo the last edit with ctrl+Z and redo it with ctrl+Y or ctrl+shift+Z. Undoing goes through make_edit() like
+ * any edit, so it is recorded into replays as the cells it writes.
+ */
+void undo_redo(GameState& game_state)
+{
+    const bool ctrl = IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL);
+    if (game_state.history == nullptr || !ctrl) {
+        return;
+    }
+    const bool shift = IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT);
+    std::optional<Edit> edit;
+    if (IsKeyPressed(KEY_Z) && !shift) {
+        edit = game_state.history->undo(game_state.simulation);
+    }
+    else if (IsKeyPressed(KEY_Y) || (IsKeyPressed(KEY_Z) && shift)) {
+        edit = game_state.history->redo(game_state.simulation);
+    }
+    if (edit.has_value()) {
+        make_edit(game_state, std::move(edit.value()));
+    }
+}
+
+void save_trace()
+{
+    if (!util::profiling_enabled()) {
+        POP_LOG_WARN("Built without profiling, build with POP_PROFILING to record traces");
+        return;
+    }
+    const int zone_count = util::write_trace("trace.json");
+    if (zone_count < 0) {
+        POP_LOG_ERROR("Unable to write trace.json");
+        return;
+    }
+    POP_LOG_INFO("Wrote {} profiler zones to trace.json", zone_count);
+}
+
+void save_scene_file(GameState& game_state)
+{
+    try {
+        const auto start = std::chrono::steady_clock::now();
+        const std::size_t size = save_scene(game_state.simulation, k_scene_path, game_state.worker_pool.get());
+        const std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+        POP_LOG_INFO("Saved {} bytes to {} in {:.2f} ms", size, k_scene_path, duration.count());
+    }
+    catch (const std::exception& e) {
+        POP_LOG_ERROR("Unable to save scene: {}", e.what());
+    }
+}
+
+void load_scene_file(GameState& game_state, const std::string& path)
+{
+    try {
+        const auto start = std::chrono::steady_clock::now();
+        make_edit(game_state, { .type = EditType::e_scene, .scene = util::read_file(path) });
+        const std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+        POP_LOG_INFO("Loaded {} in {:.2f} ms", path, duration.count());
+    }
+    catch (const std::exception& e) {
+        POP_LOG_ERROR("Unable to load scene: {}", e.what());
+    }
+}
+
+void apply_input(GameState& game_state)
 {
     Simulation& simulation = game_state.simulation;
 
@@ -63,58 +278,156 @@ void main_loop(GameState& game_state)
         game_state.selected_element = simulation.id_of("toxic_gas");
     }
 
-    if (IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
-        rl::Vector2 mouse_pos = GetMousePosition();
-        Vector2i sim_pos { (int)mouse_pos.x, (int)mouse_pos.y };
-        if (simulation.in_bounds(sim_pos)) {
-            simulation.particle_at(sim_pos).element_id = game_state.selected_element;
-            if (game_state.selected_element == simulation.id_of("salt")) {
-                simulation.particle_at(sim_pos).shade = (float)GetRandomValue(750, 1000) / 1000.0f;
-            }
-        }
+    if (IsKeyPressed(KEY_T)) {
+        toggle_table_driven(game_state);
+    }
+    if (IsKeyPressed(KEY_E)) {
+        cycle_engine(game_state);
+    }
+    if (IsKeyPressed(KEY_R)) {
+        toggle_rewind(game_state);
     }
-    else if (IsMouseButtonDown(MOUSE_BUTTON_RIGHT)) {
-        rl::Vector2 mouse_pos = GetMousePosition();
-        Vector2i sim_pos { (int)mouse_pos.x, (int)mouse_pos.y };
-        if (simulation.in_bounds(sim_pos)) {
-            simulation.particle_at(sim_pos).element_id = simulation.id_of("air");
+    if (game_state.rewind_tick.has_value()) {
+        scrub(game_state);
+    }
+    else {
+        // Scrubbing would throw away what is undone while rewinding
+        undo_redo(game_state);
+    }
+    if (IsKeyPressed(KEY_C)) {
+        make_edit(game_state, { .type = EditType::e_clear, .element_id = game_state.air_id });
+    }
+    if (IsKeyPressed(KEY_F3)) {
+        game_state.hud.visible = !game_state.hud.visible;
+    }
+    if (IsKeyPressed(KEY_F4)) {
+        save_trace();
+    }
+    if (IsKeyPressed(KEY_F5)) {
+        save_scene_file(game_state);
+    }
+    if (IsKeyPressed(KEY_F9)) {
+        load_scene_file(game_state, k_scene_path);
+    }
+    if (game_state.world_view != nullptr) {
+        const Vector2i step { IsKeyPressed(KEY_RIGHT) - IsKeyPressed(KEY_LEFT),
+            IsKeyPressed(KEY_DOWN) - IsKeyPressed(KEY_UP) };
+        if (step.x != 0 || step.y != 0) {
+            const Vector2i origin = game_state.world_view->origin();
+            game_state.world_view->move_to({ origin.x + step.x, origin.y + step.y }, game_state.worker_pool.get());
         }
     }
 
-    game_state.fixed_loop.update(20, [&]() { simulation.update(); });
-
-    game_state.powder_image.ClearBackground(rl::Color().Alpha(0));
-    game_state.gas_image.ClearBackground(rl::Color().Alpha(0));
-
-    draw_sim(game_state.powder_image, game_state.gas_image, simulation, game_state.thread_pool);
-
-    game_state.powder_texture.Update(game_state.powder_image.data);
-    game_state.gas_texture.Update(game_state.gas_image.data);
-
-    BeginDrawing();
-    {
-        ClearBackground(rl::Color(15, 15, 15));
-
-        game_state.powder_texture.Draw(
-            rl::Rectangle(0, 0, (float)simulation.width(), (float)simulation.height()),
-            rl::Rectangle(0, 0, (float)game_state.screen_width, (float)game_state.screen_height));
+    const float wheel = GetMouseWheelMove();
+    if (wheel != 0.0f) {
+        Brush& brush = game_state.brush;
+        brush.radius = std::clamp(brush.radius + (wheel > 0.0f ? 1 : -1), 0, k_max_brush_radius);
+    }
+    if (IsKeyPressed(KEY_B)) {
+        Brush& brush = game_state.brush;
+        brush.shape = brush.shape == BrushShape::e_spray ? BrushShape::e_circle
+                                                         : static_cast<BrushShape>(static_cast<int>(brush.shape) + 1);
+    }
 
-        game_state.gas_render_texture.BeginMode();
-        ClearBackground(rl::Color().Alpha(0));
-        game_state.gas_texture.Draw(
-            rl::Rectangle(0, 0, (float)simulation.width(), (float)simulation.height()),
-            rl::Rectangle(0, 0, (float)game_state.screen_width, (float)game_state.screen_height));
-        game_state.gas_render_texture.EndMode();
+    const bool painting = IsMouseButtonDown(MOUSE_BUTTON_LEFT) || IsMouseButtonDown(MOUSE_BUTTON_RIGHT);
+    const rl::Vector2 mouse_pos = GetMousePosition();
+    if (!painting || (game_state.hud.visible && CheckCollisionPointRec(mouse_pos, k_hud_bounds))) {
+        game_state.last_stroke.reset();
+        if (!painting && game_state.history != nullptr) {
+            game_state.history->end_stroke();
+        }
+        return;
+    }
+    const float sim_scale = (float)simulation.width() / (float)game_state.screen_width;
+    // Strokes dragged off the window stay on its edge
+    const Vector2i sim_pos { std::clamp((int)(mouse_pos.x * sim_scale), 0, simulation.width() - 1),
+        std::clamp((int)(mouse_pos.y * sim_scale), 0, simulation.height() - 1) };
+    const bool erasing = !IsMouseButtonDown(MOUSE_BUTTON_LEFT);
+    const ElementId element_id = erasing ? game_state.air_id : game_state.selected_element;
+    Edit stroke { .type = EditType::e_stroke,
+        .pos = sim_pos,
+        .from = game_state.last_stroke.has_value() ? game_state.last_stroke->pos : sim_pos,
+        .brush = game_state.brush,
+        .seed = game_state.stroke_seed++,
+        .element_id = element_id };
+    if (element_id == game_state.salt_id) {
+        stroke.shade = 0.75f;
+    }
+    // Holding still would paint the same cells again every frame, except with a spray, which fills in more of them
+    const std::optional<Edit>& last = game_state.last_stroke;
+    if (last.has_value() && last->pos.x == sim_pos.x && last->pos.y == sim_pos.y && last->element_id == element_id
+        && last->brush.shape == stroke.brush.shape && last->brush.radius == stroke.brush.radius
+        && stroke.brush.shape != BrushShape::e_spray) {
+        return;
+    }
+    game_state.last_stroke = stroke;
+    make_edit(game_state, std::move(stroke));
+}
 
-        game_state.blur_shader.BeginMode();
-        game_state.gas_render_texture.GetTexture().Draw();
-        game_state.blur_shader.EndMode();
+void simulate(GameState& game_state)
+{
+    Simulation& simulation = game_state.simulation;
+    PerfHud& hud = game_state.hud;
+    if (game_state.rewind_tick.has_value()) {
+        // Ticks don't pile up while rewinding
+        game_state.fixed_loop.reset();
+        return;
+    }
+    game_state.fixed_loop.update(20, [&]() {
+        const auto start = std::chrono::steady_clock::now();
+        simulation.update();
+        const auto duration = std::chrono::steady_clock::now() - start;
+        game_state.metrics.record_tick(duration);
+        hud.window_tick_ms += std::chrono::duration<double, std::milli>(duration).count();
+        hud.window_ticks++;
+        if (simulation.deterministic() && simulation.tick() % 240 == 0) {
+            POP_LOG_INFO("Tick {} checksum {:016x}", simulation.tick(), simulation.checksum());
+        }
+        if (game_state.rewind != nullptr) {
+            game_state.rewind->record(simulation, game_state.worker_pool.get());
+        }
+    });
+    if (game_state.autosave != nullptr) {
+        game_state.autosave->update(simulation);
+    }
+}
 
-        DrawFPS(10, 10);
+void record_metrics(GameState& game_state)
+{
+    const auto now = std::chrono::steady_clock::now();
+    game_state.metrics.record_frame(now - game_state.frame_start);
+    game_state.frame_start = now;
+    const double render_ms = frame_time(game_state, "raster") + frame_time(game_state, "stage");
+    game_state.metrics.record_render(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double, std::milli>(render_ms)));
+    game_state.metrics.update_gauges(
+        game_state.simulation, redrawn_tile_count(game_state), game_state.fixed_loop.dropped_steps());
+
+    if (game_state.metrics_interval.count() > 0 && now - game_state.last_metrics_line >= game_state.metrics_interval) {
+        game_state.metrics.write_json_line(util::metrics_logger());
+        game_state.last_metrics_line = now;
+    }
+}
 
-        rl::DrawText(simulation.element_of(game_state.selected_element).friendly_name, 10, 50, 20, rl::Color::Yellow());
+void main_loop(GameState& game_state)
+{
+    util::TaskGraph& graph = game_state.frame_graph;
+    graph.run(game_state.render_pool);
+
+    game_state.frame_times.clear();
+    for (util::TaskGraph::TaskId task = 0; task < graph.task_count(); task++) {
+        auto time = std::find_if(game_state.frame_times.begin(), game_state.frame_times.end(),
+            [&](const TaskTime& t) { return t.name == graph.name(task); });
+        if (time == game_state.frame_times.end()) {
+            game_state.frame_times.push_back({ .name = graph.name(task), .total_ms = 0.0, .count = 0 });
+            time = game_state.frame_times.end() - 1;
+        }
+        time->total_ms += graph.timing(task).duration_ms;
+        time->count++;
     }
-    EndDrawing();
+
+    record_metrics(game_state);
+    apply_hud(game_state);
 }
 
 void init_elements(Simulation& simulation)
@@ -123,6 +436,7 @@ void init_elements(Simulation& simulation)
     air.name = "air";
     air.friendly_name = "Air";
     air.type = ElementType::e_null;
+    air.bitsliced = true;
     air.update_func = [](Simulation&, Vector2i) {};
     air.color = rl::Color(15, 15, 15);
     simulation.push_element(air);
@@ -131,6 +445,7 @@ void init_elements(Simulation& simulation)
     wall.name = "wall";
     wall.friendly_name = "Wall";
     wall.type = ElementType::e_solid;
+    wall.bitsliced = true;
     wall.update_func = [](Simulation&, Vector2i) {};
     wall.color = rl::Color(120, 120, 120);
     simulation.push_element(wall);
@@ -139,6 +454,7 @@ void init_elements(Simulation& simulation)
     salt.name = "salt";
     salt.friendly_name = "Salt";
     salt.type = ElementType::e_powder;
+    salt.bitsliced = true;
     salt.update_func = update_salt;
     salt.color = rl::Color::FromHSV(0.0f, 0.0f, 1.0f);
     simulation.push_element(salt);
@@ -171,6 +487,7 @@ void init_elements(Simulation& simulation)
     stone.name = "stone";
     stone.friendly_name = "Stone";
     stone.type = ElementType::e_powder;
+    stone.bitsliced = true;
     stone.update_func = update_stone;
     stone.color = rl::Color(140, 140, 140);
     simulation.push_element(stone);
@@ -184,8 +501,13 @@ void init_elements(Simulation& simulation)
     simulation.push_element(toxic_gas);
 }
 
-void run()
+void run(const RunOptions& options)
 {
+    // Worlds page chunks in and out of the grid, which replays don't record
+    if (!options.record_path.empty() && (!options.world_path.empty() || options.sparse_world)) {
+        throw std::runtime_error("Replays can't be recorded of a world");
+    }
+
     const int screen_width = 1200;
     const int screen_height = 900;
 
@@ -198,35 +520,161 @@ void run()
 
     init_elements(simulation);
     simulation.clear_to("air");
+    simulation.set_bitsliced_powders(true);
+    simulation.set_engine(make_engine(options.engine_name));
+    simulation.set_seed(options.seed);
+    // Replays only play back to the same grid if every step is deterministic
+    const bool deterministic = options.deterministic || !options.record_path.empty();
+    simulation.set_deterministic(deterministic);
+    simulation.set_checksums(deterministic);
+
+    PROFILE_THREAD("main");
 
-    LOG->set_level(spdlog::level::err);
+    util::main_logger().set_level(spdlog::level::err);
     GameState game_state {
         .screen_width = screen_width,
         .screen_height = screen_height,
         .simulation = std::move(simulation),
         .fixed_loop = util::FixedLoop(240),
         .thread_pool {},
+        .worker_pool = std::make_unique<util::WorkerPool>(),
+        .render_pool = util::WorkerPool(k_render_workers),
         .selected_element = 1,
+        .air_id = game_state.simulation.id_of("air"),
+        .salt_id = game_state.simulation.id_of("salt"),
+        .brush { .shape = BrushShape::e_circle, .radius = 2 },
+        .last_stroke {},
+        .stroke_seed = 0,
         .powder_image { 320, 240 },
         .gas_image { 320, 240 },
         .powder_texture { game_state.powder_image },
         .gas_texture { game_state.gas_image },
         .blur_shader { nullptr, "res/blur.frag" },
         .gas_render_texture { 1200, 900 },
+        .tiles {},
+        .frame_snapshot {},
+        .palette {},
+        .frame_graph {},
+        .frame_times {},
+        .hud {},
+        .metrics {},
+        .metrics_server {},
+        .metrics_interval = std::chrono::seconds(options.metrics_interval),
+        .last_metrics_line = std::chrono::steady_clock::now(),
+        .frame_start = std::chrono::steady_clock::now(),
+        .world_store {},
+        .world_view {},
+        .autosave {},
+        .recorder {},
+        .record_path = options.record_path,
+        .rewind {},
+        .rewind_tick {},
+        .history {},
     };
-    LOG->set_level(spdlog::level::info);
+    util::main_logger().set_level(spdlog::level::info);
 
     game_state.gas_render_texture.GetTexture().SetWrap(TEXTURE_WRAP_CLAMP);
 
+    // Tiles only upload what changed, so start from images and textures that agree
+    game_state.powder_image.ClearBackground(rl::Color().Alpha(0));
+    game_state.gas_image.ClearBackground(rl::Color().Alpha(0));
+    game_state.powder_texture.Update(game_state.powder_image.data);
+    game_state.gas_texture.Update(game_state.gas_image.data);
+
+    const int sim_width = game_state.simulation.width();
+    const int sim_height = game_state.simulation.height();
+    for (int y = 0; y < sim_height; y += k_tile_size) {
+        for (int x = 0; x < sim_width; x += k_tile_size) {
+            Tile tile { .start = { x, y },
+                .end = { std::min(x + k_tile_size, sim_width), std::min(y + k_tile_size, sim_height) } };
+            const auto size = static_cast<std::size_t>((tile.end.x - x) * (tile.end.y - y));
+            tile.powder_staging.resize(size);
+            tile.gas_staging.resize(size);
+            game_state.tiles.push_back(std::move(tile));
+        }
+    }
+    build_frame_graph(game_state);
+
+    if (options.metrics_port != 0) {
+        game_state.metrics_server = std::make_unique<util::MetricsServer>(static_cast<uint16_t>(options.metrics_port),
+            [&metrics = game_state.metrics]() { return metrics.prometheus_text(); });
+        POP_LOG_INFO("Serving metrics at http://127.0.0.1:{}/metrics", options.metrics_port);
+    }
+
+    game_state.simulation.set_worker_pool(game_state.worker_pool.get());
+    if (!options.world_path.empty()) {
+        game_state.world_store = std::make_unique<MappedChunkStore>(
+            options.world_path, game_state.simulation, k_world_chunks, k_world_resident_slots);
+        const Vector2i world_size = game_state.world_store->size().value();
+        game_state.world_view = std::make_unique<WorldView>(game_state.simulation, *game_state.world_store,
+            Vector2i { world_size.x / 2, world_size.y / 2 }, game_state.worker_pool.get());
+        POP_LOG_INFO("Opened {}, a world of {}x{} chunks", options.world_path, world_size.x, world_size.y);
+    }
+    else if (options.sparse_world) {
+        game_state.world_store
+            = std::make_unique<SparseChunkStore>(Particle { .element_id = game_state.simulation.id_of("air") });
+        game_state.world_view = std::make_unique<WorldView>(
+            game_state.simulation, *game_state.world_store, Vector2i { 0, 0 }, game_state.worker_pool.get());
+    }
+    if (!options.scene_path.empty()) {
+        load_scene_file(game_state, options.scene_path);
+    }
+    if (options.autosave_interval > 0) {
+        game_state.autosave
+            = std::make_unique<Autosave>(k_autosave_path, std::chrono::seconds(options.autosave_interval));
+    }
+    game_state.hud.worker_count = game_state.worker_pool->worker_count();
+    game_state.hud.tick_rate = game_state.fixed_loop.rate();
+    game_state.hud.engine_index = engine_index(game_state.simulation);
+
+    int rule_table_count = game_state.simulation.compile_rule_tables(game_state.thread_pool);
+    POP_LOG_INFO("Compiled rule tables for {} elements", rule_table_count);
+    if (!options.record_path.empty()) {
+        game_state.recorder = std::make_unique<ReplayRecorder>(
+            game_state.simulation, game_state.hud.chunk_size, game_state.worker_pool.get());
+        POP_LOG_INFO("Recording a replay to {}", options.record_path);
+    }
+    // Worlds page chunks through the grid and replays don't record going back, so neither rewinds
+    if (options.rewind_seconds > 0 && game_state.world_view == nullptr && game_state.recorder == nullptr) {
+        const auto ticks = static_cast<uint64_t>(options.rewind_seconds * game_state.fixed_loop.rate());
+        game_state.rewind = std::make_unique<Rewind>(ticks, k_rewind_budget);
+        game_state.rewind->record(game_state.simulation, game_state.worker_pool.get());
+    }
+    // Cells of worlds move around the grid as the view does
+    if (game_state.world_view == nullptr) {
+        game_state.history = std::make_unique<EditHistory>(k_undo_budget);
+    }
+
     const rl::Vector2 blur_shader_resolution { screen_width, screen_height };
     game_state.blur_shader.SetValue(
         game_state.blur_shader.GetLocation("resolution"), &blur_shader_resolution, SHADER_UNIFORM_VEC2);
 
-    SetMouseScale(320.0f / 1200.0f, 320.0f / 1200.0f);
+    GuiSetStyle(DEFAULT, TEXT_SIZE, 20);
 
     while (!window.ShouldClose()) {
+        PROFILE_ZONE("frame");
         main_loop(game_state);
     }
+    if (game_state.world_view != nullptr) {
+        game_state.world_view->save(game_state.worker_pool.get());
+    }
+    if (game_state.autosave != nullptr) {
+        game_state.autosave->save(game_state.simulation);
+        game_state.autosave->wait();
+    }
+    if (game_state.recorder != nullptr) {
+        try {
+            const std::size_t size = game_state.recorder->save(game_state.simulation, game_state.record_path);
+            POP_LOG_INFO("Saved a replay of {} ticks and {} edits to {}, {} bytes", game_state.simulation.tick(),
+                game_state.recorder->edit_count(), game_state.record_path, size);
+        }
+        catch (const std::exception& e) {
+            POP_LOG_ERROR("Unable to save replay: {}", e.what());
+        }
+    }
+    if (util::profiling_enabled()) {
+        save_trace();
+    }
 }
 
 }
\ No newline at end of file
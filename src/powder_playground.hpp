@@ -1,7 +1,41 @@
 #pragma once
 
+#include <cstdint>
+#include <string>
+
 namespace pop {
 
-void run();
+class Simulation;
+
+void init_elements(Simulation& simulation);
+
+struct RunOptions {
+    // Name of the engine to start with, see engine_names()
+    std::string engine_name = "serial";
+    uint64_t seed = 0;
+    // Step deterministically and log the checksum of the grid every second
+    bool deterministic = false;
+    // Seconds between lines of metrics written to logs/metrics.jsonl, 0 to write none
+    int metrics_interval = 0;
+    // Port to serve Prometheus metrics on at 127.0.0.1:<port>/metrics, 0 to not serve them
+    int metrics_port = 0;
+    // Scene file to load at the start, empty to start empty
+    std::string scene_path {};
+    // Seconds between saves of the grid to autosave.pop, 0 to not autosave
+    int autosave_interval = 0;
+    // World file to open or create and step a window of, empty to step the simulation alone
+    std::string world_path {};
+    // Step a window of an unbounded world kept in memory, if no world file is given
+    bool sparse_world = false;
+    // Replay file to record edits to and save on exit, empty to not record. Steps deterministically while recording.
+    std::string record_path {};
+    // Seconds of history kept to rewind through, 0 to keep none
+    int rewind_seconds = 60;
+};
+
+/**
+ * @brief Open the window and run the playground
+ */
+void run(const RunOptions& options);
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,401 @@
+#include "replay.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+#include <BS_thread_pool.hpp>
+
+#include "edit_history.hpp"
+#include "engine.hpp"
+#include "powder_playground.hpp"
+#include "scene.hpp"
+#include "util/bytes.hpp"
+#include "util/file.hpp"
+#include "util/logger.hpp"
+#include "util/profiler.hpp"
+
+namespace pop {
+
+inline constexpr std::array<char, 8> k_replay_magic { 'P', 'O', 'P', 'R', 'E', 'P', 'L', 'Y' };
+
+void apply_edit(Simulation& simulation, const Edit& edit, util::WorkerPool* pool, const std::vector<BrushSpan>* spans)
+{
+    switch (edit.type) {
+    case EditType::e_paint: {
+        // Read through the const overload, the non-const one would mark the chunk changed just for reading it
+        Particle particle = std::as_const(simulation).particle_at(edit.pos);
+        particle.element_id = edit.element_id;
+        particle.shade = edit.shade.value_or(particle.shade);
+        simulation.set_particle(edit.pos, particle);
+        break;
+    }
+    case EditType::e_clear:
+        simulation.clear_to(simulation.element_of(edit.element_id).name);
+        break;
+    case EditType::e_engine: {
+        std::unique_ptr<Engine> engine = make_engine(edit.engine_name, edit.chunk_size);
+        if (engine == nullptr) {
+            throw std::runtime_error("Unknown engine: " + edit.engine_name);
+        }
+        simulation.set_engine(std::move(engine));
+        break;
+    }
+    case EditType::e_table_driven:
+        for (ElementId id = 1; id <= static_cast<ElementId>(simulation.element_count()); id++) {
+            const RuleTable* table = simulation.rule_table(id);
+            if (table != nullptr && table->can_move()) {
+                simulation.set_table_driven(id, edit.enabled);
+            }
+        }
+        break;
+    case EditType::e_scene:
+        decode_scene(simulation, edit.scene, pool);
+        break;
+    case EditType::e_cells:
+        apply_cell_diff(simulation, edit.cells);
+        break;
+    case EditType::e_stroke:
+        if (spans == nullptr) {
+            const std::vector<BrushSpan> covered = stroke_spans(
+                edit.brush, edit.from, edit.pos, edit.seed, { simulation.width(), simulation.height() });
+            paint_spans(simulation, covered, edit.element_id, edit.shade, edit.seed, pool);
+        }
+        else {
+            paint_spans(simulation, *spans, edit.element_id, edit.shade, edit.seed, pool);
+        }
+        break;
+    }
+}
+
+static void put_string(std::vector<uint8_t>& out, const std::string& value)
+{
+    util::put_u16(out, static_cast<uint16_t>(value.size()));
+    out.insert(out.end(), value.begin(), value.end());
+}
+
+static std::string read_string(util::ByteReader& reader)
+{
+    const std::span<const uint8_t> value = reader.bytes(reader.u16());
+    return { value.begin(), value.end() };
+}
+
+static void put_element(std::vector<uint8_t>& out, const Edit& edit)
+{
+    util::put_varint(out, static_cast<uint32_t>(edit.element_id) << 1 | (edit.shade.has_value() ? 1 : 0));
+    if (edit.shade.has_value()) {
+        util::put_u32(out, std::bit_cast<uint32_t>(edit.shade.value()));
+    }
+}
+
+static ElementId checked_element(uint32_t element, uint32_t element_count)
+{
+    if (element == 0 || element > element_count) {
+        throw std::runtime_error("Replay holds a malformed element");
+    }
+    return static_cast<ElementId>(element);
+}
+
+/**
+ * @brief Read the element and shade put_element() wrote into an edit
+ */
+static void read_element(util::ByteReader& reader, Edit& edit, uint32_t element_count)
+{
+    const uint32_t element = reader.varint();
+    edit.element_id = checked_element(element >> 1, element_count);
+    if ((element & 1) != 0) {
+        edit.shade = std::bit_cast<float>(reader.u32());
+    }
+}
+
+/**
+ * @brief Read a cell stored as the difference to another, throws if it is outside the grid
+ */
+static Vector2i read_pos(util::ByteReader& reader, Vector2i previous, const Replay& replay)
+{
+    const Vector2i pos { previous.x + util::unzigzag(reader.varint()), previous.y + util::unzigzag(reader.varint()) };
+    if (pos.x < 0 || pos.y < 0 || pos.x >= replay.width || pos.y >= replay.height) {
+        throw std::runtime_error("Replay paints outside the grid");
+    }
+    return pos;
+}
+
+std::vector<uint8_t> encode_replay(const Replay& replay)
+{
+    std::vector<uint8_t> data(k_replay_magic.begin(), k_replay_magic.end());
+    util::put_u32(data, k_replay_version);
+    util::put_u32(data, static_cast<uint32_t>(replay.width));
+    util::put_u32(data, static_cast<uint32_t>(replay.height));
+    util::put_u64(data, replay.seed);
+    put_string(data, replay.engine_name);
+    util::put_u32(data, static_cast<uint32_t>(replay.chunk_size));
+    util::put_u32(data, static_cast<uint32_t>(replay.element_names.size()));
+    for (const std::string& name : replay.element_names) {
+        put_string(data, name);
+    }
+    util::put_u32(data, static_cast<uint32_t>(replay.scene.size()));
+    data.insert(data.end(), replay.scene.begin(), replay.scene.end());
+    util::put_u64(data, replay.end_tick);
+    util::put_u64(data, replay.checksum);
+
+    util::put_u32(data, static_cast<uint32_t>(replay.edits.size()));
+    uint64_t tick = 0;
+    Vector2i pos { 0, 0 };
+    for (const auto& [edit_tick, edit] : replay.edits) {
+        if (edit_tick - tick > std::numeric_limits<uint32_t>::max()) {
+            throw std::runtime_error("Replay has edits too far apart");
+        }
+        util::put_varint(data, static_cast<uint32_t>(edit_tick - tick));
+        tick = edit_tick;
+        data.push_back(static_cast<uint8_t>(edit.type));
+        switch (edit.type) {
+        case EditType::e_paint:
+            // Strokes paint neighboring cells one after another
+            util::put_varint(data, util::zigzag(edit.pos.x - pos.x));
+            util::put_varint(data, util::zigzag(edit.pos.y - pos.y));
+            pos = edit.pos;
+            put_element(data, edit);
+            break;
+        case EditType::e_clear:
+            util::put_varint(data, edit.element_id);
+            break;
+        case EditType::e_engine:
+            put_string(data, edit.engine_name);
+            util::put_varint(data, static_cast<uint32_t>(edit.chunk_size));
+            break;
+        case EditType::e_table_driven:
+            data.push_back(edit.enabled ? 1 : 0);
+            break;
+        case EditType::e_scene:
+            util::put_u32(data, static_cast<uint32_t>(edit.scene.size()));
+            data.insert(data.end(), edit.scene.begin(), edit.scene.end());
+            break;
+        case EditType::e_cells:
+            util::put_u32(data, static_cast<uint32_t>(edit.cells.size()));
+            data.insert(data.end(), edit.cells.begin(), edit.cells.end());
+            break;
+        case EditType::e_stroke:
+            // Each stroke starts where the last one ended while the mouse is held
+            util::put_varint(data, util::zigzag(edit.from.x - pos.x));
+            util::put_varint(data, util::zigzag(edit.from.y - pos.y));
+            util::put_varint(data, util::zigzag(edit.pos.x - edit.from.x));
+            util::put_varint(data, util::zigzag(edit.pos.y - edit.from.y));
+            pos = edit.pos;
+            data.push_back(static_cast<uint8_t>(edit.brush.shape));
+            util::put_varint(data, static_cast<uint32_t>(edit.brush.radius));
+            util::put_varint(data, edit.seed);
+            put_element(data, edit);
+            break;
+        }
+    }
+    return data;
+}
+
+Replay decode_replay(std::span<const uint8_t> data)
+{
+    util::ByteReader reader(data, "Replay");
+    const std::span<const uint8_t> magic = reader.bytes(k_replay_magic.size());
+    if (!std::equal(magic.begin(), magic.end(), k_replay_magic.begin())) {
+        throw std::runtime_error("Not a replay");
+    }
+    if (reader.u32() != k_replay_version) {
+        throw std::runtime_error("Replay has an unsupported version");
+    }
+
+    Replay replay;
+    replay.width = static_cast<int>(reader.u32());
+    replay.height = static_cast<int>(reader.u32());
+    if (replay.width <= 0 || replay.height <= 0) {
+        throw std::runtime_error("Replay has a malformed size");
+    }
+    replay.seed = reader.u64();
+    replay.engine_name = read_string(reader);
+    replay.chunk_size = static_cast<int>(reader.u32());
+    if (replay.chunk_size <= 0) {
+        throw std::runtime_error("Replay has a malformed chunk size");
+    }
+    const uint32_t element_count = reader.u32();
+    for (uint32_t i = 0; i < element_count; i++) {
+        replay.element_names.push_back(read_string(reader));
+    }
+    const std::span<const uint8_t> scene = reader.bytes(reader.u32());
+    replay.scene.assign(scene.begin(), scene.end());
+    replay.end_tick = reader.u64();
+    replay.checksum = reader.u64();
+
+    const uint32_t edit_count = reader.u32();
+    uint64_t tick = 0;
+    Vector2i pos { 0, 0 };
+    for (uint32_t i = 0; i < edit_count; i++) {
+        tick += reader.varint();
+        if (tick > replay.end_tick) {
+            throw std::runtime_error("Replay has an edit past its end");
+        }
+        Edit edit;
+        edit.type = static_cast<EditType>(reader.u8());
+        switch (edit.type) {
+        case EditType::e_paint:
+            pos = read_pos(reader, pos, replay);
+            edit.pos = pos;
+            read_element(reader, edit, element_count);
+            break;
+        case EditType::e_clear:
+            edit.element_id = checked_element(reader.varint(), element_count);
+            break;
+        case EditType::e_engine:
+            edit.engine_name = read_string(reader);
+            edit.chunk_size = static_cast<int>(reader.varint());
+            break;
+        case EditType::e_table_driven:
+            edit.enabled = reader.u8() != 0;
+            break;
+        case EditType::e_scene: {
+            const std::span<const uint8_t> edit_scene = reader.bytes(reader.u32());
+            edit.scene.assign(edit_scene.begin(), edit_scene.end());
+            break;
+        }
+        case EditType::e_cells: {
+            const std::span<const uint8_t> cells = reader.bytes(reader.u32());
+            edit.cells.assign(cells.begin(), cells.end());
+            break;
+        }
+        case EditType::e_stroke:
+            edit.from = read_pos(reader, pos, replay);
+            edit.pos = read_pos(reader, edit.from, replay);
+            pos = edit.pos;
+            edit.brush.shape = static_cast<BrushShape>(reader.u8());
+            edit.brush.radius = static_cast<int>(reader.varint());
+            if (edit.brush.shape > BrushShape::e_spray || edit.brush.radius > k_max_brush_radius) {
+                throw std::runtime_error("Replay holds a malformed brush");
+            }
+            edit.seed = reader.varint();
+            read_element(reader, edit, element_count);
+            break;
+        default:
+            throw std::runtime_error("Replay holds an unknown edit");
+        }
+        replay.edits.emplace_back(tick, std::move(edit));
+    }
+    if (!reader.at_end()) {
+        throw std::runtime_error("Replay has trailing data");
+    }
+    return replay;
+}
+
+ReplayRecorder::ReplayRecorder(const Simulation& simulation, int chunk_size, util::WorkerPool* pool)
+    : m_replay {
+        .width = simulation.width(),
+        .height = simulation.height(),
+        .seed = simulation.seed(),
+        .engine_name = std::string(simulation.engine().name()),
+        .chunk_size = chunk_size,
+        .element_names = element_names(simulation),
+        .scene = encode_scene(simulation, pool),
+    }
+{
+    if (simulation.tick() != 0) {
+        throw std::runtime_error("Replays are recorded from tick 0");
+    }
+}
+
+void ReplayRecorder::apply(
+    Simulation& simulation, Edit edit, util::WorkerPool* pool, const std::vector<BrushSpan>* spans)
+{
+    // Edits that fail aren't recorded, so playback doesn't fail on them
+    apply_edit(simulation, edit, pool, spans);
+    m_replay.edits.emplace_back(simulation.tick(), std::move(edit));
+}
+
+std::size_t ReplayRecorder::save(const Simulation& simulation, const std::filesystem::path& path)
+{
+    m_replay.end_tick = simulation.tick();
+    m_replay.checksum = simulation.checksum();
+    const std::vector<uint8_t> data = encode_replay(m_replay);
+    util::replace_file(path, [&](std::FILE* file) { util::write_bytes(file, data); });
+    return data.size();
+}
+
+std::size_t ReplayRecorder::edit_count() const
+{
+    return m_replay.edits.size();
+}
+
+bool run_replay(const std::filesystem::path& path)
+{
+    Replay replay = decode_replay(util::read_file(path));
+
+    Simulation simulation(replay.width, replay.height);
+    init_elements(simulation);
+    simulation.clear_to("air");
+    simulation.set_bitsliced_powders(true);
+
+    // Id 0 is the null element in every build
+    std::vector<ElementId> ids { 0 };
+    for (const std::string& name : replay.element_names) {
+        if (!simulation.has_element(name)) {
+            throw std::runtime_error("Replay holds an element this build doesn't have: " + name);
+        }
+        ids.push_back(simulation.id_of(name));
+    }
+    for (auto& [tick, edit] : replay.edits) {
+        edit.element_id = ids[edit.element_id];
+        if (edit.type == EditType::e_cells) {
+            edit.cells = map_cell_diff(edit.cells, ids);
+        }
+    }
+
+    std::unique_ptr<Engine> engine = make_engine(replay.engine_name, replay.chunk_size);
+    if (engine == nullptr) {
+        throw std::runtime_error("Unknown engine: " + replay.engine_name);
+    }
+    simulation.set_engine(std::move(engine));
+    simulation.set_seed(replay.seed);
+    simulation.set_deterministic(true);
+    simulation.set_checksums(true);
+    util::WorkerPool pool;
+    simulation.set_worker_pool(&pool);
+    {
+        // The same tables as the playground compiles, in case the replay switches to them
+        BS::thread_pool thread_pool;
+        simulation.compile_rule_tables(thread_pool);
+    }
+    decode_scene(simulation, replay.scene, &pool);
+
+    POP_LOG_INFO("Playing {} ticks and {} edits of {} on {} workers", replay.end_tick, replay.edits.size(),
+        path.string(), pool.worker_count());
+    const auto start = std::chrono::steady_clock::now();
+    auto edit = replay.edits.begin();
+    const Engine* checked_engine = nullptr;
+    for (uint64_t tick = 0; tick < replay.end_tick; tick++) {
+        PROFILE_ZONE("replay_tick");
+        for (; edit != replay.edits.end() && edit->first == tick; edit++) {
+            apply_edit(simulation, edit->second, &pool);
+        }
+        if (&simulation.engine() != checked_engine) {
+            checked_engine = &simulation.engine();
+            if (!checked_engine->deterministic()) {
+                POP_LOG_WARN("Playing from tick {} with the {} engine, which depends on scheduling", tick,
+                    checked_engine->name());
+            }
+        }
+        simulation.update();
+    }
+    const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+    const double seconds = duration.count();
+    const double ticks_per_second = seconds > 0.0 ? static_cast<double>(replay.end_tick) / seconds : 0.0;
+    POP_LOG_INFO("Played {} ticks in {:.2f} s, {:.0f} ticks/s", replay.end_tick, seconds, ticks_per_second);
+
+    if (simulation.checksum() != replay.checksum) {
+        POP_LOG_ERROR("Replay ended on checksum {:016x} instead of {:016x}", simulation.checksum(), replay.checksum);
+        return false;
+    }
+    POP_LOG_INFO("Replay ended on the recorded checksum {:016x}", replay.checksum);
+    return true;
+}
+
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "brush.hpp"
+#include "simulation.hpp"
+#include "util/worker_pool.hpp"
+
+namespace pop {
+
+inline constexpr uint32_t k_replay_version = 1;
+
+enum class EditType : uint8_t { e_paint, e_clear, e_engine, e_table_driven, e_scene, e_cells, e_stroke };
+
+/**
+ * @brief Change made to a simulation between updates by the player. Live play and replays both go through
+ * apply_edit(), so the same edits at the same ticks step to the same grids.
+ */
+struct Edit {
+    EditType type = EditType::e_paint;
+    // Cell painted, or where a stroke ends
+    Vector2i pos {};
+    // Where a stroke starts and the brush it paints with
+    Vector2i from {};
+    Brush brush {};
+    // Picks the cells a spray paints and the shades of a stroke
+    uint32_t seed = 0;
+    // Element painted or cleared to
+    ElementId element_id = 0;
+    // Shade painted, none to keep the shade of the cell. Strokes paint shades between it and 1, none paints shade 1.
+    std::optional<float> shade {};
+    // Engine switched to and the chunk size it runs with
+    std::string engine_name {};
+    int chunk_size = k_chunk_size;
+    // Whether moving elements with rule tables were switched to them
+    bool enabled = false;
+    // Scene loaded, as encode_scene() writes it
+    std::vector<uint8_t> scene {};
+    // Cells written, as a cell diff
+    std::vector<uint8_t> cells {};
+};
+
+/**
+ * @brief Apply an edit to a simulation, which must be between updates. Throws if a scene or cell edit doesn't decode.
+ * @param pool - Pool to decode scenes on, or nullptr to decode them on the calling thread
+ * @param spans - Cells a stroke covers as stroke_spans() gives them if the caller already has them, or nullptr to get
+ * them here
+ */
+void apply_edit(
+    Simulation& simulation, const Edit& edit, util::WorkerPool* pool, const std::vector<BrushSpan>* spans = nullptr);
+
+/**
+ * @brief Everything needed to step a session again: how the simulation was set up, the grid it started from and the
+ * edits made to it, each stamped with the tick it was made before. The checksum of the grid after the last tick tells
+ * whether a playback ended up in the same place.
+ */
+struct Replay {
+    int width = 0;
+    int height = 0;
+    uint64_t seed = 0;
+    std::string engine_name {};
+    int chunk_size = k_chunk_size;
+    // Names of the elements by id, starting at id 1, so edits are matched up by name when played back
+    std::vector<std::string> element_names {};
+    // Grid at tick 0, as encode_scene() writes it
+    std::vector<uint8_t> scene {};
+    // In tick order
+    std::vector<std::pair<uint64_t, Edit>> edits {};
+    uint64_t end_tick = 0;
+    uint64_t checksum = 0;
+};
+
+/**
+ * @brief Encode a replay into the binary replay format. Edits are stored as the difference to the previous one: the
+ * tick and the painted cell as small variable length numbers and the shade only if one was painted, so a stroke costs
+ * a few bytes per cell.
+ */
+[[nodiscard]] std::vector<uint8_t> encode_replay(const Replay& replay);
+
+/**
+ * @brief Decode a replay written by encode_replay(), throws if the data isn't a replay or is corrupt
+ */
+[[nodiscard]] Replay decode_replay(std::span<const uint8_t> data);
+
+/**
+ * @brief Records the edits made to a simulation as they are applied, from the grid it has when recording starts
+ */
+class ReplayRecorder {
+public:
+    /**
+     * @brief Start recording from the current grid. The simulation must be between updates at tick 0 and should step
+     * deterministically with checksums on, or the replay won't play back to the same grid.
+     * @param chunk_size - Chunk size the engine of the simulation runs with
+     * @param pool - Pool to encode the grid on, or nullptr to encode it on the calling thread
+     */
+    ReplayRecorder(const Simulation& simulation, int chunk_size, util::WorkerPool* pool);
+
+    /**
+     * @brief Apply an edit to the simulation and record it at the current tick
+     * @param spans - Cells a stroke covers if the caller already has them, as for apply_edit()
+     */
+    void apply(
+        Simulation& simulation, Edit edit, util::WorkerPool* pool, const std::vector<BrushSpan>* spans = nullptr);
+
+    /**
+     * @brief Write the replay so far to a file, ending at the current tick. The file is replaced atomically.
+     * @return - Size of the file in bytes
+     */
+    std::size_t save(const Simulation& simulation, const std::filesystem::path& path);
+
+    [[nodiscard]] std::size_t edit_count() const;
+
+private:
+    Replay m_replay;
+};
+
+/**
+ * @brief Play a replay file back without opening a window, as fast as the simulation steps, and log how fast it ran
+ * and whether it ended on the recorded checksum
+ * @return - True if the checksums match
+ */
+bool run_replay(const std::filesystem::path& path);
+
+}
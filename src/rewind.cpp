@@ -0,0 +1,383 @@
+#include "rewind.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+
+#include "util/bytes.hpp"
+#include "util/profiler.hpp"
+
+namespace pop {
+
+inline constexpr int k_chunk_cells = k_chunk_size * k_chunk_size;
+
+// Grids kept while restoring per keyframe interval, so moving back applies at most an eighth of the interval
+inline constexpr int k_checkpoints = 8;
+
+// A changed cell is either the neighbor it moved from, one of these, or a literal past them
+inline constexpr uint32_t k_literal = static_cast<uint32_t>(neighbor::offsets.size());
+
+static bool same_particle(const Particle& a, const Particle& b)
+{
+    return a.element_id == b.element_id && std::bit_cast<uint32_t>(a.shade) == std::bit_cast<uint32_t>(b.shade);
+}
+
+static int chunks_across(int width)
+{
+    return (width + k_chunk_size - 1) / k_chunk_size;
+}
+
+static int chunk_count(int width, int height)
+{
+    return chunks_across(width) * chunks_across(height);
+}
+
+static Vector2i chunk_pos(int chunk, int width)
+{
+    return { chunk % chunks_across(width), chunk / chunks_across(width) };
+}
+
+/**
+ * @brief Get the index of a cell in a frame, where the cells of each chunk follow one another
+ */
+static std::size_t frame_index(Vector2i pos, int width)
+{
+    const int chunk = pos.y / k_chunk_size * chunks_across(width) + pos.x / k_chunk_size;
+    return static_cast<std::size_t>(chunk) * k_chunk_cells + pos.y % k_chunk_size * k_chunk_size + pos.x % k_chunk_size;
+}
+
+/**
+ * @brief Get a neighbor of a cell in the previous grid, looked up in the cells of its chunk if it is in the same one
+ * @param before - Cells of the chunk of the cell
+ * @param local - Position of the cell in its chunk
+ * @return - The neighbor, or nullptr if it is out of bounds
+ */
+static const Particle* neighbor_before(
+    const GridSnapshot& previous, std::span<const Particle> before, Vector2i pos, Vector2i local, Vector2i offset)
+{
+    if (!previous.in_bounds({ pos.x + offset.x, pos.y + offset.y })) {
+        return nullptr;
+    }
+    const Vector2i from { local.x + offset.x, local.y + offset.y };
+    if (from.x >= 0 && from.x < k_chunk_size && from.y >= 0 && from.y < k_chunk_size) {
+        return &before[from.y * k_chunk_size + from.x];
+    }
+    return &previous.particle_at({ pos.x + offset.x, pos.y + offset.y });
+}
+
+Rewind::Rewind(uint64_t ticks, std::size_t budget, int keyframe_interval)
+    : m_ticks(ticks)
+    , m_budget(budget)
+    , m_keyframe_interval(keyframe_interval)
+{
+}
+
+void Rewind::record(Simulation& simulation, util::WorkerPool* pool)
+{
+    PROFILE_ZONE("rewind_record");
+    GridSnapshot snapshot = simulation.snapshot();
+    const bool follows = m_previous.has_value() && !m_segments.empty() && m_previous->tick() + 1 == snapshot.tick()
+        && m_previous->width() == snapshot.width() && m_previous->height() == snapshot.height();
+    if (!follows) {
+        m_segments.clear();
+        m_bytes = 0;
+        m_frame_tick.reset();
+        m_checkpoints.clear();
+    }
+    else {
+        truncate(m_previous->tick());
+    }
+
+    if (m_segments.empty() || snapshot.tick() - m_segments.back().tick >= static_cast<uint64_t>(m_keyframe_interval)) {
+        add_keyframe(snapshot, pool);
+    }
+    else {
+        add_changes(m_previous.value(), snapshot, pool);
+    }
+    m_previous = std::move(snapshot);
+
+    while (m_segments.size() > 1 && (m_bytes > m_budget || newest_tick() - m_segments[1].tick >= m_ticks)) {
+        drop_oldest();
+    }
+}
+
+void Rewind::restore(Simulation& simulation, uint64_t tick, util::WorkerPool* pool)
+{
+    PROFILE_ZONE("rewind_restore");
+    if (empty() || tick < oldest_tick() || tick > newest_tick()) {
+        throw std::runtime_error("Tick isn't kept to rewind to");
+    }
+    if (simulation.width() != m_previous->width() || simulation.height() != m_previous->height()) {
+        throw std::runtime_error("Rewinding a grid of another size");
+    }
+    const auto segment = std::prev(std::upper_bound(m_segments.begin(), m_segments.end(), tick,
+        [](uint64_t t, const Segment& s) { return t < s.tick; }));
+
+    const int width = simulation.width();
+    const int height = simulation.height();
+    const int chunks = chunk_count(width, height);
+    if (m_checkpoint_segment != segment->tick) {
+        m_checkpoints.clear();
+        m_checkpoint_segment = segment->tick;
+    }
+
+    // Start from the latest of the frame and the checkpoints that isn't past the tick, or else the keyframe
+    const auto checkpoint = std::upper_bound(m_checkpoints.begin(), m_checkpoints.end(), tick,
+        [](uint64_t t, const auto& c) { return t < c.first; });
+    const bool frame_usable = m_frame_tick.has_value() && m_frame_tick.value() >= segment->tick
+        && m_frame_tick.value() <= tick;
+    if (checkpoint != m_checkpoints.begin()
+        && (!frame_usable || std::prev(checkpoint)->first > m_frame_tick.value())) {
+        m_frame = std::prev(checkpoint)->second;
+        m_frame_tick = std::prev(checkpoint)->first;
+    }
+    else if (!frame_usable) {
+        m_frame.resize(static_cast<std::size_t>(chunks) * k_chunk_cells);
+        m_scratch.resize(pool == nullptr ? 1 : pool->worker_count());
+        util::parallel_for(pool, 0, chunks, [&](int start, int end, int worker) {
+            for (int c = start; c < end; c++) {
+                decode_chunk(segment->keyframe[c], true,
+                    std::span(m_frame).subspan(static_cast<std::size_t>(c) * k_chunk_cells, k_chunk_cells),
+                    m_scratch[worker]);
+            }
+        });
+        m_frame_tick = segment->tick;
+        add_checkpoint(segment->tick);
+    }
+
+    const uint64_t checkpoint_interval = std::max(1, m_keyframe_interval / k_checkpoints);
+    for (uint64_t t = m_frame_tick.value() + 1; t <= tick; t++) {
+        const std::size_t index = t - segment->tick - 1;
+        const std::size_t begin = index == 0 ? 0 : segment->change_ends[index - 1];
+        apply_changes(std::span(segment->changes).subspan(begin, segment->change_ends[index] - begin));
+        if ((t - segment->tick) % checkpoint_interval == 0) {
+            add_checkpoint(t);
+        }
+    }
+    m_frame_tick = tick;
+
+    util::parallel_for(pool, 0, chunks, [&](int start, int end, int) {
+        for (int c = start; c < end; c++) {
+            const Vector2i chunk = chunk_pos(c, width);
+            const Vector2i origin { chunk.x * k_chunk_size, chunk.y * k_chunk_size };
+            const int row_width = std::min(k_chunk_size, width - origin.x);
+            for (int y = 0; y < std::min(k_chunk_size, height - origin.y); y++) {
+                std::copy_n(m_frame.begin() + static_cast<std::ptrdiff_t>(c) * k_chunk_cells + y * k_chunk_size,
+                    row_width, &simulation.particle_at({ origin.x, origin.y + y }));
+            }
+        }
+    });
+    simulation.rebuild_occupancy();
+    simulation.mark_all_changed();
+    simulation.set_tick(tick);
+    m_previous = simulation.snapshot();
+}
+
+bool Rewind::empty() const
+{
+    return m_segments.empty();
+}
+
+uint64_t Rewind::oldest_tick() const
+{
+    return m_segments.front().tick;
+}
+
+uint64_t Rewind::newest_tick() const
+{
+    return m_segments.back().tick + m_segments.back().change_ends.size();
+}
+
+std::size_t Rewind::memory_bytes() const
+{
+    return m_bytes;
+}
+
+void Rewind::add_keyframe(const GridSnapshot& snapshot, util::WorkerPool* pool)
+{
+    PROFILE_ZONE("rewind_keyframe");
+    const int chunks = chunk_count(snapshot.width(), snapshot.height());
+    Segment segment { .tick = snapshot.tick(), .keyframe = std::vector<std::vector<uint8_t>>(chunks) };
+    m_scratch.resize(pool == nullptr ? 1 : pool->worker_count());
+    util::parallel_for(pool, 0, chunks, [&](int start, int end, int worker) {
+        for (int c = start; c < end; c++) {
+            encode_chunk(snapshot.chunk(chunk_pos(c, snapshot.width())), true, segment.keyframe[c], m_scratch[worker]);
+            segment.keyframe[c].shrink_to_fit();
+        }
+    });
+    m_bytes += segment_bytes(segment);
+    m_segments.push_back(std::move(segment));
+}
+
+void Rewind::add_changes(const GridSnapshot& previous, const GridSnapshot& snapshot, util::WorkerPool* pool)
+{
+    PROFILE_ZONE("rewind_changes");
+    const int chunks = chunk_count(snapshot.width(), snapshot.height());
+    m_chunk_changes.resize(chunks);
+    util::parallel_for(pool, 0, chunks, [&](int start, int end, int) {
+        for (int c = start; c < end; c++) {
+            std::vector<uint8_t>& out = m_chunk_changes[c];
+            out.clear();
+            const Vector2i chunk = chunk_pos(c, snapshot.width());
+            const std::span<const Particle> before = previous.chunk(chunk);
+            const std::span<const Particle> after = snapshot.chunk(chunk);
+            // Chunks the tick didn't write are still shared
+            if (before.data() == after.data()) {
+                continue;
+            }
+            // Runs of changed cells, each the cells skipped since the last run, its length and its cells
+            int run_end = 0;
+            for (int i = 0; i < k_chunk_cells;) {
+                if (same_particle(before[i], after[i])) {
+                    i++;
+                    continue;
+                }
+                int length = 1;
+                while (i + length < k_chunk_cells && !same_particle(before[i + length], after[i + length])) {
+                    length++;
+                }
+                util::put_varint(out, static_cast<uint32_t>(i - run_end));
+                util::put_varint(out, static_cast<uint32_t>(length));
+                for (int j = i; j < i + length; j++) {
+                    const Vector2i local { j % k_chunk_size, j / k_chunk_size };
+                    const Vector2i pos { chunk.x * k_chunk_size + local.x, chunk.y * k_chunk_size + local.y };
+                    uint32_t symbol = k_literal;
+                    for (uint32_t n = 0; n < k_literal; n++) {
+                        const Particle* moved = neighbor_before(previous, before, pos, local, neighbor::offsets[n]);
+                        if (moved != nullptr && same_particle(*moved, after[j])) {
+                            symbol = n;
+                            break;
+                        }
+                    }
+                    if (symbol != k_literal) {
+                        util::put_varint(out, symbol);
+                        continue;
+                    }
+                    // The element, with the low bit set if the shade changed too
+                    const bool shaded
+                        = std::bit_cast<uint32_t>(before[j].shade) != std::bit_cast<uint32_t>(after[j].shade);
+                    util::put_varint(out, k_literal + (static_cast<uint32_t>(after[j].element_id) << 1 | shaded));
+                    if (shaded) {
+                        util::put_u32(out, std::bit_cast<uint32_t>(after[j].shade));
+                    }
+                }
+                i += length;
+                run_end = i;
+            }
+        }
+    });
+
+    // Chunks that changed, each the chunks skipped since the last one and its runs, ended by a run of length 0
+    Segment& segment = m_segments.back();
+    const std::size_t size = segment.changes.size();
+    int chunk_end = 0;
+    for (int c = 0; c < chunks; c++) {
+        if (m_chunk_changes[c].empty()) {
+            continue;
+        }
+        util::put_varint(segment.changes, static_cast<uint32_t>(c - chunk_end));
+        segment.changes.insert(segment.changes.end(), m_chunk_changes[c].begin(), m_chunk_changes[c].end());
+        util::put_varint(segment.changes, 0);
+        util::put_varint(segment.changes, 0);
+        chunk_end = c + 1;
+    }
+    segment.change_ends.push_back(segment.changes.size());
+    m_bytes += segment.changes.size() - size + sizeof(std::size_t);
+}
+
+void Rewind::truncate(uint64_t tick)
+{
+    if (tick >= newest_tick()) {
+        return;
+    }
+    while (m_segments.back().tick > tick) {
+        m_bytes -= segment_bytes(m_segments.back());
+        m_segments.pop_back();
+    }
+    Segment& segment = m_segments.back();
+    m_bytes -= segment_bytes(segment);
+    segment.change_ends.resize(tick - segment.tick);
+    segment.changes.resize(segment.change_ends.empty() ? 0 : segment.change_ends.back());
+    m_bytes += segment_bytes(segment);
+    if (m_frame_tick.has_value() && m_frame_tick.value() > tick) {
+        m_frame_tick.reset();
+    }
+    if (m_checkpoint_segment > tick) {
+        m_checkpoints.clear();
+    }
+    std::erase_if(m_checkpoints, [&](const auto& c) { return c.first > tick; });
+}
+
+void Rewind::drop_oldest()
+{
+    if (m_frame_tick.has_value() && m_frame_tick.value() < m_segments[1].tick) {
+        m_frame_tick.reset();
+    }
+    if (m_checkpoint_segment == m_segments.front().tick) {
+        m_checkpoints.clear();
+    }
+    m_bytes -= segment_bytes(m_segments.front());
+    m_segments.pop_front();
+}
+
+void Rewind::apply_changes(std::span<const uint8_t> changes)
+{
+    const int width = m_previous->width();
+    util::ByteReader reader(changes, "Rewind history");
+    m_pending.clear();
+    int chunk = 0;
+    while (!reader.at_end()) {
+        chunk += static_cast<int>(reader.varint());
+        const Vector2i origin { chunk_pos(chunk, width).x * k_chunk_size, chunk_pos(chunk, width).y * k_chunk_size };
+        const std::size_t chunk_start = static_cast<std::size_t>(chunk) * k_chunk_cells;
+        int i = 0;
+        while (true) {
+            i += static_cast<int>(reader.varint());
+            const int length = static_cast<int>(reader.varint());
+            if (length == 0) {
+                break;
+            }
+            for (const int end = i + length; i < end; i++) {
+                const uint32_t symbol = reader.varint();
+                Particle particle = m_frame[chunk_start + i];
+                if (symbol < k_literal) {
+                    const Vector2i from { origin.x + i % k_chunk_size + neighbor::offsets[symbol].x,
+                        origin.y + i / k_chunk_size + neighbor::offsets[symbol].y };
+                    particle = m_frame[frame_index(from, width)];
+                }
+                else {
+                    particle.element_id = static_cast<ElementId>((symbol - k_literal) >> 1);
+                    if (((symbol - k_literal) & 1) != 0) {
+                        particle.shade = std::bit_cast<float>(reader.u32());
+                    }
+                }
+                m_pending.emplace_back(chunk_start + i, particle);
+            }
+        }
+        chunk++;
+    }
+    // Cells are only written once every cell was read, so a particle moving on reads where it came from
+    for (const auto& [index, particle] : m_pending) {
+        m_frame[index] = particle;
+    }
+}
+
+void Rewind::add_checkpoint(uint64_t tick)
+{
+    const auto position = std::lower_bound(
+        m_checkpoints.begin(), m_checkpoints.end(), tick, [](const auto& c, uint64_t t) { return c.first < t; });
+    if (position == m_checkpoints.end() || position->first != tick) {
+        m_checkpoints.emplace(position, tick, m_frame);
+    }
+}
+
+std::size_t Rewind::segment_bytes(const Segment& segment)
+{
+    std::size_t bytes = segment.changes.size() + segment.change_ends.size() * sizeof(std::size_t);
+    for (const std::vector<uint8_t>& chunk : segment.keyframe) {
+        bytes += chunk.size();
+    }
+    return bytes;
+}
+
+}
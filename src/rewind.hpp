@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "scene.hpp"
+#include "simulation.hpp"
+#include "util/worker_pool.hpp"
+
+namespace pop {
+
+/**
+ * @brief Keeps the recent history of a grid so it can be put back to how it was at any tick still kept. Every
+ * keyframe_interval ticks the whole grid is compressed chunk by chunk into a keyframe, and every tick in between keeps
+ * only the cells that changed. Most cells change by a particle moving in from a neighbor, which is kept as a byte
+ * naming the neighbor. A tick is rebuilt by decoding the keyframe before it and applying the changes of the ticks after
+ * the keyframe. Changes are found by comparing snapshots of consecutive ticks, which share the chunks the tick didn't
+ * write, so only written chunks are compared. The oldest keyframe and its ticks are dropped once the history is longer
+ * than it needs to be or takes more than its budget.
+ */
+class Rewind {
+public:
+    /**
+     * @param ticks - Ticks to keep at least, if they fit in the budget
+     * @param budget - Bytes of keyframes and changes to keep at most, though the newest keyframe is always kept
+     * @param keyframe_interval - Ticks from one keyframe to the next
+     */
+    Rewind(uint64_t ticks, std::size_t budget, int keyframe_interval = 240);
+
+    /**
+     * @brief Keep the grid of the tick the simulation just stepped to. Must be called between updates, after every
+     * one. If the simulation was put back to an earlier tick, the ticks after it are dropped first.
+     * @param pool - Pool to compress chunks on, or nullptr to compress them on the calling thread
+     */
+    void record(Simulation& simulation, util::WorkerPool* pool);
+
+    /**
+     * @brief Put the grid of the simulation back to how it was at a kept tick and set its tick, which must be between
+     * oldest_tick() and newest_tick(). Ticks after it stay kept until the next record(), so the grid can be moved back
+     * and forth. Moving forward from the last tick restored only applies the changes in between, and moving back starts
+     * from one of a few grids of the same keyframe interval kept while restoring. Must be called between updates.
+     * @param pool - Pool to decompress chunks on, or nullptr to decompress them on the calling thread
+     */
+    void restore(Simulation& simulation, uint64_t tick, util::WorkerPool* pool);
+
+    [[nodiscard]] bool empty() const;
+
+    [[nodiscard]] uint64_t oldest_tick() const;
+
+    [[nodiscard]] uint64_t newest_tick() const;
+
+    /**
+     * @brief Get the bytes of keyframes and changes kept, not counting the grids kept while restoring
+     */
+    [[nodiscard]] std::size_t memory_bytes() const;
+
+private:
+    /**
+     * @brief A keyframe and the changes of the ticks after it, up to the next keyframe
+     */
+    struct Segment {
+        uint64_t tick;
+        // Compressed cells of each chunk
+        std::vector<std::vector<uint8_t>> keyframe {};
+        // Changes of every tick after the keyframe, one after another
+        std::vector<uint8_t> changes {};
+        // End of the changes of tick + 1 + i in changes
+        std::vector<std::size_t> change_ends {};
+    };
+
+    const uint64_t m_ticks;
+    const std::size_t m_budget;
+    const int m_keyframe_interval;
+    std::deque<Segment> m_segments {};
+    std::size_t m_bytes = 0;
+    // Grid of the last tick recorded or restored, which the changes of the next tick are found against
+    std::optional<GridSnapshot> m_previous {};
+    // Changes of each chunk during a tick, kept between ticks so they aren't allocated for each
+    std::vector<std::vector<uint8_t>> m_chunk_changes {};
+    // Cells of every chunk at m_frame_tick, one chunk after another, kept so moving forward continues from it
+    std::vector<Particle> m_frame {};
+    std::optional<uint64_t> m_frame_tick {};
+    // Copies of the frame at every checkpoint interval of the segment starting at m_checkpoint_segment, by tick
+    std::vector<std::pair<uint64_t, std::vector<Particle>>> m_checkpoints {};
+    uint64_t m_checkpoint_segment = 0;
+    // Cells a change writes, held until it has read every cell it moves from
+    std::vector<std::pair<std::size_t, Particle>> m_pending {};
+    std::vector<ChunkCodecScratch> m_scratch {};
+
+    void add_keyframe(const GridSnapshot& snapshot, util::WorkerPool* pool);
+
+    void add_changes(const GridSnapshot& previous, const GridSnapshot& snapshot, util::WorkerPool* pool);
+
+    /**
+     * @brief Drop the ticks after a tick
+     */
+    void truncate(uint64_t tick);
+
+    void drop_oldest();
+
+    /**
+     * @brief Apply the changes of a tick to the frame
+     */
+    void apply_changes(std::span<const uint8_t> changes);
+
+    void add_checkpoint(uint64_t tick);
+
+    [[nodiscard]] static std::size_t segment_bytes(const Segment& segment);
+};
+
+}
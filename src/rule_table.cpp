@@ -0,0 +1,405 @@
+#include "rule_table.hpp"
+
+#include <atomic>
+#include <cmath>
+#include <map>
+
+#include "simulation.hpp"
+
+namespace pop {
+
+// Neighbor classes as encoded in the 2 bits of a key
+static constexpr int k_class_blocked = 0;
+static constexpr int k_class_empty = 1;
+static constexpr int k_class_liquid = 2;
+static constexpr int k_class_gas = 3;
+static constexpr int k_class_count = 4;
+
+// Every element of a class is checked to act the same as the first one on every this many keys. Kernels that look at
+// specific elements tend to do so on most keys, and checking all of them would make compiling several times slower.
+static constexpr int k_variant_key_stride = 7;
+
+static uint16_t spread_bits(uint8_t bits)
+{
+    uint32_t spread = bits;
+    spread = (spread | (spread << 4)) & 0x0f0f;
+    spread = (spread | (spread << 2)) & 0x3333;
+    spread = (spread | (spread << 1)) & 0x5555;
+    return static_cast<uint16_t>(spread);
+}
+
+static int class_of(ElementType type)
+{
+    switch (type) {
+    case ElementType::e_null:
+        return k_class_empty;
+    case ElementType::e_liquid:
+        return k_class_liquid;
+    case ElementType::e_gas:
+        return k_class_gas;
+    default:
+        return k_class_blocked;
+    }
+}
+
+/**
+ * @brief Random source that walks every sequence of values a kernel can draw, depth first
+ */
+class ScriptedRandom : public RandomSource {
+public:
+    int next(int min, int max) override
+    {
+        if (min > max) {
+            std::swap(min, max);
+        }
+        if (m_depth == m_choices.size()) {
+            m_choices.push_back({ 0, max - min + 1 });
+        }
+        return min + m_choices.at(m_depth++).value;
+    }
+
+    void begin_path()
+    {
+        m_depth = 0;
+    }
+
+    /**
+     * @brief Finish running a path
+     * @return - Probability of the values drawn on the path
+     */
+    double end_path()
+    {
+        m_choices.resize(m_depth);
+        double probability = 1.0;
+        for (const Choice& choice : m_choices) {
+            probability /= choice.span;
+        }
+        return probability;
+    }
+
+    /**
+     * @brief Move on to the next path
+     * @return - False if every path was walked
+     */
+    bool next_path()
+    {
+        while (!m_choices.empty()) {
+            Choice& choice = m_choices.back();
+            choice.value++;
+            if (choice.value < choice.span) {
+                return true;
+            }
+            m_choices.pop_back();
+        }
+        return false;
+    }
+
+private:
+    struct Choice {
+        int value;
+        int span;
+    };
+
+    std::vector<Choice> m_choices {};
+    size_t m_depth = 0;
+};
+
+using Distribution = std::array<double, 9>;
+
+/**
+ * @brief 3x3 simulation to run a kernel on a single neighborhood. Shades are used to tag particles so that where the
+ * center particle went can be told even when it swaps with the same element.
+ */
+class Probe {
+public:
+    Probe(const Simulation& simulation, ElementId element_id)
+        : m_simulation(3, 3)
+    {
+        for (ElementId id = 1; id <= static_cast<ElementId>(simulation.element_count()); id++) {
+            m_simulation.push_element(simulation.element_of(id));
+        }
+        m_update_func = simulation.element_of(element_id).update_func;
+        m_simulation.set_random_source(&m_random);
+        m_cells.fill(element_id);
+        reset();
+    }
+
+    Probe(const Probe&) = delete;
+    Probe& operator=(const Probe&) = delete;
+
+    void set_neighbor(int bit, ElementId element_id)
+    {
+        Vector2i offset = neighbor::offsets.at(bit);
+        int i = (offset.y + 1) * 3 + offset.x + 1;
+        if (m_cells.at(i) != element_id) {
+            m_cells.at(i) = element_id;
+            m_simulation.change_element(m_simulation.pos_at(i), element_id);
+        }
+    }
+
+    /**
+     * @brief Run the kernel on the center for every random path
+     * @return - Probability of each outcome, or nothing if the kernel did more than swap with a neighbor
+     */
+    std::optional<Distribution> run()
+    {
+        Distribution distribution {};
+        do {
+            m_random.begin_path();
+            std::invoke(m_update_func, m_simulation, Vector2i { 1, 1 });
+            double probability = m_random.end_path();
+            std::optional<int> outcome = find_outcome();
+            if (!outcome.has_value()) {
+                reset();
+                return std::nullopt;
+            }
+            distribution.at(outcome.value()) += probability;
+            if (outcome.value() != RuleTable::outcome_stay) {
+                // Undo the swap, cheaper than resetting the whole probe
+                Vector2i offset = neighbor::offsets.at(outcome.value());
+                m_simulation.swap({ 1, 1 }, { 1 + offset.x, 1 + offset.y });
+            }
+        } while (m_random.next_path());
+        return distribution;
+    }
+
+private:
+    Simulation m_simulation;
+    ScriptedRandom m_random {};
+    std::function<void(Simulation&, Vector2i)> m_update_func {};
+    std::array<ElementId, 9> m_cells {};
+
+    void reset()
+    {
+        for (int i = 0; i < 9; i++) {
+            Vector2i pos = m_simulation.pos_at(i);
+            m_simulation.change_element(pos, m_cells[i]);
+            m_simulation.particle_at(pos).shade = static_cast<float>(i);
+        }
+    }
+
+    [[nodiscard]] int tag_at(int i) const
+    {
+        return static_cast<int>(m_simulation.particle_at(m_simulation.pos_at(i)).shade);
+    }
+
+    std::optional<int> find_outcome() const
+    {
+        int swapped = -1;
+        for (int i = 0; i < 9; i++) {
+            int tag = tag_at(i);
+            if (m_simulation.id_at(m_simulation.pos_at(i)) != m_cells[tag]) {
+                return std::nullopt;
+            }
+            if (tag == i) {
+                continue;
+            }
+            if (i == 4) {
+                swapped = tag;
+            }
+            else if (tag != 4) {
+                return std::nullopt;
+            }
+        }
+        if (swapped == -1) {
+            return RuleTable::outcome_stay;
+        }
+        for (int bit = 0; bit < 8; bit++) {
+            Vector2i offset = neighbor::offsets.at(bit);
+            if ((offset.y + 1) * 3 + offset.x + 1 == swapped) {
+                return bit;
+            }
+        }
+        return std::nullopt;
+    }
+};
+
+static bool same_distribution(const Distribution& a, const Distribution& b, double tolerance)
+{
+    for (int i = 0; i < static_cast<int>(a.size()); i++) {
+        if (std::abs(a[i] - b[i]) > tolerance) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static std::optional<std::vector<Distribution>> compile_distributions(
+    const Simulation& simulation,
+    ElementId element_id,
+    const std::array<ElementId, k_class_count>& representatives,
+    int key_stride,
+    BS::thread_pool& pool)
+{
+    std::vector<Distribution> distributions(RuleTable::key_count / key_stride);
+    std::atomic<bool> failed = false;
+    auto compile_keys = [&](int start, int end) {
+        Probe probe(simulation, element_id);
+        for (int i = start; i < end && !failed; i++) {
+            int key = i * key_stride;
+            for (int bit = 0; bit < 8; bit++) {
+                probe.set_neighbor(bit, representatives.at((key >> (bit * 2)) & 0b11));
+            }
+            std::optional<Distribution> distribution = probe.run();
+            if (!distribution.has_value()) {
+                failed = true;
+                return;
+            }
+            distributions[i] = distribution.value();
+        }
+    };
+    pool.parallelize_loop(0, static_cast<int>(distributions.size()), compile_keys).wait();
+    if (failed) {
+        return std::nullopt;
+    }
+    return distributions;
+}
+
+std::optional<RuleTable> RuleTable::compile(const Simulation& simulation, ElementId element_id, BS::thread_pool& pool)
+{
+    std::array<std::vector<ElementId>, k_class_count> class_elements;
+    for (ElementId id = 1; id <= static_cast<ElementId>(simulation.element_count()); id++) {
+        class_elements.at(class_of(simulation.type_of(id))).push_back(id);
+    }
+    // Out of bounds cells are probed as blocked, so there has to be an element to stand in for them
+    if (class_elements[k_class_blocked].empty()) {
+        return std::nullopt;
+    }
+
+    std::array<ElementId, k_class_count> base {};
+    for (int c = 0; c < k_class_count; c++) {
+        // Keys with a class no element has can't come up, the blocked element is as good as any
+        base[c] = class_elements[c].empty() ? class_elements[k_class_blocked][0] : class_elements[c][0];
+    }
+
+    std::optional<std::vector<Distribution>> distributions
+        = compile_distributions(simulation, element_id, base, 1, pool);
+    if (!distributions.has_value()) {
+        return std::nullopt;
+    }
+
+    for (int c = 0; c < k_class_count; c++) {
+        for (size_t i = 1; i < class_elements[c].size(); i++) {
+            std::array<ElementId, k_class_count> variant = base;
+            variant[c] = class_elements[c][i];
+            std::optional<std::vector<Distribution>> other
+                = compile_distributions(simulation, element_id, variant, k_variant_key_stride, pool);
+            if (!other.has_value()) {
+                return std::nullopt;
+            }
+            for (size_t key = 0; key < other.value().size(); key++) {
+                if (!same_distribution(distributions.value()[key * k_variant_key_stride], other.value()[key], 1e-9)) {
+                    return std::nullopt;
+                }
+            }
+        }
+    }
+
+    RuleTable table;
+    table.m_key_thresholds.resize(key_count);
+    std::map<Thresholds, uint16_t> unique_thresholds;
+    for (int key = 0; key < key_count; key++) {
+        Thresholds thresholds {};
+        double cumulative = 0.0;
+        for (int i = 0; i < static_cast<int>(thresholds.size()); i++) {
+            cumulative += distributions.value()[key][i];
+            thresholds[i] = static_cast<uint32_t>(std::lround(cumulative * 65536.0));
+        }
+        thresholds.back() = 65536;
+        auto [it, inserted]
+            = unique_thresholds.insert({ thresholds, static_cast<uint16_t>(table.m_thresholds.size()) });
+        if (inserted) {
+            table.m_thresholds.push_back(thresholds);
+        }
+        table.m_key_thresholds[key] = it->second;
+    }
+    return table;
+}
+
+uint16_t RuleTable::key_at(const Simulation& simulation, Vector2i pos)
+{
+    uint8_t empty = simulation.neighbor_mask(pos, ElementType::e_null);
+    uint8_t liquid = simulation.neighbor_mask(pos, ElementType::e_liquid);
+    uint8_t gas = simulation.neighbor_mask(pos, ElementType::e_gas);
+    return spread_bits(empty | gas) | static_cast<uint16_t>(spread_bits(liquid | gas) << 1);
+}
+
+int RuleTable::outcome(uint16_t key, uint16_t rand) const
+{
+    const Thresholds& thresholds = m_thresholds[m_key_thresholds[key]];
+    for (int i = 0; i < outcome_stay; i++) {
+        if (rand < thresholds[i]) {
+            return i;
+        }
+    }
+    return outcome_stay;
+}
+
+int RuleTable::cross_validate(const Simulation& simulation, ElementId element_id, int max_samples) const
+{
+    ElementId blocked = 0;
+    for (ElementId id = 1; id <= static_cast<ElementId>(simulation.element_count()); id++) {
+        if (class_of(simulation.type_of(id)) == k_class_blocked) {
+            blocked = id;
+            break;
+        }
+    }
+
+    Probe probe(simulation, element_id);
+    int samples = 0;
+    int mismatches = 0;
+    for (int i = 0; i < simulation.width() * simulation.height() && samples < max_samples; i++) {
+        Vector2i pos = simulation.pos_at(i);
+        if (simulation.id_at(pos) != element_id) {
+            continue;
+        }
+        for (int bit = 0; bit < 8; bit++) {
+            Vector2i neighbor_pos { pos.x + neighbor::offsets[bit].x, pos.y + neighbor::offsets[bit].y };
+            probe.set_neighbor(bit, simulation.in_bounds(neighbor_pos) ? simulation.id_at(neighbor_pos) : blocked);
+        }
+        std::optional<Distribution> expected = probe.run();
+        const Thresholds& thresholds = m_thresholds[m_key_thresholds[key_at(simulation, pos)]];
+        Distribution actual {};
+        uint32_t previous = 0;
+        for (int o = 0; o < static_cast<int>(actual.size()); o++) {
+            actual[o] = (thresholds[o] - previous) / 65536.0;
+            previous = thresholds[o];
+        }
+        if (!expected.has_value() || !same_distribution(expected.value(), actual, 1.0 / 65536.0)) {
+            mismatches++;
+        }
+        samples++;
+    }
+    return mismatches;
+}
+
+bool RuleTable::can_move(uint16_t key) const
+{
+    return m_thresholds[m_key_thresholds[key]][outcome_stay - 1] != 0;
+}
+
+bool RuleTable::can_move() const
+{
+    for (const Thresholds& thresholds : m_thresholds) {
+        if (thresholds[outcome_stay - 1] != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void step_rule_table(Simulation& simulation, const RuleTable& table, Vector2i particle_pos)
+{
+    const uint16_t key = RuleTable::key_at(simulation, particle_pos);
+    if (!table.can_move(key)) {
+        return;
+    }
+    const int outcome = table.outcome(key, static_cast<uint16_t>(simulation.random(0, 65535)));
+    if (outcome == RuleTable::outcome_stay) {
+        return;
+    }
+    const Vector2i offset = neighbor::offsets[outcome];
+    simulation.swap(particle_pos, { particle_pos.x + offset.x, particle_pos.y + offset.y });
+}
+
+}
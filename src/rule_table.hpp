@@ -0,0 +1,77 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include <BS_thread_pool.hpp>
+
+#include "common.hpp"
+#include "elements.hpp"
+
+namespace pop {
+
+class Simulation;
+
+/**
+ * @brief Transition table of an element keyed on the classes of its 8 neighbors. Each neighbor takes 2 bits of the
+ * key: air, liquid, gas or blocked (powder, solid or out of bounds). An entry is the probability of the particle
+ * staying put or swapping with each neighbor.
+ */
+class RuleTable {
+public:
+    static constexpr int key_count = 1 << 16;
+    static constexpr int outcome_stay = 8;
+
+    /**
+     * @brief Compile an element's kernel by running it on a 3x3 probe for every neighborhood key and every random
+     * value it draws. The probe is compiled once per element of each class to catch kernels that look at more than
+     * the class of their neighbors.
+     * @return - Table, or nothing if the kernel does more than swap with a neighbor or depends on specific elements
+     */
+    [[nodiscard]] static std::optional<RuleTable> compile(
+        const Simulation& simulation, ElementId element_id, BS::thread_pool& pool);
+
+    /**
+     * @brief Get the neighborhood key of a cell
+     */
+    [[nodiscard]] static uint16_t key_at(const Simulation& simulation, Vector2i pos);
+
+    /**
+     * @brief Pick an outcome of a neighborhood
+     * @param rand - Uniformly random 16 bits
+     * @return - Index of the neighbor to swap with (see neighbor::offsets) or outcome_stay
+     */
+    [[nodiscard]] int outcome(uint16_t key, uint16_t rand) const;
+
+    /**
+     * @brief Check if any outcome of a neighborhood moves the particle, so that no random value has to be drawn
+     */
+    [[nodiscard]] bool can_move(uint16_t key) const;
+
+    /**
+     * @brief Check if the particle moves in any neighborhood, elements that never do gain nothing from a table
+     */
+    [[nodiscard]] bool can_move() const;
+
+    /**
+     * @brief Compare the table against the kernel on the real neighborhoods of up to max_samples cells of its element
+     * @return - Number of sampled cells where the outcome probabilities differ
+     */
+    [[nodiscard]] int cross_validate(const Simulation& simulation, ElementId element_id, int max_samples) const;
+
+private:
+    // Cumulative probability of each outcome, out of 65536
+    using Thresholds = std::array<uint32_t, 9>;
+
+    std::vector<uint16_t> m_key_thresholds {};
+    std::vector<Thresholds> m_thresholds {};
+};
+
+/**
+ * @brief Update a particle using its element's rule table: one table lookup plus at most one swap
+ */
+void step_rule_table(Simulation& simulation, const RuleTable& table, Vector2i particle_pos);
+
+}
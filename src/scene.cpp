@@ -0,0 +1,390 @@
+#include "scene.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "simulation.hpp"
+#include "util/bytes.hpp"
+#include "util/file.hpp"
+#include "util/profiler.hpp"
+
+namespace pop {
+
+inline constexpr std::array<char, 8> k_scene_magic { 'P', 'O', 'P', 'S', 'C', 'E', 'N', 'E' };
+inline constexpr uint32_t k_scene_flag_shades = 1;
+
+/**
+ * @brief Cells covered by one chunk of a scene, clipped to the grid
+ */
+struct SceneChunk {
+    Vector2i start;
+    Vector2i end;
+};
+
+static SceneChunk scene_chunk(int chunk, int chunks_x, int chunk_size, int width, int height)
+{
+    const Vector2i start { (chunk % chunks_x) * chunk_size, (chunk / chunks_x) * chunk_size };
+    return { start, { std::min(start.x + chunk_size, width), std::min(start.y + chunk_size, height) } };
+}
+
+/**
+ * @brief Write the values of a chunk as a sorted palette followed by runs of palette indices, or as the palette alone
+ * if every value is the same
+ * @param runs - Scratch for the runs of the chunk
+ */
+static void encode_layer(std::vector<uint8_t>& out, const std::vector<uint32_t>& values,
+    std::vector<std::pair<uint32_t, uint32_t>>& runs, std::vector<uint32_t>& palette)
+{
+    runs.clear();
+    palette.clear();
+    std::size_t i = 0;
+    while (i < values.size()) {
+        std::size_t run = 1;
+        while (i + run < values.size() && values[i + run] == values[i]) {
+            run++;
+        }
+        runs.emplace_back(values[i], static_cast<uint32_t>(run));
+        palette.push_back(values[i]);
+        i += run;
+    }
+    std::sort(palette.begin(), palette.end());
+    palette.erase(std::unique(palette.begin(), palette.end()), palette.end());
+    util::put_varint(out, static_cast<uint32_t>(palette.size()));
+    for (uint32_t value : palette) {
+        util::put_varint(out, value);
+    }
+    if (palette.size() == 1) {
+        return;
+    }
+    for (const auto& [value, length] : runs) {
+        util::put_varint(out, length);
+        const auto index = std::lower_bound(palette.begin(), palette.end(), value) - palette.begin();
+        util::put_varint(out, static_cast<uint32_t>(index));
+    }
+}
+
+/**
+ * @brief Read the values of a chunk written by encode_layer()
+ * @param ids - Maps palette values from the ids of the scene to the ids of the simulation, nullptr to keep them
+ */
+static void decode_layer(util::ByteReader& reader, std::vector<uint32_t>& values, std::vector<uint32_t>& palette,
+    const std::vector<ElementId>* ids)
+{
+    const uint32_t palette_size = reader.varint();
+    if (palette_size == 0 || palette_size > values.size()) {
+        throw std::runtime_error("Scene chunk has a malformed palette");
+    }
+    palette.resize(palette_size);
+    for (uint32_t& value : palette) {
+        value = reader.varint();
+        if (ids != nullptr) {
+            if (value >= ids->size()) {
+                throw std::runtime_error("Scene chunk holds an unknown element");
+            }
+            value = (*ids)[value];
+        }
+    }
+    if (palette_size == 1) {
+        std::fill(values.begin(), values.end(), palette[0]);
+        return;
+    }
+    std::size_t i = 0;
+    while (i < values.size()) {
+        const uint32_t run = reader.varint();
+        const uint32_t index = reader.varint();
+        if (run == 0 || run > values.size() - i || index >= palette_size) {
+            throw std::runtime_error("Scene chunk has a malformed run");
+        }
+        std::fill_n(values.begin() + static_cast<std::ptrdiff_t>(i), run, palette[index]);
+        i += run;
+    }
+}
+
+static std::size_t varint_size(std::size_t value)
+{
+    std::size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+std::size_t max_encoded_chunk_size(std::size_t cell_count, bool shades)
+{
+    // Every value its own palette entry of up to five bytes and its own run
+    const std::size_t layer = varint_size(cell_count) + cell_count * (5 + 2 * varint_size(cell_count));
+    return shades ? layer * 2 : layer;
+}
+
+void encode_chunk(std::span<const Particle> cells, bool shades, std::vector<uint8_t>& out, ChunkCodecScratch& scratch,
+    const std::vector<ElementId>* ids)
+{
+    scratch.values.clear();
+    for (const Particle& particle : cells) {
+        scratch.values.push_back(ids == nullptr ? particle.element_id : (*ids)[particle.element_id]);
+    }
+    encode_layer(out, scratch.values, scratch.runs, scratch.palette);
+    if (shades) {
+        scratch.values.clear();
+        for (const Particle& particle : cells) {
+            scratch.values.push_back(std::bit_cast<uint32_t>(particle.shade));
+        }
+        encode_layer(out, scratch.values, scratch.runs, scratch.palette);
+    }
+}
+
+void decode_chunk(std::span<const uint8_t> data, bool shades, std::span<Particle> cells, ChunkCodecScratch& scratch,
+    const std::vector<ElementId>* ids)
+{
+    util::ByteReader reader(data, "Scene");
+    scratch.values.resize(cells.size());
+    decode_layer(reader, scratch.values, scratch.palette, ids);
+    for (std::size_t i = 0; i < cells.size(); i++) {
+        cells[i].element_id = scratch.values[i];
+    }
+    if (shades) {
+        decode_layer(reader, scratch.values, scratch.palette, nullptr);
+        for (std::size_t i = 0; i < cells.size(); i++) {
+            cells[i].shade = std::bit_cast<float>(scratch.values[i]);
+        }
+    }
+    else {
+        for (Particle& particle : cells) {
+            particle.shade = Particle {}.shade;
+        }
+    }
+}
+
+/**
+ * @brief Write everything a scene holds before the sizes of its chunks
+ */
+static void put_header(std::vector<uint8_t>& data, int width, int height, bool shades,
+    const std::vector<std::string>& element_names, int chunk_count)
+{
+    data.insert(data.end(), k_scene_magic.begin(), k_scene_magic.end());
+    util::put_u32(data, k_scene_version);
+    util::put_u32(data, shades ? k_scene_flag_shades : 0);
+    util::put_u32(data, static_cast<uint32_t>(width));
+    util::put_u32(data, static_cast<uint32_t>(height));
+    util::put_u32(data, static_cast<uint32_t>(k_chunk_size));
+    // Ids are written as they are and matched up by name when loading
+    util::put_u32(data, static_cast<uint32_t>(element_names.size()));
+    for (const std::string& name : element_names) {
+        util::put_u16(data, static_cast<uint16_t>(name.size()));
+        data.insert(data.end(), name.begin(), name.end());
+    }
+    util::put_u32(data, static_cast<uint32_t>(chunk_count));
+}
+
+std::vector<std::string> element_names(const Simulation& simulation)
+{
+    std::vector<std::string> names;
+    for (ElementId id = 1; id <= static_cast<ElementId>(simulation.element_count()); id++) {
+        names.push_back(simulation.element_of(id).name);
+    }
+    return names;
+}
+
+std::vector<uint8_t> encode_scene(const Simulation& simulation, util::WorkerPool* pool, bool shades)
+{
+    PROFILE_ZONE("encode_scene");
+    const int width = simulation.width();
+    const int height = simulation.height();
+    const int chunks_x = (width + k_chunk_size - 1) / k_chunk_size;
+    const int chunk_count = chunks_x * ((height + k_chunk_size - 1) / k_chunk_size);
+
+    std::vector<std::vector<uint8_t>> chunks(chunk_count);
+    util::parallel_for(pool, 0, chunk_count, [&](int start, int end, int) {
+        std::vector<Particle> cells;
+        ChunkCodecScratch scratch;
+        for (int c = start; c < end; c++) {
+            const SceneChunk chunk = scene_chunk(c, chunks_x, k_chunk_size, width, height);
+            cells.clear();
+            for (int y = chunk.start.y; y < chunk.end.y; y++) {
+                // Rows of a chunk are contiguous
+                const Particle* row = &simulation.particle_at({ chunk.start.x, y });
+                cells.insert(cells.end(), row, row + (chunk.end.x - chunk.start.x));
+            }
+            encode_chunk(cells, shades, chunks[c], scratch);
+        }
+    });
+
+    std::vector<uint8_t> data;
+    put_header(data, width, height, shades, element_names(simulation), chunk_count);
+    std::size_t total_size = data.size();
+    for (const std::vector<uint8_t>& chunk : chunks) {
+        util::put_u32(data, static_cast<uint32_t>(chunk.size()));
+        total_size += 4 + chunk.size();
+    }
+    data.reserve(total_size);
+    for (const std::vector<uint8_t>& chunk : chunks) {
+        data.insert(data.end(), chunk.begin(), chunk.end());
+    }
+    return data;
+}
+
+void decode_scene(Simulation& simulation, std::span<const uint8_t> data, util::WorkerPool* pool)
+{
+    PROFILE_ZONE("decode_scene");
+    util::ByteReader reader(data, "Scene");
+    const std::span<const uint8_t> magic = reader.bytes(k_scene_magic.size());
+    if (std::memcmp(magic.data(), k_scene_magic.data(), k_scene_magic.size()) != 0) {
+        throw std::runtime_error("Not a scene");
+    }
+    const uint32_t version = reader.u32();
+    if (version > k_scene_version) {
+        throw std::runtime_error("Scene version " + std::to_string(version) + " is newer than this build reads");
+    }
+    const bool shades = (reader.u32() & k_scene_flag_shades) != 0;
+    const auto width = static_cast<int>(reader.u32());
+    const auto height = static_cast<int>(reader.u32());
+    if (width != simulation.width() || height != simulation.height()) {
+        throw std::runtime_error("Scene is " + std::to_string(width) + "x" + std::to_string(height)
+            + " but the simulation is " + std::to_string(simulation.width()) + "x"
+            + std::to_string(simulation.height()));
+    }
+    const auto chunk_size = static_cast<int>(reader.u32());
+    if (chunk_size <= 0) {
+        throw std::runtime_error("Scene has a malformed chunk size");
+    }
+
+    // Id 0 is the null element in every build
+    const uint32_t element_count = reader.u32();
+    std::vector<ElementId> ids { 0 };
+    for (uint32_t i = 0; i < element_count; i++) {
+        const std::span<const uint8_t> name = reader.bytes(reader.u16());
+        const std::string element_name(name.begin(), name.end());
+        if (!simulation.has_element(element_name)) {
+            throw std::runtime_error("Scene holds an element this build doesn't have: " + element_name);
+        }
+        ids.push_back(simulation.id_of(element_name));
+    }
+
+    const int chunks_x = (width + chunk_size - 1) / chunk_size;
+    const int chunk_count = chunks_x * ((height + chunk_size - 1) / chunk_size);
+    if (reader.u32() != static_cast<uint32_t>(chunk_count)) {
+        throw std::runtime_error("Scene has the wrong number of chunks");
+    }
+    std::vector<std::span<const uint8_t>> chunks(chunk_count);
+    std::vector<uint32_t> chunk_sizes(chunk_count);
+    for (uint32_t& size : chunk_sizes) {
+        size = reader.u32();
+    }
+    for (int c = 0; c < chunk_count; c++) {
+        chunks[c] = reader.bytes(chunk_sizes[c]);
+    }
+
+    // Chunks are decoded into rows of a staging grid first, so a corrupt chunk leaves the simulation untouched
+    std::vector<Particle> staging(static_cast<std::size_t>(width) * height);
+    std::atomic<bool> corrupt = false;
+    util::parallel_for(pool, 0, chunk_count, [&](int start, int end, int) {
+        std::vector<Particle> cells;
+        ChunkCodecScratch scratch;
+        for (int c = start; c < end; c++) {
+            const SceneChunk chunk = scene_chunk(c, chunks_x, chunk_size, width, height);
+            const int chunk_width = chunk.end.x - chunk.start.x;
+            cells.resize(static_cast<std::size_t>(chunk_width * (chunk.end.y - chunk.start.y)));
+            try {
+                decode_chunk(chunks[c], shades, cells, scratch, &ids);
+            }
+            catch (const std::runtime_error&) {
+                corrupt.store(true, std::memory_order_relaxed);
+                continue;
+            }
+            for (int y = chunk.start.y; y < chunk.end.y; y++) {
+                std::copy_n(cells.begin() + static_cast<std::ptrdiff_t>((y - chunk.start.y) * chunk_width),
+                    chunk_width, staging.begin() + static_cast<std::ptrdiff_t>(y) * width + chunk.start.x);
+            }
+        }
+    });
+    if (corrupt.load()) {
+        throw std::runtime_error("Scene has a corrupt chunk");
+    }
+
+    util::parallel_for(pool, 0, height, [&](int start, int end, int) {
+        for (int y = start; y < end; y++) {
+            // Rows are contiguous up to the end of each chunk of the simulation
+            for (int x = 0; x < width; x += k_chunk_size) {
+                std::copy_n(staging.begin() + static_cast<std::ptrdiff_t>(y) * width + x,
+                    std::min(k_chunk_size, width - x), &simulation.particle_at({ x, y }));
+            }
+        }
+    });
+    simulation.rebuild_occupancy();
+    simulation.mark_all_changed();
+}
+
+std::size_t save_scene(
+    const Simulation& simulation, const std::filesystem::path& path, util::WorkerPool* pool, bool shades)
+{
+    const std::vector<uint8_t> data = encode_scene(simulation, pool, shades);
+    util::replace_file(path, [&](std::FILE* file) { util::write_bytes(file, data); });
+    return data.size();
+}
+
+std::size_t write_scene(GridSnapshot snapshot, const std::vector<std::string>& element_names,
+    const std::filesystem::path& path, std::size_t buffer_size, bool shades)
+{
+    PROFILE_ZONE("write_scene");
+    const int width = snapshot.width();
+    const int height = snapshot.height();
+    const int chunks_x = (width + k_chunk_size - 1) / k_chunk_size;
+    const int chunk_count = chunks_x * ((height + k_chunk_size - 1) / k_chunk_size);
+
+    std::vector<uint8_t> header;
+    put_header(header, width, height, shades, element_names, chunk_count);
+    const std::size_t sizes_offset = header.size();
+    // Sizes are filled in once every chunk is written
+    header.resize(sizes_offset + 4 * static_cast<std::size_t>(chunk_count));
+    std::size_t total_size = header.size();
+
+    util::replace_file(path, [&](std::FILE* file) {
+        util::write_bytes(file, header);
+        std::vector<uint8_t> sizes;
+        std::vector<uint8_t> pending;
+        std::vector<Particle> cells;
+        ChunkCodecScratch scratch;
+        for (int c = 0; c < chunk_count; c++) {
+            const SceneChunk chunk = scene_chunk(c, chunks_x, k_chunk_size, width, height);
+            const Vector2i chunk_pos { chunk.start.x / k_chunk_size, chunk.start.y / k_chunk_size };
+            const std::span<const Particle> chunk_cells = snapshot.chunk(chunk_pos);
+            cells.clear();
+            for (int y = 0; y < chunk.end.y - chunk.start.y; y++) {
+                const auto row = chunk_cells.subspan(static_cast<std::size_t>(y * k_chunk_size));
+                cells.insert(cells.end(), row.begin(), row.begin() + (chunk.end.x - chunk.start.x));
+            }
+            // Once released the simulation writes the chunk without copying it
+            snapshot.release_chunk(chunk_pos);
+            const std::size_t start = pending.size();
+            encode_chunk(cells, shades, pending, scratch);
+            util::put_u32(sizes, static_cast<uint32_t>(pending.size() - start));
+            if (pending.size() >= buffer_size) {
+                util::write_bytes(file, pending);
+                total_size += pending.size();
+                pending.clear();
+            }
+        }
+        util::write_bytes(file, pending);
+        total_size += pending.size();
+        if (std::fseek(file, static_cast<long>(sizes_offset), SEEK_SET) != 0) {
+            throw std::runtime_error("Unable to write scene");
+        }
+        util::write_bytes(file, sizes);
+    });
+    return total_size;
+}
+
+void load_scene(Simulation& simulation, const std::filesystem::path& path, util::WorkerPool* pool)
+{
+    decode_scene(simulation, util::read_file(path), pool);
+}
+
+}
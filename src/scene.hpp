@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "simulation.hpp"
+#include "util/worker_pool.hpp"
+
+namespace pop {
+
+inline constexpr uint32_t k_scene_version = 1;
+
+/**
+ * @brief Buffers the chunk codec works in, kept between chunks so they aren't allocated for each
+ */
+struct ChunkCodecScratch {
+    std::vector<uint32_t> values {};
+    std::vector<uint32_t> palette {};
+    std::vector<std::pair<uint32_t, uint32_t>> runs {};
+};
+
+/**
+ * @brief Compress the cells of a chunk as scenes store them: the distinct element ids go into a sorted palette and the
+ * cells become runs of palette indices, then the same for shades
+ * @param cells - Cells of the chunk, in rows
+ * @param out - Compressed bytes are appended to it
+ * @param ids - Maps element ids to the ids to store, nullptr to store them as they are
+ */
+void encode_chunk(std::span<const Particle> cells, bool shades, std::vector<uint8_t>& out, ChunkCodecScratch& scratch,
+    const std::vector<ElementId>* ids = nullptr);
+
+/**
+ * @brief Decompress cells written by encode_chunk(), throws if the data is corrupt. Cells get the default shade if no
+ * shades were stored.
+ * @param ids - Maps stored element ids to the ids of the simulation, nullptr to keep them. Stored ids past its end are
+ * treated as corrupt.
+ */
+void decode_chunk(std::span<const uint8_t> data, bool shades, std::span<Particle> cells, ChunkCodecScratch& scratch,
+    const std::vector<ElementId>* ids = nullptr);
+
+/**
+ * @brief Get the most bytes encode_chunk() can write for a number of cells
+ */
+[[nodiscard]] std::size_t max_encoded_chunk_size(std::size_t cell_count, bool shades);
+
+/**
+ * @brief Encode the grid of a simulation into the binary scene format. The file holds the grid size, the names of the
+ * elements so ids are matched up by name when loading, and every k_chunk_size square chunk compressed on its own: the
+ * distinct values of the chunk go into a palette and the cells become runs of palette indices. Chunks are encoded in
+ * parallel.
+ * @param pool - Pool to encode chunks on, or nullptr to encode them on the calling thread
+ * @param shades - Whether to store the shade of every cell, which only changes how cells are drawn
+ */
+[[nodiscard]] std::vector<uint8_t> encode_scene(
+    const Simulation& simulation, util::WorkerPool* pool, bool shades = true);
+
+/**
+ * @brief Replace the grid of a simulation with an encoded scene of the same size. Chunks are decoded in parallel.
+ * Cells keep the default shade if the scene holds no shades. Throws if the data isn't a scene, its size differs, it
+ * names an element the simulation doesn't have, or a chunk is corrupt. Every chunk is decoded before any cell is
+ * written, so the grid is left as it was if loading throws.
+ * @param pool - Pool to decode chunks on, or nullptr to decode them on the calling thread
+ */
+void decode_scene(Simulation& simulation, std::span<const uint8_t> data, util::WorkerPool* pool);
+
+/**
+ * @brief Encode a scene and write it to a file. The file is written under a temporary name, flushed to disk and renamed
+ * into place, so a crash leaves either the old scene or the new one whole.
+ * @return - Size of the file in bytes
+ */
+std::size_t save_scene(
+    const Simulation& simulation, const std::filesystem::path& path, util::WorkerPool* pool, bool shades = true);
+
+/**
+ * @brief Write a snapshot to a scene file on the calling thread, one chunk at a time so only about buffer_size bytes of
+ * encoded chunks are held at once. Chunks are released from the snapshot as they are encoded, after which the
+ * simulation writes them without copying them. The file is replaced the same way as by save_scene().
+ * @param element_names - Names of the elements of the simulation the snapshot was taken of, see element_names()
+ * @return - Size of the file in bytes
+ */
+std::size_t write_scene(GridSnapshot snapshot, const std::vector<std::string>& element_names,
+    const std::filesystem::path& path, std::size_t buffer_size, bool shades = true);
+
+/**
+ * @brief Get the names of the elements of a simulation in order of id, as scenes store them
+ */
+[[nodiscard]] std::vector<std::string> element_names(const Simulation& simulation);
+
+/**
+ * @brief Read a scene file and decode it into a simulation, see decode_scene()
+ */
+void load_scene(Simulation& simulation, const std::filesystem::path& path, util::WorkerPool* pool);
+
+}
@@ -1,46 +1,125 @@
 #include "simulation.hpp"
 
+#include <algorithm>
+#include <bit>
 #include <cassert>
+#include <memory>
+#include <thread>
+#include <utility>
 
+#include "bitsliced.hpp"
 #include "elements.hpp"
+#include "util/logger.hpp"
+#include "util/profiler.hpp"
 
 namespace rl = raylib;
 
 namespace pop {
 
-void draw_particle(rl::Image& render_image, const Simulation& simulation, Vector2i pos)
+inline constexpr int k_chunk_cells = k_chunk_size * k_chunk_size;
+inline constexpr int k_chunk_shift = std::countr_zero(static_cast<unsigned>(k_chunk_size));
+
+static thread_local util::Rng* t_rng = nullptr;
+
+static int cell_in_chunk(Vector2i pos)
+{
+    return (pos.y & (k_chunk_size - 1)) << k_chunk_shift | (pos.x & (k_chunk_size - 1));
+}
+
+int GridSnapshot::width() const
+{
+    return m_width;
+}
+
+int GridSnapshot::height() const
+{
+    return m_height;
+}
+
+uint64_t GridSnapshot::tick() const
 {
-    rl::Vector3 hsv = simulation.element_at(pos).color.ToHSV();
-    if (simulation.element_at(pos).name == "salt") {
-        hsv.z = simulation.particle_at(pos).shade;
+    return m_tick;
+}
+
+bool GridSnapshot::in_bounds(Vector2i pos) const
+{
+    return pos.x >= 0 && pos.x < m_width && pos.y >= 0 && pos.y < m_height;
+}
+
+const Particle& GridSnapshot::particle_at(Vector2i pos) const
+{
+    assert(in_bounds(pos));
+    return m_chunks[(pos.y >> k_chunk_shift) * m_chunks_x + (pos.x >> k_chunk_shift)].get()[cell_in_chunk(pos)];
+}
+
+ElementId GridSnapshot::id_at(Vector2i pos) const
+{
+    return particle_at(pos).element_id;
+}
+
+std::span<const Particle> GridSnapshot::chunk(Vector2i chunk) const
+{
+    return { m_chunks.at(chunk.y * m_chunks_x + chunk.x).get(), k_chunk_cells };
+}
+
+void GridSnapshot::release_chunk(Vector2i chunk)
+{
+    m_chunks.at(chunk.y * m_chunks_x + chunk.x).reset();
+}
+
+static bool draw_pixel(::Color* pixel, ::Color color)
+{
+    if (pixel->r == color.r && pixel->g == color.g && pixel->b == color.b && pixel->a == color.a) {
+        return false;
     }
+    *pixel = color;
+    return true;
+}
 
-    render_image.DrawPixel(pos.x, pos.y, rl::Color::FromHSV(hsv.x, hsv.y, hsv.z));
+DrawPalette draw_palette(const Simulation& simulation)
+{
+    DrawPalette palette { .salt = simulation.id_of("salt") };
+    palette.hsv_colors.resize(simulation.element_count() + 1);
+    palette.colors.resize(palette.hsv_colors.size());
+    palette.types.resize(palette.hsv_colors.size());
+    for (ElementId id = 1; id < palette.hsv_colors.size(); id++) {
+        palette.types[id] = simulation.type_of(id);
+        const rl::Vector3 hsv = simulation.element_of(id).color.ToHSV();
+        palette.hsv_colors[id] = hsv;
+        palette.colors[id] = rl::Color::FromHSV(hsv.x, hsv.y, hsv.z);
+    }
+    return palette;
 }
 
-void draw_column(
-    rl::Image& render_image, rl::Image& gas_image, const Simulation& simulation, int start_col, int col_width)
+bool draw_region(rl::Image& render_image, rl::Image& gas_image, const GridSnapshot& snapshot,
+    const DrawPalette& palette, Vector2i start, Vector2i end)
 {
-    for (int x = start_col * col_width; x < (start_col + 1) * col_width; x++) {
-        for (int y = 0; y < simulation.height(); y++) {
-            if (simulation.type_at({ x, y }) == ElementType::e_gas) {
-                draw_particle(gas_image, simulation, { x, y });
+    PROFILE_ZONE("draw_region");
+    const ElementId salt = palette.salt;
+    auto* render_pixels = static_cast<::Color*>(render_image.data);
+    auto* gas_pixels = static_cast<::Color*>(gas_image.data);
+    const ::Color clear { 0, 0, 0, 0 };
+    bool changed = false;
+    for (int y = start.y; y < end.y; y++) {
+        for (int x = start.x; x < end.x; x++) {
+            const Particle& particle = snapshot.particle_at({ x, y });
+            ::Color color = palette.colors[particle.element_id];
+            if (particle.element_id == salt) {
+                const rl::Vector3& hsv = palette.hsv_colors[salt];
+                color = rl::Color::FromHSV(hsv.x, hsv.y, particle.shade);
+            }
+            const int i = y * snapshot.width() + x;
+            if (palette.types[particle.element_id] == ElementType::e_gas) {
+                changed |= draw_pixel(gas_pixels + i, color);
+                changed |= draw_pixel(render_pixels + i, clear);
             }
             else {
-                draw_particle(render_image, simulation, { x, y });
+                changed |= draw_pixel(render_pixels + i, color);
+                changed |= draw_pixel(gas_pixels + i, clear);
             }
         }
     }
-}
-
-void draw_sim(rl::Image& render_image, rl::Image& gas_image, const Simulation& simulation, BS::thread_pool& pool)
-{
-    for (int col = 0; col < 8; col++) {
-        pool.push_task([col, &simulation, &render_image, &gas_image] {
-            draw_column(render_image, gas_image, simulation, col, 40);
-        });
-    }
-    pool.wait_for_tasks();
+    return changed;
 }
 
 int Simulation::index_at(Vector2i pos) const
@@ -55,26 +134,133 @@ bool Simulation::in_bounds(Vector2i pos) const
 {
     return pos.x >= 0 && pos.x < m_width && pos.y >= 0 && pos.y < m_height;
 }
+int Simulation::chunk_at(Vector2i pos) const
+{
+    assert(in_bounds(pos));
+    return (pos.y >> k_chunk_shift) * m_chunks_x + (pos.x >> k_chunk_shift);
+}
 const Particle& Simulation::particle_at(Vector2i pos) const
 {
-    return m_space.at(index_at(pos));
+    // Acquire pairs with unshare() publishing a copied chunk, so its cells are seen along with the pointer
+    return m_chunk_cells[chunk_at(pos)].load(std::memory_order_acquire)[cell_in_chunk(pos)];
 }
 Particle& Simulation::particle_at(Vector2i pos)
 {
-    return m_space.at(index_at(pos));
+    m_chunk_hashes.mark_dirty(pos);
+    return writable_particle(pos);
+}
+Particle& Simulation::writable_particle(Vector2i pos)
+{
+    const int chunk = chunk_at(pos);
+    // Acquire so a chunk copied on another thread is seen with its cells
+    if (m_chunk_states[chunk].load(std::memory_order_acquire) != ChunkState::e_owned) {
+        unshare(chunk);
+    }
+    return m_chunk_cells[chunk].load(std::memory_order_acquire)[cell_in_chunk(pos)];
+}
+void Simulation::unshare(int chunk)
+{
+    ChunkState expected = ChunkState::e_shared;
+    if (!m_chunk_states[chunk].compare_exchange_strong(expected, ChunkState::e_copying, std::memory_order_acquire)) {
+        while (m_chunk_states[chunk].load(std::memory_order_acquire) != ChunkState::e_owned) {
+            std::this_thread::yield();
+        }
+        return;
+    }
+    // Snapshots that shared the chunk may all be gone already
+    if (m_chunks[chunk].use_count() > 1) {
+        auto* cells = static_cast<Particle*>(m_chunk_pool->allocate());
+        std::uninitialized_copy_n(m_chunks[chunk].get(), k_chunk_cells, cells);
+        m_chunks[chunk] = std::shared_ptr<Particle>(
+            cells, [pool = m_chunk_pool](Particle* cells) { pool->deallocate(cells); });
+        m_chunk_cells[chunk].store(cells, std::memory_order_release);
+    }
+    else {
+        // The count is read relaxed, so this orders the reads the last snapshot made of the chunk before it let go
+        // ahead of the writes about to go into it
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    m_chunk_states[chunk].store(ChunkState::e_owned, std::memory_order_release);
 }
 void Simulation::swap(Vector2i pos1, Vector2i pos2)
 {
-    std::swap(m_space.at(index_at(pos1)), m_space.at(index_at(pos2)));
+    // Intents are counted once they are committed
+    if (m_intents != nullptr) {
+        m_intents->targets[index_at(pos1)] = index_at(pos2);
+        return;
+    }
+    m_chunk_hashes.mark_dirty(pos1);
+    m_chunk_hashes.mark_dirty(pos2);
+    if (m_cell_claims != nullptr) {
+        // Both cells are claimed so no other worker touches them and neither particle moves again this tick
+        const int cell1 = index_at(pos1);
+        const int cell2 = index_at(pos2);
+        if (!m_cell_claims->try_claim(cell1)) {
+            return;
+        }
+        if (!m_cell_claims->try_claim(cell2)) {
+            m_cell_claims->release(cell1);
+            return;
+        }
+        Particle& particle1 = writable_particle(pos1);
+        Particle& particle2 = writable_particle(pos2);
+        const ElementType type1 = type_of(particle1.element_id);
+        const ElementType type2 = type_of(particle2.element_id);
+        if (ActivityCounts* activity = local_activity()) {
+            activity->swaps[particle1.element_id]++;
+            activity->cells_changed += 2;
+        }
+        m_occupancy.swap_shared(pos1, type1, pos2, type2);
+        std::swap(particle1, particle2);
+        // Air left behind is free to move into, like in the serial engine
+        if (type2 == ElementType::e_null) {
+            m_cell_claims->release(cell1);
+        }
+        return;
+    }
+    Particle& particle1 = writable_particle(pos1);
+    Particle& particle2 = writable_particle(pos2);
+    if (ActivityCounts* activity = local_activity()) {
+        activity->swaps[particle1.element_id]++;
+        activity->cells_changed += 2;
+    }
+    m_occupancy.swap(pos1, type_of(particle1.element_id), pos2, type_of(particle2.element_id));
+    std::swap(particle1, particle2);
+}
+
+uint8_t Simulation::neighbor_mask(Vector2i pos, ElementType type) const
+{
+    return m_occupancy.neighbor_mask(pos, type);
+}
+const Occupancy& Simulation::occupancy() const
+{
+    return m_occupancy;
 }
 
 Simulation::Simulation(int width, int height)
     : m_width(width)
     , m_height(height)
+    , m_chunk_pool(std::make_shared<util::ChunkPool>(sizeof(Particle) * k_chunk_cells))
+    , m_chunks_x((width + k_chunk_size - 1) / k_chunk_size)
+    , m_occupancy(width, height)
+    , m_engine(make_engine("serial"))
+    , m_chunk_hashes(width, height)
 {
-    for (int i = 0; i < m_width * m_height; i++) {
-        m_space.push_back({});
+    const int chunk_count = m_chunks_x * ((height + k_chunk_size - 1) / k_chunk_size);
+    m_chunk_cells = std::make_unique<std::atomic<Particle*>[]>(chunk_count);
+    m_chunk_states = std::make_unique<std::atomic<ChunkState>[]>(chunk_count);
+    for (int c = 0; c < chunk_count; c++) {
+        auto* cells = static_cast<Particle*>(m_chunk_pool->allocate());
+        std::uninitialized_fill_n(cells, k_chunk_cells, Particle {});
+        m_chunks.emplace_back(cells, [pool = m_chunk_pool](Particle* cells) { pool->deallocate(cells); });
+        m_chunk_cells[c].store(cells, std::memory_order_relaxed);
+        m_chunk_states[c].store(ChunkState::e_owned, std::memory_order_relaxed);
     }
+    m_row_types.resize(m_width);
+    m_powder_segments.resize(m_occupancy.words_per_row());
+    m_element_types.push_back(static_cast<uint8_t>(ElementType::e_null));
+    m_rule_tables.push_back(nullptr);
+    m_table_driven.push_back(false);
 }
 
 void Simulation::push_element(Element element)
@@ -84,6 +270,127 @@ void Simulation::push_element(Element element)
 
     m_elements.insert({ id, element });
     m_element_name_map.insert({ element.name, id });
+    m_element_types.push_back(static_cast<uint8_t>(element.type));
+    m_rule_tables.push_back(nullptr);
+    m_table_driven.push_back(false);
+    if (m_activity_counters != nullptr) {
+        m_activity_counters = std::make_unique<ActivityCounters>(m_element_id_count);
+    }
+    if (element.type != ElementType::e_liquid && element.type != ElementType::e_gas && !element.bitsliced) {
+        m_bitsliced_supported = false;
+    }
+}
+
+void Simulation::set_bitsliced_powders(bool enabled)
+{
+    m_bitsliced_powders = enabled;
+}
+
+bool Simulation::bitsliced_powders() const
+{
+    return m_bitsliced_powders;
+}
+
+int Simulation::compile_rule_tables(BS::thread_pool& pool)
+{
+    int count = 0;
+    for (ElementId id = 1; id < m_element_id_count; id++) {
+        std::optional<RuleTable> table = RuleTable::compile(*this, id, pool);
+        if (table.has_value()) {
+            m_rule_tables.at(id) = std::make_shared<const RuleTable>(std::move(table.value()));
+            count++;
+        }
+        else {
+            m_rule_tables.at(id) = nullptr;
+            m_table_driven.at(id) = false;
+        }
+    }
+    return count;
+}
+
+bool Simulation::set_table_driven(ElementId element_id, bool enabled)
+{
+    if (enabled && m_rule_tables.at(element_id) == nullptr) {
+        return false;
+    }
+    m_table_driven.at(element_id) = enabled;
+    return true;
+}
+
+bool Simulation::table_driven(ElementId element_id) const
+{
+    return m_table_driven.at(element_id);
+}
+
+const RuleTable* Simulation::rule_table(ElementId element_id) const
+{
+    return m_rule_tables.at(element_id).get();
+}
+
+int Simulation::random(int min, int max)
+{
+    if (ActivityCounts* activity = local_activity()) {
+        activity->random_draws++;
+    }
+    if (m_random_source != nullptr) {
+        return m_random_source->next(min, max);
+    }
+    if (t_rng != nullptr) {
+        return t_rng->range(min, max);
+    }
+    return GetRandomValue(min, max);
+}
+
+void Simulation::set_random_source(RandomSource* source)
+{
+    m_random_source = source;
+}
+
+void Simulation::set_thread_rng(util::Rng* rng)
+{
+    t_rng = rng;
+}
+
+void Simulation::set_intents(Intents* intents)
+{
+    m_intents = intents;
+}
+
+void Simulation::set_cell_claims(CellClaims* claims)
+{
+    m_cell_claims = claims;
+}
+
+void Simulation::set_activity_counters(bool enabled)
+{
+    if (enabled == (m_activity_counters != nullptr)) {
+        return;
+    }
+    m_activity_counters = enabled ? std::make_unique<ActivityCounters>(m_element_id_count) : nullptr;
+}
+
+const ActivityCounts* Simulation::activity() const
+{
+    return m_activity_counters == nullptr ? nullptr : &m_activity_counters->last_tick();
+}
+
+ActivityCounts* Simulation::local_activity()
+{
+    return m_activity_counters == nullptr ? nullptr : &m_activity_counters->local();
+}
+
+void Simulation::update_particle(Vector2i pos)
+{
+    if (ActivityCounts* activity = local_activity()) {
+        activity->cells_visited++;
+    }
+    ElementId id = id_at(pos);
+    if (m_table_driven[id]) {
+        step_rule_table(*this, *m_rule_tables[id], pos);
+    }
+    else {
+        std::invoke(m_elements.at(id).update_func, *this, pos);
+    }
 }
 
 ElementId Simulation::id_of(const std::string& element_name) const
@@ -91,18 +398,178 @@ ElementId Simulation::id_of(const std::string& element_name) const
     return m_element_name_map.at(element_name);
 }
 
+bool Simulation::has_element(const std::string& element_name) const
+{
+    return m_element_name_map.contains(element_name);
+}
+
+int Simulation::element_count() const
+{
+    return static_cast<int>(m_elements.size());
+}
+
+void Simulation::rebuild_occupancy()
+{
+    for (int y = 0; y < m_height; y++) {
+        for (int x = 0; x < m_width; x += k_chunk_size) {
+            const Particle* row = &std::as_const(*this).particle_at({ x, y });
+            const int count = std::min(k_chunk_size, m_width - x);
+            for (int i = 0; i < count; i++) {
+                m_row_types[x + i] = m_element_types[row[i].element_id];
+            }
+        }
+        m_occupancy.rebuild_row(y, m_row_types.data());
+    }
+}
+
+void Simulation::mark_all_changed()
+{
+    m_chunk_hashes.mark_all_dirty();
+}
+
+void Simulation::set_particle(Vector2i pos, const Particle& particle)
+{
+    writable_particle(pos) = particle;
+    m_chunk_hashes.mark_dirty(pos);
+}
+
 void Simulation::update()
 {
+    PROFILE_ZONE("update");
+    // Cells may have been edited through particle_at() since the last update
+    rebuild_occupancy();
+
+    util::Rng* thread_rng = t_rng;
+    if (m_deterministic) {
+        m_rng.seed(tick_seed());
+        t_rng = &m_rng;
+    }
+    // Seeded per tick too, so a grid put back to a tick or loaded mid-run steps on the same way. Mixed once more so it
+    // doesn't draw the stream of the generator above.
+    m_wide_rng.seed(util::mix64(tick_seed()));
+    m_engine->step(*this, m_tick, m_worker_pool);
+    POP_LOG_TRACE("Stepped tick {} with the {} engine", m_tick, m_engine->name());
+    t_rng = thread_rng;
+
+    if (m_checksums) {
+        m_checksum = m_chunk_hashes.update(*this, m_worker_pool);
+    }
+    if (m_activity_counters != nullptr) {
+        m_activity_counters->merge();
+    }
+    m_tick++;
+}
+
+void Simulation::set_engine(std::unique_ptr<Engine> engine)
+{
+    m_engine = std::move(engine);
+}
+
+const Engine& Simulation::engine() const
+{
+    return *m_engine;
+}
+
+void Simulation::set_worker_pool(util::WorkerPool* pool)
+{
+    m_worker_pool = pool;
+}
+
+uint64_t Simulation::tick() const
+{
+    return m_tick;
+}
+
+void Simulation::set_tick(uint64_t tick)
+{
+    m_tick = tick;
+}
+
+void Simulation::set_seed(uint64_t seed)
+{
+    m_seed = seed;
+}
+
+uint64_t Simulation::seed() const
+{
+    return m_seed;
+}
+
+uint64_t Simulation::tick_seed() const
+{
+    return util::mix64(m_seed ^ util::mix64(m_tick));
+}
+
+void Simulation::set_deterministic(bool enabled)
+{
+    m_deterministic = enabled;
+}
+
+bool Simulation::deterministic() const
+{
+    return m_deterministic && m_engine->deterministic();
+}
+
+void Simulation::set_checksums(bool enabled)
+{
+    if (enabled && !m_checksums) {
+        m_chunk_hashes.mark_all_dirty();
+        m_checksum = m_chunk_hashes.update(*this, m_worker_pool);
+    }
+    m_checksums = enabled;
+    if (!enabled) {
+        m_checksum = 0;
+    }
+}
+
+uint64_t Simulation::checksum() const
+{
+    return m_checksum;
+}
+
+const ChunkHashes& Simulation::chunk_hashes() const
+{
+    return m_chunk_hashes;
+}
+
+void Simulation::step_serial()
+{
+    PROFILE_ZONE("step_serial");
     std::vector<int> rand_indices;
     rand_indices.reserve(m_width);
     for (int i = 0; i < m_width; i++) {
         rand_indices.push_back(i);
     }
 
+    const bool bitsliced = m_bitsliced_powders && m_bitsliced_supported;
+    std::fill(m_powder_segments.begin(), m_powder_segments.end(), 0);
+
     for (int y = m_height - 1; y >= 0; y--) {
-        simple_shuffle(rand_indices);
+        if (bitsliced) {
+            int powder_segment_count = 0;
+            for (int w = 0; w < m_occupancy.words_per_row(); w++) {
+                m_powder_segments[w] = is_powder_segment(m_occupancy, y, w);
+                if (m_powder_segments[w]) {
+                    step_powder_segment(*this, y, w, m_wide_rng);
+                    powder_segment_count++;
+                    if (ActivityCounts* activity = local_activity()) {
+                        activity->cells_visited += std::min(64, m_width - w * 64);
+                    }
+                }
+            }
+            if (powder_segment_count == m_occupancy.words_per_row()) {
+                continue;
+            }
+        }
+        // Drawn through random() so the order follows a generator set for the thread
+        for (int i = m_width - 1; i > 0; i--) {
+            std::swap(rand_indices[i], rand_indices[random(0, i)]);
+        }
         for (int x : rand_indices) {
-            std::invoke(m_elements.at(particle_at({ x, y }).element_id).update_func, *this, Vector2i { x, y });
+            if (m_powder_segments[x >> 6]) {
+                continue;
+            }
+            update_particle({ x, y });
         }
     }
 }
@@ -117,7 +584,7 @@ int Simulation::height() const
 
 ElementType Simulation::type_of(ElementId element_id) const
 {
-    return m_elements.at(element_id).type;
+    return static_cast<ElementType>(m_element_types.at(element_id));
 }
 
 ElementType Simulation::type_at(Vector2i pos) const
@@ -136,24 +603,63 @@ const Element Simulation::element_of(ElementId element_id) const
 
 void Simulation::change_element(Vector2i pos, ElementId element_id)
 {
-    m_space.at(index_at(pos)).element_id = element_id;
+    // Intents are counted once they are committed
+    if (m_intents != nullptr) {
+        m_intents->elements[index_at(pos)] = element_id;
+        return;
+    }
+    if (ActivityCounts* activity = local_activity()) {
+        activity->changes[id_at(pos) * activity->element_slots + element_id]++;
+        activity->cells_changed++;
+    }
+    m_chunk_hashes.mark_dirty(pos);
+    if (m_cell_claims != nullptr) {
+        Particle& particle = writable_particle(pos);
+        m_occupancy.set_shared(pos, type_of(particle.element_id), type_of(element_id));
+        particle.element_id = element_id;
+        return;
+    }
+    Particle& particle = writable_particle(pos);
+    m_occupancy.set(pos, type_of(particle.element_id), type_of(element_id));
+    particle.element_id = element_id;
 }
 
 void Simulation::change_element(Vector2i pos, const std::string& element_name)
 {
-    m_space.at(index_at(pos)).element_id = id_of(element_name);
+    change_element(pos, id_of(element_name));
 }
 
 void Simulation::clear_to(const std::string& element_name)
 {
     ElementId id = id_of(element_name);
-    for (int i = 0; i < m_space.size(); i++) {
-        m_space.at(i).element_id = id;
+    for (int c = 0; c < static_cast<int>(m_chunks.size()); c++) {
+        const Vector2i pos { c % m_chunks_x * k_chunk_size, c / m_chunks_x * k_chunk_size };
+        Particle* cells = &writable_particle(pos);
+        for (int i = 0; i < k_chunk_cells; i++) {
+            cells[i].element_id = id;
+        }
     }
+    m_chunk_hashes.mark_all_dirty();
+    rebuild_occupancy();
 }
 ElementId Simulation::id_at(Vector2i pos) const
 {
     return particle_at(pos).element_id;
 }
 
+GridSnapshot Simulation::snapshot()
+{
+    PROFILE_ZONE("snapshot");
+    GridSnapshot snapshot;
+    snapshot.m_width = m_width;
+    snapshot.m_height = m_height;
+    snapshot.m_chunks_x = m_chunks_x;
+    snapshot.m_tick = m_tick;
+    snapshot.m_chunks.assign(m_chunks.begin(), m_chunks.end());
+    for (int c = 0; c < static_cast<int>(m_chunks.size()); c++) {
+        m_chunk_states[c].store(ChunkState::e_shared, std::memory_order_relaxed);
+    }
+    return snapshot;
+}
+
 }
@@ -1,26 +1,112 @@
 #pragma once
 
+#include <atomic>
+#include <memory>
+#include <span>
 #include <string>
 #include <vector>
 
 #include <BS_thread_pool.hpp>
 #include <raylib-cpp.hpp>
 
+#include "activity.hpp"
+#include "checksum.hpp"
 #include "common.hpp"
 #include "elements.hpp"
+#include "engine.hpp"
+#include "intent_engine.hpp"
+#include "occupancy.hpp"
+#include "optimistic_engine.hpp"
+#include "rule_table.hpp"
+#include "util/chunk_pool.hpp"
+#include "util/rng.hpp"
+#include "util/worker_pool.hpp"
 
 namespace pop {
 
-void draw_sim(
-    raylib::Image& render_image, raylib::Image& gas_image, const Simulation& simulation, BS::thread_pool& pool);
+/**
+ * @brief Colors of every element by id, built once a frame and shared by every region drawn during it
+ */
+struct DrawPalette {
+    std::vector<raylib::Vector3> hsv_colors {};
+    std::vector<::Color> colors {};
+    std::vector<ElementType> types {};
+    // Salt is drawn with the shade of each particle as its value
+    ElementId salt = 0;
+};
 
-using ElementId = uint32_t;
+/**
+ * @brief Build the colors to draw the elements of a simulation with
+ */
+[[nodiscard]] DrawPalette draw_palette(const Simulation& simulation);
 
 struct Particle {
     ElementId element_id = 0;
     float shade = 1.0f;
 };
 
+/**
+ * @brief Cells of a simulation as they were when the snapshot was taken. Chunks are shared with the simulation, which
+ * only copies a chunk once it writes to it, so taking a snapshot copies no cells. A snapshot never changes and may be
+ * read on any thread while the simulation keeps updating.
+ */
+class GridSnapshot {
+public:
+    [[nodiscard]] int width() const;
+
+    [[nodiscard]] int height() const;
+
+    /**
+     * @brief Get the tick of the simulation when the snapshot was taken
+     */
+    [[nodiscard]] uint64_t tick() const;
+
+    [[nodiscard]] bool in_bounds(Vector2i pos) const;
+
+    [[nodiscard]] const Particle& particle_at(Vector2i pos) const;
+
+    [[nodiscard]] ElementId id_at(Vector2i pos) const;
+
+    /**
+     * @brief Get the cells of a k_chunk_size square chunk, k_chunk_size rows of k_chunk_size cells. In chunks cut by
+     * the edge of the grid, cells past the edge hold nothing to read.
+     * @param chunk - Position of the chunk in chunks
+     */
+    [[nodiscard]] std::span<const Particle> chunk(Vector2i chunk) const;
+
+    /**
+     * @brief Let go of a chunk that won't be read again, so the simulation can write it without copying it first
+     */
+    void release_chunk(Vector2i chunk);
+
+private:
+    friend class Simulation;
+
+    int m_width = 0;
+    int m_height = 0;
+    int m_chunks_x = 0;
+    uint64_t m_tick = 0;
+    std::vector<std::shared_ptr<const Particle>> m_chunks {};
+};
+
+/**
+ * @brief Draw a rectangle of a snapshot into RGBA images, gases into one and everything else into the other. Only
+ * pixels that differ from what the images hold are written.
+ * @return - True if any pixel changed
+ */
+bool draw_region(raylib::Image& render_image, raylib::Image& gas_image, const GridSnapshot& snapshot,
+    const DrawPalette& palette, Vector2i start, Vector2i end);
+
+/**
+ * @brief Source of the random values drawn by kernels in place of the default generator
+ */
+class RandomSource {
+public:
+    virtual ~RandomSource() = default;
+
+    virtual int next(int min, int max) = 0;
+};
+
 class Simulation {
 public:
     Simulation(int width, int height);
@@ -29,6 +115,164 @@ public:
 
     void update();
 
+    /**
+     * @brief Replace the engine update() steps with, the serial engine is used until one is set
+     */
+    void set_engine(std::unique_ptr<Engine> engine);
+
+    [[nodiscard]] const Engine& engine() const;
+
+    /**
+     * @brief Step every cell in place, rows from the bottom up and cells of a row in a shuffled order. Used by the
+     * serial engine.
+     */
+    void step_serial();
+
+    /**
+     * @brief Set the pool parallel engines run on, nullptr to run them on the calling thread
+     */
+    void set_worker_pool(util::WorkerPool* pool);
+
+    /**
+     * @brief Get the number of updates done so far
+     */
+    [[nodiscard]] uint64_t tick() const;
+
+    /**
+     * @brief Set the number of updates done so far, after the grid was put back to how it was at that tick. Must be
+     * called between updates.
+     */
+    void set_tick(uint64_t tick);
+
+    /**
+     * @brief Seed every generator the simulation owns
+     */
+    void set_seed(uint64_t seed);
+
+    [[nodiscard]] uint64_t seed() const;
+
+    /**
+     * @brief Get the random seed of the current tick, mixed from the seed and the tick. Engines seed their generators
+     * from it.
+     */
+    [[nodiscard]] uint64_t tick_seed() const;
+
+    /**
+     * @brief Draw kernel randomness on the calling thread from a generator seeded per tick instead of the default one.
+     * With a deterministic engine, the same seed and the same edits between updates then step to bit-identical grids
+     * for any number of threads.
+     */
+    void set_deterministic(bool enabled);
+
+    /**
+     * @brief Whether deterministic mode is on and the current engine is deterministic
+     */
+    [[nodiscard]] bool deterministic() const;
+
+    /**
+     * @brief Keep per-chunk hashes of the grid and combine them into a checksum after every update
+     */
+    void set_checksums(bool enabled);
+
+    /**
+     * @brief Get the checksum of the grid as of the last update, 0 if checksums are off
+     */
+    [[nodiscard]] uint64_t checksum() const;
+
+    [[nodiscard]] const ChunkHashes& chunk_hashes() const;
+
+    /**
+     * @brief Step row segments holding only powders, air and walls with the bitsliced fast path instead of the
+     * per-cell kernels. Only takes effect if every air, wall and powder element is marked as bitsliced, and only in
+     * step_serial(): segments write into the row below without claiming cells and draw from one generator the
+     * simulation owns, so the parallel engines always run the kernels.
+     */
+    void set_bitsliced_powders(bool enabled);
+
+    [[nodiscard]] bool bitsliced_powders() const;
+
+    /**
+     * @brief Compile the rule tables of every element whose kernel can be expressed as one
+     * @return - Number of elements with a rule table
+     */
+    int compile_rule_tables(BS::thread_pool& pool);
+
+    /**
+     * @brief Switch an element between its kernel and its rule table
+     * @return - False if the element has no rule table
+     */
+    bool set_table_driven(ElementId element_id, bool enabled);
+
+    [[nodiscard]] bool table_driven(ElementId element_id) const;
+
+    [[nodiscard]] const RuleTable* rule_table(ElementId element_id) const;
+
+    /**
+     * @brief Draw a random value for a kernel
+     * @return - Value between min and max, both inclusive
+     */
+    int random(int min, int max);
+
+    /**
+     * @brief Replace the generator kernels draw from, nullptr to go back to the default
+     */
+    void set_random_source(RandomSource* source);
+
+    /**
+     * @brief Set the generator kernels draw from on the calling thread, nullptr to go back to the default. A random
+     * source set on the simulation takes precedence.
+     */
+    static void set_thread_rng(util::Rng* rng);
+
+    /**
+     * @brief Record swaps and element changes into intents instead of applying them, nullptr to apply them again
+     */
+    void set_intents(Intents* intents);
+
+    /**
+     * @brief Claim both cells of every swap first and skip the swap if either claim fails, nullptr to stop claiming.
+     * Air a swap leaves behind is released again. While set, swaps and element changes update the occupancy planes
+     * with atomic operations, so threads may step cells that share occupancy words.
+     */
+    void set_cell_claims(CellClaims* claims);
+
+    /**
+     * @brief Start or stop counting what kernels do every tick. Counting starts over when elements are pushed.
+     */
+    void set_activity_counters(bool enabled);
+
+    /**
+     * @brief Get what kernels did during the last tick
+     * @return - The counts, or nullptr if activity isn't counted
+     */
+    [[nodiscard]] const ActivityCounts* activity() const;
+
+    /**
+     * @brief Get the counts of the calling thread for the current tick, for engines that write cells themselves
+     * @return - The counts, or nullptr if activity isn't counted
+     */
+    [[nodiscard]] ActivityCounts* local_activity();
+
+    /**
+     * @brief Run the rule table or kernel of the particle at a position
+     */
+    void update_particle(Vector2i pos);
+
+    /**
+     * @brief Rebuild the occupancy planes after cells were written through particle_at()
+     */
+    void rebuild_occupancy();
+
+    /**
+     * @brief Mark every chunk changed after cells were written through particle_at(), so checksums rehash them
+     */
+    void mark_all_changed();
+
+    /**
+     * @brief Write a cell between updates and mark its chunk changed, so checksums rehash it
+     */
+    void set_particle(Vector2i pos, const Particle& particle);
+
     void change_element(Vector2i pos, ElementId element_id);
 
     void change_element(Vector2i pos, const std::string& element_name);
@@ -45,6 +289,10 @@ public:
 
     [[nodiscard]] ElementId id_of(const std::string& element_name) const;
 
+    [[nodiscard]] bool has_element(const std::string& element_name) const;
+
+    [[nodiscard]] int element_count() const;
+
     [[nodiscard]] ElementId id_at(Vector2i pos) const;
 
     [[nodiscard]] ElementType type_of(ElementId element_id) const;
@@ -57,19 +305,80 @@ public:
 
     [[nodiscard]] bool in_bounds(Vector2i pos) const;
 
+    /**
+     * @brief Get a cell. Cells of a row are contiguous up to the end of their k_chunk_size chunk.
+     */
     [[nodiscard]] const Particle& particle_at(Vector2i pos) const;
 
+    /**
+     * @brief Get a cell to write, copying its chunk first if a snapshot shares it. Cells of a row are contiguous up to
+     * the end of their k_chunk_size chunk.
+     */
     [[nodiscard]] Particle& particle_at(Vector2i pos);
 
+    [[nodiscard]] uint8_t neighbor_mask(Vector2i pos, ElementType type) const;
+
+    [[nodiscard]] const Occupancy& occupancy() const;
+
     void swap(Vector2i pos1, Vector2i pos2);
 
+    /**
+     * @brief Take a snapshot of the grid, which costs a reference per chunk. Chunks are copied the first time they are
+     * written afterwards, while a snapshot still holds them. Must not be called during an update.
+     */
+    [[nodiscard]] GridSnapshot snapshot();
+
 private:
+    enum class ChunkState : uint8_t {
+        e_owned,
+        e_shared,
+        e_copying,
+    };
+
     const int m_width;
     const int m_height;
     ElementId m_element_id_count = 1;
     std::unordered_map<ElementId, Element> m_elements {};
     std::unordered_map<std::string, ElementId> m_element_name_map {};
-    std::vector<Particle> m_space {};
+    // Cells are stored in k_chunk_size square chunks of rows, which snapshots share until they are written
+    std::shared_ptr<util::ChunkPool> m_chunk_pool;
+    const int m_chunks_x;
+    std::vector<std::shared_ptr<Particle>> m_chunks {};
+    // Cells of every chunk and whether a snapshot may share it, read by every access so kept apart from m_chunks
+    std::unique_ptr<std::atomic<Particle*>[]> m_chunk_cells;
+    std::unique_ptr<std::atomic<ChunkState>[]> m_chunk_states;
+    std::vector<uint8_t> m_element_types {};
+    Occupancy m_occupancy;
+    std::vector<uint8_t> m_row_types {};
+    bool m_bitsliced_powders = false;
+    bool m_bitsliced_supported = true;
+    std::vector<uint8_t> m_powder_segments {};
+    util::WideRng m_wide_rng {};
+    std::vector<std::shared_ptr<const RuleTable>> m_rule_tables {};
+    std::vector<uint8_t> m_table_driven {};
+    RandomSource* m_random_source = nullptr;
+    std::unique_ptr<Engine> m_engine;
+    util::WorkerPool* m_worker_pool = nullptr;
+    uint64_t m_tick = 0;
+    uint64_t m_seed = 0;
+    bool m_deterministic = false;
+    util::Rng m_rng {};
+    bool m_checksums = false;
+    uint64_t m_checksum = 0;
+    ChunkHashes m_chunk_hashes;
+    Intents* m_intents = nullptr;
+    CellClaims* m_cell_claims = nullptr;
+    std::unique_ptr<ActivityCounters> m_activity_counters {};
+
+    [[nodiscard]] int chunk_at(Vector2i pos) const;
+
+    [[nodiscard]] Particle& writable_particle(Vector2i pos);
+
+    /**
+     * @brief Copy a chunk a snapshot shares before it is written. Safe to call from several threads for one chunk,
+     * one copies it and the others wait.
+     */
+    void unshare(int chunk);
 };
 
 }
\ No newline at end of file
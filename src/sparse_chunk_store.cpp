@@ -0,0 +1,231 @@
+#include "sparse_chunk_store.hpp"
+
+#include <algorithm>
+#include <bit>
+
+#include "scene.hpp"
+#include "util/logger.hpp"
+
+namespace pop {
+
+inline constexpr int k_chunk_cells = k_chunk_size * k_chunk_size;
+// Compressed chunks must take at most this part of their cells to be worth decompressing
+inline constexpr std::size_t k_min_compression_ratio = 2;
+
+// Decompressing a chunk on read reuses the buffers of the thread
+static thread_local ChunkCodecScratch t_scratch {};
+
+static bool same_particle(const Particle& a, const Particle& b)
+{
+    return a.element_id == b.element_id && std::bit_cast<uint32_t>(a.shade) == std::bit_cast<uint32_t>(b.shade);
+}
+
+static bool all_same(std::span<const Particle> cells, const Particle& particle)
+{
+    return std::all_of(cells.begin(), cells.end(), [&](const Particle& cell) { return same_particle(cell, particle); });
+}
+
+static void unpack(
+    const std::vector<uint8_t>& packed, Particle uniform, std::span<Particle> cells, ChunkCodecScratch& scratch)
+{
+    if (packed.empty()) {
+        std::fill(cells.begin(), cells.end(), uniform);
+        return;
+    }
+    decode_chunk(packed, true, cells, scratch);
+}
+
+SparseChunkStore::SparseChunkStore(Particle fill, std::optional<std::chrono::milliseconds> compress_after)
+    : m_fill(fill)
+    , m_pool(sizeof(Particle) * k_chunk_cells)
+{
+    if (compress_after.has_value()) {
+        m_thread = std::thread([this, interval = *compress_after] { run(interval); });
+    }
+}
+
+SparseChunkStore::~SparseChunkStore()
+{
+    if (m_thread.joinable()) {
+        {
+            std::lock_guard lock(m_stop_mutex);
+            m_stopping = true;
+        }
+        m_stop_condition.notify_one();
+        m_thread.join();
+    }
+    m_chunks.for_each([&](int, int, const Chunk& chunk) {
+        if (chunk.cells != nullptr) {
+            m_pool.deallocate(const_cast<Particle*>(chunk.cells));
+        }
+    });
+}
+
+void SparseChunkStore::read(Vector2i chunk, std::span<Particle> cells)
+{
+    std::shared_lock lock(m_mutex);
+    const Chunk* stored = m_chunks.find(chunk.x, chunk.y);
+    if (stored == nullptr) {
+        std::fill(cells.begin(), cells.end(), m_fill);
+    }
+    else if (stored->cells != nullptr) {
+        std::copy_n(stored->cells, k_chunk_cells, cells.begin());
+    }
+    else {
+        // Decompressed straight into the cells rather than stored, the chunk is stored uncompressed again once written
+        unpack(stored->packed, stored->uniform, cells, t_scratch);
+    }
+}
+
+void SparseChunkStore::write(Vector2i chunk, std::span<const Particle> cells)
+{
+    const bool fill = all_same(cells, m_fill);
+    const bool uniform = fill || all_same(cells, cells.front());
+    Particle* block = nullptr;
+    if (!uniform) {
+        block = static_cast<Particle*>(m_pool.allocate());
+        std::copy_n(cells.begin(), k_chunk_cells, block);
+    }
+
+    // Freed once the lock is released
+    Chunk replaced;
+    {
+        std::unique_lock lock(m_mutex);
+        Chunk* stored = m_chunks.find(chunk.x, chunk.y);
+        if (stored == nullptr && fill) {
+            return;
+        }
+        if (stored != nullptr) {
+            replaced = std::move(*stored);
+            if (replaced.cells == nullptr) {
+                m_packed_bytes -= replaced.packed.capacity();
+                m_compressed_count--;
+            }
+        }
+        m_generation++;
+        if (fill) {
+            m_chunks.erase(chunk.x, chunk.y);
+        }
+        else {
+            // Uniform chunks are stored compressed right away
+            m_chunks.insert(chunk.x, chunk.y,
+                Chunk { .cells = block,
+                    .uniform = cells.front(),
+                    .written = m_generation,
+                    .written_pass = m_pass.load(std::memory_order_relaxed) });
+            if (uniform) {
+                m_compressed_count++;
+            }
+        }
+    }
+    if (replaced.cells != nullptr) {
+        m_pool.deallocate(const_cast<Particle*>(replaced.cells));
+    }
+}
+
+void SparseChunkStore::flush()
+{
+}
+
+std::optional<Vector2i> SparseChunkStore::size() const
+{
+    return std::nullopt;
+}
+
+std::size_t SparseChunkStore::compress_idle()
+{
+    struct Candidate {
+        Vector2i chunk;
+        uint64_t written;
+    };
+
+    std::lock_guard compress_lock(m_compress_mutex);
+    // Chunks written from here on are stamped with the next pass and left for the call after
+    const uint64_t pass = m_pass.fetch_add(1, std::memory_order_relaxed);
+    std::vector<Candidate> candidates;
+    {
+        std::shared_lock lock(m_mutex);
+        m_chunks.for_each([&](int x, int y, const Chunk& chunk) {
+            if (chunk.cells != nullptr && !chunk.incompressible && chunk.written_pass < pass) {
+                candidates.push_back({ .chunk = { x, y }, .written = chunk.written });
+            }
+        });
+    }
+
+    std::size_t compressed = 0;
+    ChunkCodecScratch scratch;
+    for (const Candidate& candidate : candidates) {
+        std::vector<uint8_t> packed;
+        {
+            // Blocks aren't written once stored, so the chunk is compressed while writes to others go ahead
+            std::shared_lock lock(m_mutex);
+            const Chunk* stored = m_chunks.find(candidate.chunk.x, candidate.chunk.y);
+            if (stored == nullptr || stored->written != candidate.written) {
+                continue;
+            }
+            encode_chunk({ stored->cells, k_chunk_cells }, true, packed, scratch);
+        }
+        packed.shrink_to_fit();
+        const bool worth_it = packed.size() * k_min_compression_ratio <= sizeof(Particle) * k_chunk_cells;
+
+        const Particle* block;
+        {
+            std::unique_lock lock(m_mutex);
+            Chunk* stored = m_chunks.find(candidate.chunk.x, candidate.chunk.y);
+            if (stored == nullptr || stored->written != candidate.written) {
+                continue;
+            }
+            if (!worth_it) {
+                stored->incompressible = true;
+                continue;
+            }
+            block = stored->cells;
+            stored->cells = nullptr;
+            stored->packed = std::move(packed);
+            m_packed_bytes += stored->packed.capacity();
+            m_compressed_count++;
+            m_generation++;
+        }
+        m_pool.deallocate(const_cast<Particle*>(block));
+        compressed++;
+    }
+    m_pool.trim();
+    return compressed;
+}
+
+void SparseChunkStore::run(std::chrono::milliseconds compress_after)
+{
+    std::unique_lock lock(m_stop_mutex);
+    while (!m_stop_condition.wait_for(lock, compress_after, [&] { return m_stopping; })) {
+        lock.unlock();
+        const std::size_t compressed = compress_idle();
+        if (compressed > 0) {
+            POP_LOG_DEBUG("Compressed {} idle world chunks", compressed);
+        }
+        lock.lock();
+    }
+}
+
+std::size_t SparseChunkStore::chunk_count() const
+{
+    std::shared_lock lock(m_mutex);
+    return m_chunks.size();
+}
+
+std::size_t SparseChunkStore::compressed_count() const
+{
+    std::shared_lock lock(m_mutex);
+    return m_compressed_count;
+}
+
+std::size_t SparseChunkStore::memory_bytes() const
+{
+    std::size_t packed_bytes;
+    {
+        std::shared_lock lock(m_mutex);
+        packed_bytes = m_packed_bytes;
+    }
+    return m_pool.resident_bytes() + packed_bytes;
+}
+
+}
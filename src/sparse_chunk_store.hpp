@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "chunk_store.hpp"
+#include "simulation.hpp"
+#include "util/chunk_pool.hpp"
+#include "util/coord_map.hpp"
+
+namespace pop {
+
+/**
+ * @brief Unbounded world kept in memory. A chunk is only stored while it holds something other than the fill element,
+ * in a block from a pool, and its block goes back to the pool once it is written full of fill again, so memory
+ * follows what the world holds rather than how far it reaches. Chunks are found through a hash map of their
+ * coordinates. The world view reads a chunk when it pages into the window and writes it when it pages out, so chunks
+ * are only stored once the window moves off them, not while particles move through the window.
+ *
+ * Chunks that go a while without being written are compressed on a background thread, either to a tag holding their
+ * only cell or to the palette and runs scenes store chunks in, and their blocks are given back to the system. Reading
+ * a compressed chunk decompresses it into the cells read, and writing it stores it uncompressed again until it goes
+ * idle. Blocks are never written once stored, a write stores a new block in place of the old, so the background thread
+ * compresses a chunk without holding up anything but writes swapping in their block.
+ */
+class SparseChunkStore final : public ChunkStore {
+public:
+    /**
+     * @brief Construct SparseChunkStore
+     * @param fill - Cell every chunk is full of until written
+     * @param compress_after - Interval the background thread compresses chunks at, a chunk is compressed once it goes a
+     * whole interval without being written. nullopt to only compress when compress_idle() is called.
+     */
+    explicit SparseChunkStore(
+        Particle fill, std::optional<std::chrono::milliseconds> compress_after = std::chrono::milliseconds(1000));
+
+    /**
+     * @brief Stop the background thread and free every chunk
+     */
+    ~SparseChunkStore() override;
+
+    SparseChunkStore(const SparseChunkStore&) = delete;
+    SparseChunkStore& operator=(const SparseChunkStore&) = delete;
+
+    void read(Vector2i chunk, std::span<Particle> cells) override;
+
+    void write(Vector2i chunk, std::span<const Particle> cells) override;
+
+    /**
+     * @brief Nothing to do, chunks only live in memory
+     */
+    void flush() override;
+
+    /**
+     * @brief Nothing, the world is unbounded
+     */
+    [[nodiscard]] std::optional<Vector2i> size() const override;
+
+    /**
+     * @brief Compress every chunk not written since the last call and give the freed blocks back to the system, as
+     * the background thread does
+     * @return - Number of chunks compressed
+     */
+    std::size_t compress_idle();
+
+    /**
+     * @brief Get the number of chunks stored
+     */
+    [[nodiscard]] std::size_t chunk_count() const;
+
+    /**
+     * @brief Get the number of chunks stored compressed
+     */
+    [[nodiscard]] std::size_t compressed_count() const;
+
+    /**
+     * @brief Get the memory taken by chunks, blocks not given back to the system and compressed data, in bytes
+     */
+    [[nodiscard]] std::size_t memory_bytes() const;
+
+private:
+    struct Chunk {
+        // Uncompressed cells, or nullptr if the chunk is compressed
+        const Particle* cells = nullptr;
+        // Compressed cells, or empty if every cell is uniform
+        std::vector<uint8_t> packed {};
+        Particle uniform {};
+        // Generation of the write that stored the chunk
+        uint64_t written = 0;
+        // Pass of compress_idle() the chunk was written during
+        uint64_t written_pass = 0;
+        // Whether compressing would not have saved enough to be worth it
+        bool incompressible = false;
+    };
+
+    const Particle m_fill;
+    util::ChunkPool m_pool;
+    mutable std::shared_mutex m_mutex {};
+    util::CoordMap<Chunk> m_chunks {};
+    // Bumped whenever a chunk is added, replaced, compressed or removed, so compressing can tell a chunk was written
+    // since it was read. Guarded by m_mutex.
+    uint64_t m_generation = 0;
+    std::size_t m_packed_bytes = 0;
+    std::size_t m_compressed_count = 0;
+    std::atomic<uint64_t> m_pass { 1 };
+    std::mutex m_compress_mutex {};
+    std::mutex m_stop_mutex {};
+    std::condition_variable m_stop_condition {};
+    bool m_stopping = false;
+    std::thread m_thread {};
+
+    void run(std::chrono::milliseconds compress_after);
+};
+
+}
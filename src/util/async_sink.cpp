@@ -0,0 +1,154 @@
+#include "async_sink.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+namespace util {
+
+AsyncSink::AsyncSink(std::vector<spdlog::sink_ptr> sinks, std::size_t capacity)
+    : m_sinks(std::move(sinks))
+    , m_slots(std::make_unique<Slot[]>(capacity))
+    , m_mask(capacity - 1)
+{
+    if (!std::has_single_bit(capacity)) {
+        throw std::invalid_argument("Async sink capacity must be a power of two");
+    }
+    for (std::size_t i = 0; i < capacity; i++) {
+        m_slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    m_thread = std::thread([this] { run(); });
+}
+
+AsyncSink::~AsyncSink()
+{
+    m_stopping.store(true, std::memory_order_release);
+    m_thread.join();
+    drain();
+    for (const spdlog::sink_ptr& sink : m_sinks) {
+        sink->flush();
+    }
+}
+
+void AsyncSink::log(const spdlog::details::log_msg& msg)
+{
+    uint64_t position = m_tail.load(std::memory_order_relaxed);
+    Slot* slot;
+    while (true) {
+        slot = &m_slots[position & m_mask];
+        const uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+        const auto difference = static_cast<int64_t>(sequence - position);
+        if (difference == 0) {
+            if (m_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+        else if (difference < 0) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        else {
+            position = m_tail.load(std::memory_order_relaxed);
+        }
+    }
+
+    Entry& entry = slot->entry;
+    entry.time = msg.time;
+    entry.thread_id = msg.thread_id;
+    entry.level = msg.level;
+    entry.name_size = static_cast<uint16_t>(std::min(msg.logger_name.size(), k_name_size));
+    std::memcpy(entry.name.data(), msg.logger_name.data(), entry.name_size);
+    entry.payload_size = static_cast<uint16_t>(std::min(msg.payload.size(), k_payload_size));
+    std::memcpy(entry.payload.data(), msg.payload.data(), entry.payload_size);
+    slot->sequence.store(position + 1, std::memory_order_release);
+}
+
+std::size_t AsyncSink::drain()
+{
+    std::size_t count = 0;
+    uint64_t position = m_head.load(std::memory_order_relaxed);
+    while (true) {
+        Slot& slot = m_slots[position & m_mask];
+        if (slot.sequence.load(std::memory_order_acquire) != position + 1) {
+            break;
+        }
+        const Entry& entry = slot.entry;
+        spdlog::details::log_msg msg(entry.time, spdlog::source_loc {},
+            spdlog::string_view_t(entry.name.data(), entry.name_size), entry.level,
+            spdlog::string_view_t(entry.payload.data(), entry.payload_size));
+        msg.thread_id = entry.thread_id;
+        for (const spdlog::sink_ptr& sink : m_sinks) {
+            if (sink->should_log(msg.level)) {
+                sink->log(msg);
+            }
+        }
+        slot.sequence.store(position + m_mask + 1, std::memory_order_release);
+        position++;
+        m_head.store(position, std::memory_order_release);
+        count++;
+    }
+    return count;
+}
+
+void AsyncSink::run()
+{
+    bool unflushed = false;
+    uint64_t reported_dropped = 0;
+    while (!m_stopping.load(std::memory_order_acquire)) {
+        if (drain() > 0) {
+            unflushed = true;
+            continue;
+        }
+        const uint64_t dropped = m_dropped.load(std::memory_order_relaxed);
+        if (dropped != reported_dropped) {
+            const std::string text = "Dropped " + std::to_string(dropped - reported_dropped) + " log messages";
+            const spdlog::details::log_msg msg("async", spdlog::level::warn, text);
+            for (const spdlog::sink_ptr& sink : m_sinks) {
+                sink->log(msg);
+            }
+            reported_dropped = dropped;
+            unflushed = true;
+        }
+        if (unflushed) {
+            for (const spdlog::sink_ptr& sink : m_sinks) {
+                sink->flush();
+            }
+            unflushed = false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+}
+
+void AsyncSink::flush()
+{
+    const uint64_t target = m_tail.load(std::memory_order_acquire);
+    while (m_head.load(std::memory_order_acquire) < target) {
+        std::this_thread::yield();
+    }
+    for (const spdlog::sink_ptr& sink : m_sinks) {
+        sink->flush();
+    }
+}
+
+void AsyncSink::set_pattern(const std::string& pattern)
+{
+    for (const spdlog::sink_ptr& sink : m_sinks) {
+        sink->set_pattern(pattern);
+    }
+}
+
+void AsyncSink::set_formatter(std::unique_ptr<spdlog::formatter> sink_formatter)
+{
+    for (const spdlog::sink_ptr& sink : m_sinks) {
+        sink->set_formatter(sink_formatter->clone());
+    }
+}
+
+uint64_t AsyncSink::dropped() const
+{
+    return m_dropped.load(std::memory_order_relaxed);
+}
+
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "spdlog/sinks/sink.h"
+
+namespace util {
+
+/**
+ * @brief Sink that hands messages to other sinks on a background thread. Logging threads copy a formatted message
+ * into a bounded lock-free queue and return, the background thread writes them out and flushes once the queue runs
+ * dry. Messages that arrive while the queue is full are dropped and counted rather than blocking the thread logging
+ * them, and messages longer than a queue slot are cut short.
+ */
+class AsyncSink final : public spdlog::sinks::sink {
+public:
+    /**
+     * @brief Construct AsyncSink and start its background thread
+     * @param capacity - Number of messages the queue holds, a power of two
+     */
+    explicit AsyncSink(std::vector<spdlog::sink_ptr> sinks, std::size_t capacity = 4096);
+
+    /**
+     * @brief Write out everything still queued and stop the background thread
+     */
+    ~AsyncSink() override;
+
+    AsyncSink(const AsyncSink&) = delete;
+    AsyncSink& operator=(const AsyncSink&) = delete;
+
+    void log(const spdlog::details::log_msg& msg) override;
+
+    /**
+     * @brief Wait for everything queued so far to be written, then flush the sinks
+     */
+    void flush() override;
+
+    void set_pattern(const std::string& pattern) override;
+
+    void set_formatter(std::unique_ptr<spdlog::formatter> sink_formatter) override;
+
+    /**
+     * @brief Get the number of messages dropped so far because the queue was full
+     */
+    [[nodiscard]] uint64_t dropped() const;
+
+private:
+    static constexpr std::size_t k_payload_size = 480;
+    static constexpr std::size_t k_name_size = 16;
+
+    struct Entry {
+        spdlog::log_clock::time_point time;
+        std::size_t thread_id;
+        spdlog::level::level_enum level;
+        uint16_t name_size;
+        uint16_t payload_size;
+        std::array<char, k_name_size> name;
+        std::array<char, k_payload_size> payload;
+    };
+
+    // A slot is free to write when its sequence equals the position writing it, and holds a message to read when its
+    // sequence is one past the position
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> sequence;
+        Entry entry;
+    };
+
+    std::vector<spdlog::sink_ptr> m_sinks;
+    std::unique_ptr<Slot[]> m_slots;
+    const std::size_t m_mask;
+    alignas(64) std::atomic<uint64_t> m_tail { 0 };
+    alignas(64) std::atomic<uint64_t> m_head { 0 };
+    std::atomic<uint64_t> m_dropped { 0 };
+    std::atomic<bool> m_stopping { false };
+    std::thread m_thread;
+
+    /**
+     * @brief Write out every queued message
+     * @return - Number of messages written
+     */
+    std::size_t drain();
+
+    void run();
+};
+
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace util {
+
+inline void put_u16(std::vector<uint8_t>& out, uint16_t value)
+{
+    out.push_back(static_cast<uint8_t>(value));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+}
+
+inline void put_u32(std::vector<uint8_t>& out, uint32_t value)
+{
+    for (int i = 0; i < 4; i++) {
+        out.push_back(static_cast<uint8_t>(value >> (i * 8)));
+    }
+}
+
+inline void put_u64(std::vector<uint8_t>& out, uint64_t value)
+{
+    put_u32(out, static_cast<uint32_t>(value));
+    put_u32(out, static_cast<uint32_t>(value >> 32));
+}
+
+/**
+ * @brief Write a value in 7 bit groups, low first, with the top bit of a byte set if more follow
+ */
+inline void put_varint(std::vector<uint8_t>& out, uint32_t value)
+{
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+/**
+ * @brief Map a signed value to an unsigned one small values of either sign stay small in, for put_varint()
+ */
+inline uint32_t zigzag(int32_t value)
+{
+    return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+}
+
+inline int32_t unzigzag(uint32_t value)
+{
+    return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+}
+
+/**
+ * @brief Little-endian reads over binary data that throw once they run past the end
+ */
+class ByteReader {
+public:
+    /**
+     * @param what - What the data holds, for error messages
+     */
+    ByteReader(std::span<const uint8_t> data, std::string what)
+        : m_data(data)
+        , m_what(std::move(what))
+    {
+    }
+
+    std::span<const uint8_t> bytes(std::size_t count)
+    {
+        if (count > m_data.size() - m_position) {
+            throw std::runtime_error(m_what + " ends unexpectedly");
+        }
+        const std::span<const uint8_t> result = m_data.subspan(m_position, count);
+        m_position += count;
+        return result;
+    }
+
+    uint8_t u8()
+    {
+        return bytes(1)[0];
+    }
+
+    uint16_t u16()
+    {
+        const std::span<const uint8_t> value = bytes(2);
+        return static_cast<uint16_t>(value[0] | value[1] << 8);
+    }
+
+    uint32_t u32()
+    {
+        const std::span<const uint8_t> value = bytes(4);
+        return static_cast<uint32_t>(value[0]) | static_cast<uint32_t>(value[1]) << 8
+            | static_cast<uint32_t>(value[2]) << 16 | static_cast<uint32_t>(value[3]) << 24;
+    }
+
+    uint64_t u64()
+    {
+        const uint64_t low = u32();
+        return low | static_cast<uint64_t>(u32()) << 32;
+    }
+
+    uint32_t varint()
+    {
+        uint32_t value = 0;
+        for (int shift = 0; shift < 35 && m_position < m_data.size(); shift += 7) {
+            const uint8_t byte = m_data[m_position++];
+            value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+        throw std::runtime_error(m_what + " holds a malformed number");
+    }
+
+    [[nodiscard]] bool at_end() const
+    {
+        return m_position == m_data.size();
+    }
+
+private:
+    std::span<const uint8_t> m_data;
+    std::string m_what;
+    std::size_t m_position = 0;
+};
+
+}
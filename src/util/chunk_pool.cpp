@@ -0,0 +1,165 @@
+#include "chunk_pool.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace util {
+
+inline constexpr std::size_t k_slab_size = std::size_t { 2 } << 20;
+
+ChunkPool::ChunkPool(std::size_t block_size)
+    // Blocks are kept on 64 byte boundaries so they don't share cache lines
+    : m_block_size((std::max(block_size, sizeof(FreeBlock)) + 63) / 64 * 64)
+{
+    if (m_block_size > k_slab_size) {
+        throw std::invalid_argument("Chunk pool blocks must fit in a slab");
+    }
+}
+
+ChunkPool::~ChunkPool()
+{
+    for (void* slab : m_slabs) {
+#if defined(__linux__)
+        munmap(slab, k_slab_size);
+#else
+        ::operator delete(slab, std::align_val_t(k_slab_size));
+#endif
+    }
+}
+
+void* ChunkPool::allocate()
+{
+    std::lock_guard lock(m_mutex);
+    if (m_free == nullptr && m_trimmed == nullptr) {
+        grow();
+    }
+    FreeBlock* block;
+    if (m_free != nullptr) {
+        block = m_free;
+        m_free = block->next;
+    }
+    else {
+        block = m_trimmed;
+        m_trimmed = block->next;
+        m_trimmed_bytes -= trimmable_pages(block).second;
+    }
+    m_used++;
+    return block;
+}
+
+void ChunkPool::deallocate(void* block)
+{
+    std::lock_guard lock(m_mutex);
+    auto* free_block = static_cast<FreeBlock*>(block);
+    free_block->next = m_free;
+    m_free = free_block;
+    m_used--;
+}
+
+std::size_t ChunkPool::block_size() const
+{
+    return m_block_size;
+}
+
+std::size_t ChunkPool::used_blocks() const
+{
+    std::lock_guard lock(m_mutex);
+    return m_used;
+}
+
+std::size_t ChunkPool::reserved_bytes() const
+{
+    std::lock_guard lock(m_mutex);
+    return m_slabs.size() * k_slab_size;
+}
+
+std::size_t ChunkPool::resident_bytes() const
+{
+    std::lock_guard lock(m_mutex);
+    return m_slabs.size() * k_slab_size - m_trimmed_bytes;
+}
+
+std::pair<std::byte*, std::size_t> ChunkPool::trimmable_pages([[maybe_unused]] FreeBlock* block) const
+{
+#if defined(__linux__)
+    static const auto page_size = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    const auto begin = reinterpret_cast<uintptr_t>(block + 1);
+    const uintptr_t end = reinterpret_cast<uintptr_t>(block) + m_block_size;
+    const uintptr_t first = (begin + page_size - 1) & ~(page_size - 1);
+    const uintptr_t last = end & ~(page_size - 1);
+    if (first >= last) {
+        return { nullptr, 0 };
+    }
+    return { reinterpret_cast<std::byte*>(first), last - first };
+#else
+    return { nullptr, 0 };
+#endif
+}
+
+void ChunkPool::trim()
+{
+    // Taken off the free list so pages are given back without holding the lock
+    FreeBlock* blocks;
+    {
+        std::lock_guard lock(m_mutex);
+        blocks = m_free;
+        m_free = nullptr;
+    }
+    if (blocks == nullptr) {
+        return;
+    }
+    FreeBlock* last = blocks;
+    std::size_t trimmed_bytes = 0;
+    for (FreeBlock* block = blocks; block != nullptr; block = block->next) {
+        const auto [pages, size] = trimmable_pages(block);
+#if defined(__linux__)
+        if (size > 0) {
+            madvise(pages, size, MADV_DONTNEED);
+        }
+#endif
+        trimmed_bytes += size;
+        last = block;
+    }
+    std::lock_guard lock(m_mutex);
+    last->next = m_trimmed;
+    m_trimmed = blocks;
+    m_trimmed_bytes += trimmed_bytes;
+}
+
+void ChunkPool::grow()
+{
+#if defined(__linux__)
+    // Map twice the size and trim it down to an aligned slab, which a huge page can back
+    void* mapping = mmap(nullptr, k_slab_size * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    const auto address = reinterpret_cast<uintptr_t>(mapping);
+    const uintptr_t aligned = (address + k_slab_size - 1) & ~(k_slab_size - 1);
+    if (aligned > address) {
+        munmap(mapping, aligned - address);
+    }
+    munmap(reinterpret_cast<void*>(aligned + k_slab_size), address + k_slab_size - aligned);
+    auto* slab = reinterpret_cast<std::byte*>(aligned);
+    madvise(slab, k_slab_size, MADV_HUGEPAGE);
+#else
+    auto* slab = static_cast<std::byte*>(::operator new(k_slab_size, std::align_val_t(k_slab_size)));
+#endif
+    m_slabs.push_back(slab);
+    // Blocks are pushed in reverse so they are handed out in address order
+    for (std::size_t offset = (k_slab_size / m_block_size) * m_block_size; offset >= m_block_size;) {
+        offset -= m_block_size;
+        auto* block = reinterpret_cast<FreeBlock*>(slab + offset);
+        block->next = m_free;
+        m_free = block;
+    }
+}
+
+}
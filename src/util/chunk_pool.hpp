@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace util {
+
+/**
+ * @brief Allocator of fixed-size blocks carved out of 2 MB slabs. Slabs are aligned so the kernel can back each with a
+ * huge page, which keeps TLB misses down when many blocks are walked. Freed blocks go on a free list and are handed out
+ * again before a new slab is taken. Slabs are only returned when the pool is destroyed, but trim() gives the pages of
+ * free blocks back to the system in the meantime. Thread-safe.
+ */
+class ChunkPool {
+public:
+    /**
+     * @brief Construct ChunkPool
+     * @param block_size - Size of every block, at most a slab
+     */
+    explicit ChunkPool(std::size_t block_size);
+
+    ~ChunkPool();
+
+    ChunkPool(const ChunkPool&) = delete;
+    ChunkPool& operator=(const ChunkPool&) = delete;
+
+    /**
+     * @brief Get an uninitialized block, aligned to 64 bytes
+     */
+    [[nodiscard]] void* allocate();
+
+    /**
+     * @brief Give back a block from allocate()
+     */
+    void deallocate(void* block);
+
+    [[nodiscard]] std::size_t block_size() const;
+
+    /**
+     * @brief Get the number of blocks handed out and not given back
+     */
+    [[nodiscard]] std::size_t used_blocks() const;
+
+    /**
+     * @brief Get the memory taken from the system for slabs, in bytes
+     */
+    [[nodiscard]] std::size_t reserved_bytes() const;
+
+    /**
+     * @brief Get the memory of slabs that hasn't been given back by trim(), in bytes
+     */
+    [[nodiscard]] std::size_t resident_bytes() const;
+
+    /**
+     * @brief Give the pages of blocks freed since the last trim back to the system. Blocks keep the page holding their
+     * free list link and get zeroed pages when handed out again. Allocating isn't held up while pages are given back.
+     */
+    void trim();
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    const std::size_t m_block_size;
+    mutable std::mutex m_mutex {};
+    // Blocks whose pages are still there are handed out before trimmed ones
+    FreeBlock* m_free = nullptr;
+    FreeBlock* m_trimmed = nullptr;
+    std::vector<void*> m_slabs {};
+    std::size_t m_used = 0;
+    std::size_t m_trimmed_bytes = 0;
+
+    /**
+     * @brief Get the whole pages of a block past its free list link, which trim() gives back
+     * @return - Start and size in bytes
+     */
+    [[nodiscard]] std::pair<std::byte*, std::size_t> trimmable_pages(FreeBlock* block) const;
+
+    /**
+     * @brief Take a slab from the system and put its blocks on the free list
+     */
+    void grow();
+};
+
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace util {
+
+/**
+ * @brief Hash map from 2D integer coordinates to values, with open addressing and linear probing so a lookup is a hash
+ * and a short scan of one array. Removing shifts the entries after it back instead of leaving tombstones, so lookups
+ * don't slow down as entries come and go.
+ */
+template <typename T>
+class CoordMap {
+public:
+    [[nodiscard]] T* find(int x, int y)
+    {
+        if (m_size == 0) {
+            return nullptr;
+        }
+        const uint64_t key = pack(x, y);
+        for (std::size_t i = home(key);; i = (i + 1) & m_mask) {
+            Entry& entry = m_entries[i];
+            if (!entry.used) {
+                return nullptr;
+            }
+            if (entry.key == key) {
+                return &entry.value;
+            }
+        }
+    }
+
+    [[nodiscard]] const T* find(int x, int y) const
+    {
+        return const_cast<CoordMap*>(this)->find(x, y);
+    }
+
+    /**
+     * @brief Add a value or replace the value already at the coordinates
+     */
+    void insert(int x, int y, T value)
+    {
+        // Kept at most half full so probes stay short
+        if ((m_size + 1) * 2 > m_entries.size()) {
+            grow();
+        }
+        const uint64_t key = pack(x, y);
+        for (std::size_t i = home(key);; i = (i + 1) & m_mask) {
+            Entry& entry = m_entries[i];
+            if (!entry.used) {
+                entry = { key, std::move(value), true };
+                m_size++;
+                return;
+            }
+            if (entry.key == key) {
+                entry.value = std::move(value);
+                return;
+            }
+        }
+    }
+
+    /**
+     * @brief Remove the value at the coordinates if there is one
+     * @return - True if there was a value
+     */
+    bool erase(int x, int y)
+    {
+        if (m_size == 0) {
+            return false;
+        }
+        const uint64_t key = pack(x, y);
+        std::size_t hole = home(key);
+        while (m_entries[hole].key != key || !m_entries[hole].used) {
+            if (!m_entries[hole].used) {
+                return false;
+            }
+            hole = (hole + 1) & m_mask;
+        }
+        // Pull back every later entry of the run that can't be found past the hole anymore
+        for (std::size_t i = (hole + 1) & m_mask; m_entries[i].used; i = (i + 1) & m_mask) {
+            const std::size_t entry_home = home(m_entries[i].key);
+            const bool reachable
+                = hole <= i ? (hole < entry_home && entry_home <= i) : (hole < entry_home || entry_home <= i);
+            if (!reachable) {
+                m_entries[hole] = std::move(m_entries[i]);
+                hole = i;
+            }
+        }
+        m_entries[hole].used = false;
+        m_size--;
+        return true;
+    }
+
+    /**
+     * @brief Call func(x, y, value) for every entry, in no particular order
+     */
+    template <typename F>
+    void for_each(F&& func)
+    {
+        for (Entry& entry : m_entries) {
+            if (entry.used) {
+                func(key_x(entry.key), key_y(entry.key), entry.value);
+            }
+        }
+    }
+
+    template <typename F>
+    void for_each(F&& func) const
+    {
+        for (const Entry& entry : m_entries) {
+            if (entry.used) {
+                func(key_x(entry.key), key_y(entry.key), entry.value);
+            }
+        }
+    }
+
+    [[nodiscard]] std::size_t size() const
+    {
+        return m_size;
+    }
+
+private:
+    struct Entry {
+        uint64_t key = 0;
+        T value {};
+        bool used = false;
+    };
+
+    std::vector<Entry> m_entries {};
+    std::size_t m_mask = 0;
+    std::size_t m_size = 0;
+
+    static uint64_t pack(int x, int y)
+    {
+        return static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32 | static_cast<uint32_t>(y);
+    }
+
+    static int key_x(uint64_t key)
+    {
+        return static_cast<int>(static_cast<uint32_t>(key >> 32));
+    }
+
+    static int key_y(uint64_t key)
+    {
+        return static_cast<int>(static_cast<uint32_t>(key));
+    }
+
+    [[nodiscard]] std::size_t home(uint64_t key) const
+    {
+        // Finalizer of splitmix64, so neighboring coordinates land far apart
+        key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9;
+        key = (key ^ (key >> 27)) * 0x94d049bb133111eb;
+        return static_cast<std::size_t>(key ^ (key >> 31)) & m_mask;
+    }
+
+    void grow()
+    {
+        std::vector<Entry> entries(m_entries.empty() ? 16 : m_entries.size() * 2);
+        std::swap(entries, m_entries);
+        m_mask = m_entries.size() - 1;
+        m_size = 0;
+        for (Entry& entry : entries) {
+            if (entry.used) {
+                insert(key_x(entry.key), key_y(entry.key), std::move(entry.value));
+            }
+        }
+    }
+};
+
+}
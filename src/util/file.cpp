@@ -0,0 +1,74 @@
+#include "file.hpp"
+
+#include <fstream>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace util {
+
+void replace_file(const std::filesystem::path& path, const std::function<void(std::FILE*)>& write)
+{
+    std::filesystem::path temporary = path;
+    temporary += ".tmp";
+    std::FILE* file = std::fopen(temporary.string().c_str(), "wb");
+    if (file == nullptr) {
+        throw std::runtime_error("Unable to create " + temporary.string());
+    }
+    try {
+        write(file);
+#if defined(_WIN32)
+        const bool synced = std::fflush(file) == 0 && _commit(_fileno(file)) == 0;
+#else
+        const bool synced = std::fflush(file) == 0 && fsync(fileno(file)) == 0;
+#endif
+        if (!synced || std::ferror(file) != 0) {
+            throw std::runtime_error("Unable to write " + temporary.string());
+        }
+    }
+    catch (...) {
+        std::fclose(file);
+        throw;
+    }
+    if (std::fclose(file) != 0) {
+        throw std::runtime_error("Unable to write " + temporary.string());
+    }
+    std::filesystem::rename(temporary, path);
+#if !defined(_WIN32)
+    const std::filesystem::path directory = path.has_parent_path() ? path.parent_path() : ".";
+    const int directory_file = open(directory.c_str(), O_RDONLY);
+    if (directory_file >= 0) {
+        fsync(directory_file);
+        close(directory_file);
+    }
+#endif
+}
+
+void write_bytes(std::FILE* file, std::span<const uint8_t> data)
+{
+    if (std::fwrite(data.data(), 1, data.size(), file) != data.size()) {
+        throw std::runtime_error("Unable to write file");
+    }
+}
+
+std::vector<uint8_t> read_file(const std::filesystem::path& path)
+{
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        throw std::runtime_error("Unable to open " + path.string());
+    }
+    std::vector<uint8_t> data(static_cast<std::size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size()));
+    if (!file) {
+        throw std::runtime_error("Unable to read " + path.string());
+    }
+    return data;
+}
+
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <span>
+#include <vector>
+
+namespace util {
+
+/**
+ * @brief Write a file under a temporary name, flush it to disk and rename it over the path, then flush the rename, so
+ * a crash at any point leaves either the old file or the new one whole. Throws if anything fails.
+ * @param write - Writes the contents, throws if it fails
+ */
+void replace_file(const std::filesystem::path& path, const std::function<void(std::FILE*)>& write);
+
+/**
+ * @brief Write bytes to a file, throws if they aren't all written
+ */
+void write_bytes(std::FILE* file, std::span<const uint8_t> data);
+
+/**
+ * @brief Read a whole file, throws if it can't be opened or read
+ */
+[[nodiscard]] std::vector<uint8_t> read_file(const std::filesystem::path& path);
+
+}
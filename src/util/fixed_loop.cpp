@@ -3,6 +3,8 @@
 #include <chrono>
 #include <iostream>
 
+#include "profiler.hpp"
+
 namespace util {
 
 FixedLoop::FixedLoop(float rate)
@@ -13,10 +15,12 @@ FixedLoop::FixedLoop(float rate)
     m_is_ready = false;
     m_rate = static_cast<int64_t>((static_cast<double>(1.0 / rate)) * static_cast<int64_t>(1000000000));
     m_blend = 0;
+    m_dropped = 0;
 }
 
 void FixedLoop::update(int max_loops, std::optional<std::function<void()>> callback)
 {
+    PROFILE_ZONE("fixed_loop");
     update_state();
     int loop_count = 0;
     while (m_is_ready) {
@@ -26,6 +30,11 @@ void FixedLoop::update(int max_loops, std::optional<std::function<void()>> callb
         update_state();
         loop_count++;
         if (loop_count >= max_loops) {
+            if (m_is_ready) {
+                m_dropped += 1 + m_delta / m_rate;
+                m_delta %= m_rate;
+                m_is_ready = false;
+            }
             break;
         }
     }
@@ -36,6 +45,16 @@ void FixedLoop::set_rate(float rate)
     m_rate = static_cast<int64_t>((static_cast<double>(1.0f / rate)) * static_cast<int64_t>(1000000000));
 }
 
+float FixedLoop::rate() const
+{
+    return static_cast<float>(1000000000.0 / static_cast<double>(m_rate));
+}
+
+int64_t FixedLoop::dropped_steps() const
+{
+    return m_dropped;
+}
+
 float FixedLoop::blend() const
 {
     return static_cast<float>(m_blend);
@@ -24,6 +24,17 @@ public:
      */
     void set_rate(float rate);
 
+    /**
+     * @brief Get rate
+     * @return - Rate (Steps per second)
+     */
+    [[nodiscard]] float rate() const;
+
+    /**
+     * @brief Get the number of steps skipped so far because the loop fell more than max_loops steps behind
+     */
+    [[nodiscard]] int64_t dropped_steps() const;
+
     /**
      * @brief Reset time delta (Used in case timestep is too far behind)
      */
@@ -36,7 +47,8 @@ public:
     [[nodiscard]] float blend() const;
 
     /**
-     * @brief Update loop and callback
+     * @brief Update loop and callback. Steps still due after max_loops steps are dropped so the loop doesn't fall
+     * further and further behind.
      */
     void update(int max_loops, std::optional<std::function<void()>> callback);
 
@@ -47,6 +59,7 @@ private:
     bool m_is_ready;
     int64_t m_rate;
     double m_blend;
+    int64_t m_dropped;
 
     void update_state();
 };
@@ -0,0 +1,112 @@
+#include "histogram.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+namespace util {
+
+// Above 2^7, each power of two is split into 64 buckets, keeping them at most 1/64 as wide as their values
+inline constexpr int k_histogram_sub_bucket_bits = 7;
+inline constexpr uint64_t k_histogram_half_sub_buckets = uint64_t(1) << (k_histogram_sub_bucket_bits - 1);
+inline constexpr std::size_t k_histogram_bucket_count
+    = (64 - k_histogram_sub_bucket_bits + 2) * k_histogram_half_sub_buckets;
+
+static std::size_t bucket_of(uint64_t value)
+{
+    const int magnitude = std::bit_width(value) - 1;
+    if (magnitude < k_histogram_sub_bucket_bits) {
+        return static_cast<std::size_t>(value);
+    }
+    const int shift = magnitude - (k_histogram_sub_bucket_bits - 1);
+    return (static_cast<std::size_t>(shift) << (k_histogram_sub_bucket_bits - 1)) + (value >> shift);
+}
+
+// Lowest value that lands in a bucket
+static uint64_t bucket_start(std::size_t bucket)
+{
+    if (bucket < 2 * k_histogram_half_sub_buckets) {
+        return bucket;
+    }
+    const std::size_t shift = (bucket >> (k_histogram_sub_bucket_bits - 1)) - 1;
+    return (bucket - (shift << (k_histogram_sub_bucket_bits - 1))) << shift;
+}
+
+Histogram::Histogram()
+    : m_counts(k_histogram_bucket_count, 0)
+{
+}
+
+void Histogram::record(uint64_t value)
+{
+    m_counts[bucket_of(value)]++;
+    m_count++;
+    m_min = std::min(m_min, value);
+    m_max = std::max(m_max, value);
+    m_sum += static_cast<double>(value);
+}
+
+void Histogram::merge(const Histogram& other)
+{
+    for (std::size_t i = 0; i < m_counts.size(); i++) {
+        m_counts[i] += other.m_counts[i];
+    }
+    m_count += other.m_count;
+    m_min = std::min(m_min, other.m_min);
+    m_max = std::max(m_max, other.m_max);
+    m_sum += other.m_sum;
+}
+
+void Histogram::reset()
+{
+    std::fill(m_counts.begin(), m_counts.end(), 0);
+    m_count = 0;
+    m_min = UINT64_MAX;
+    m_max = 0;
+    m_sum = 0.0;
+}
+
+uint64_t Histogram::count() const
+{
+    return m_count;
+}
+
+uint64_t Histogram::min() const
+{
+    return m_count == 0 ? 0 : m_min;
+}
+
+uint64_t Histogram::max() const
+{
+    return m_max;
+}
+
+double Histogram::mean() const
+{
+    return m_count == 0 ? 0.0 : m_sum / static_cast<double>(m_count);
+}
+
+double Histogram::sum() const
+{
+    return m_sum;
+}
+
+uint64_t Histogram::value_at(double quantile) const
+{
+    if (m_count == 0) {
+        return 0;
+    }
+    const auto rank = std::max<uint64_t>(
+        1, static_cast<uint64_t>(std::ceil(std::clamp(quantile, 0.0, 1.0) * static_cast<double>(m_count))));
+    uint64_t seen = 0;
+    for (std::size_t i = 0; i < m_counts.size(); i++) {
+        seen += m_counts[i];
+        if (seen >= rank) {
+            const uint64_t highest = i + 1 < m_counts.size() ? bucket_start(i + 1) - 1 : UINT64_MAX;
+            return std::clamp(highest, min(), m_max);
+        }
+    }
+    return m_max;
+}
+
+}
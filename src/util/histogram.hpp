@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace util {
+
+/**
+ * @brief Histogram of non-negative values with bounded relative error, in the style of HDR histograms. Values below 128
+ * are counted exactly and larger ones in buckets that double in width every power of two, so every value lands in a
+ * bucket at most 1.6% wide relative to it, whatever its magnitude, in a fixed 30 KB.
+ */
+class Histogram {
+public:
+    Histogram();
+
+    void record(uint64_t value);
+
+    /**
+     * @brief Add every value recorded in another histogram
+     */
+    void merge(const Histogram& other);
+
+    void reset();
+
+    [[nodiscard]] uint64_t count() const;
+
+    [[nodiscard]] uint64_t min() const;
+
+    [[nodiscard]] uint64_t max() const;
+
+    [[nodiscard]] double mean() const;
+
+    [[nodiscard]] double sum() const;
+
+    /**
+     * @brief Get the value at a quantile, as the highest value of the bucket it is in
+     * @param quantile - Between 0.0 and 1.0
+     * @return - The value, or 0 if nothing was recorded
+     */
+    [[nodiscard]] uint64_t value_at(double quantile) const;
+
+private:
+    std::vector<uint64_t> m_counts;
+    uint64_t m_count = 0;
+    uint64_t m_min = UINT64_MAX;
+    uint64_t m_max = 0;
+    double m_sum = 0.0;
+};
+
+}
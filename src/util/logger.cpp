@@ -1,18 +1,39 @@
 #include "logger.hpp"
 
-
+#include "async_sink.hpp"
 #include "spdlog/sinks/daily_file_sink.h"
 #include "spdlog/sinks/stdout_color_sinks.h"
 
 namespace util {
 
-void init_logger()
+static std::shared_ptr<spdlog::logger> s_main_logger;
+static std::shared_ptr<spdlog::logger> s_metrics_logger;
+
+void init_logger(bool async)
 {
     std::vector<spdlog::sink_ptr> sinks;
     sinks.push_back(std::make_shared<spdlog::sinks::stdout_color_sink_mt>());
     sinks.push_back(std::make_shared<spdlog::sinks::daily_file_sink_mt>("logs/log.txt", 0, 0, false, 5));
-    auto logger = std::make_shared<spdlog::logger>("main", std::begin(sinks), std::end(sinks));
-    spdlog::register_logger(logger);
+    if (async) {
+        sinks = { std::make_shared<AsyncSink>(std::move(sinks)) };
+    }
+    s_main_logger = std::make_shared<spdlog::logger>("main", std::begin(sinks), std::end(sinks));
+    spdlog::register_logger(s_main_logger);
+
+    s_metrics_logger = std::make_shared<spdlog::logger>(
+        "metrics", std::make_shared<spdlog::sinks::daily_file_sink_mt>("logs/metrics.jsonl", 0, 0, false, 5));
+    s_metrics_logger->set_pattern("%v");
+    spdlog::register_logger(s_metrics_logger);
+}
+
+spdlog::logger& main_logger()
+{
+    return s_main_logger != nullptr ? *s_main_logger : *spdlog::default_logger_raw();
+}
+
+spdlog::logger& metrics_logger()
+{
+    return s_metrics_logger != nullptr ? *s_metrics_logger : *spdlog::default_logger_raw();
 }
 
 }
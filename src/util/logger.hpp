@@ -19,46 +19,105 @@
 
 #include "spdlog/spdlog.h"
 
+// Lowest level compiled in, messages below it cost nothing. One of the SPDLOG_LEVEL_ values.
+#ifndef POP_LOG_LEVEL
+#define POP_LOG_LEVEL SPDLOG_LEVEL_INFO
+#endif
+
 /**
- * @brief macro to main logger
+ * @brief macros to log to the main logger, stripped at compile time below POP_LOG_LEVEL
  */
-#define LOG spdlog::get("main")
+// A stripped message is still compiled but never run, so what only it uses doesn't warn as unused
+#define POP_LOG_STRIPPED(level, ...)                                                                                   \
+    do {                                                                                                               \
+        if constexpr (false) {                                                                                         \
+            util::main_logger().level(__VA_ARGS__);                                                                    \
+        }                                                                                                              \
+    } while (0)
+#if POP_LOG_LEVEL <= SPDLOG_LEVEL_TRACE
+#define POP_LOG_TRACE(...) util::main_logger().trace(__VA_ARGS__)
+#else
+#define POP_LOG_TRACE(...) POP_LOG_STRIPPED(trace, __VA_ARGS__)
+#endif
+#if POP_LOG_LEVEL <= SPDLOG_LEVEL_DEBUG
+#define POP_LOG_DEBUG(...) util::main_logger().debug(__VA_ARGS__)
+#else
+#define POP_LOG_DEBUG(...) POP_LOG_STRIPPED(debug, __VA_ARGS__)
+#endif
+#if POP_LOG_LEVEL <= SPDLOG_LEVEL_INFO
+#define POP_LOG_INFO(...) util::main_logger().info(__VA_ARGS__)
+#else
+#define POP_LOG_INFO(...) POP_LOG_STRIPPED(info, __VA_ARGS__)
+#endif
+#if POP_LOG_LEVEL <= SPDLOG_LEVEL_WARN
+#define POP_LOG_WARN(...) util::main_logger().warn(__VA_ARGS__)
+#else
+#define POP_LOG_WARN(...) POP_LOG_STRIPPED(warn, __VA_ARGS__)
+#endif
+#if POP_LOG_LEVEL <= SPDLOG_LEVEL_ERROR
+#define POP_LOG_ERROR(...) util::main_logger().error(__VA_ARGS__)
+#else
+#define POP_LOG_ERROR(...) POP_LOG_STRIPPED(error, __VA_ARGS__)
+#endif
+#if POP_LOG_LEVEL <= SPDLOG_LEVEL_CRITICAL
+#define POP_LOG_CRITICAL(...) util::main_logger().critical(__VA_ARGS__)
+#else
+#define POP_LOG_CRITICAL(...) POP_LOG_STRIPPED(critical, __VA_ARGS__)
+#endif
 
 namespace util {
 
 /**
  * @brief Initialize logger
+ * @param async - Write messages on a background thread so logging threads don't wait for the console or files
+ */
+void init_logger(bool async = false);
+
+/**
+ * @brief Get the main logger without looking it up by name, the default logger until init_logger() runs
  */
-void init_logger();
+[[nodiscard]] spdlog::logger& main_logger();
+
+/**
+ * @brief Get the logger that writes metrics as JSON lines, without decoration
+ */
+[[nodiscard]] spdlog::logger& metrics_logger();
 
 #ifdef LOGGER_RAYLIB
 inline void logger_callback_raylib(int log_level, const char* text, va_list args)
 {
-    char message[MAX_TRACELOG_MSG_LENGTH] = { 0 };
-    vsnprintf(message, sizeof(message), text, args);
-
+    spdlog::level::level_enum level;
     switch (log_level) {
     case LOG_TRACE:
-        LOG->trace(message);
+        level = spdlog::level::trace;
         break;
     case LOG_DEBUG:
-        LOG->debug(message);
+        level = spdlog::level::debug;
         break;
     case LOG_INFO:
-        LOG->info(message);
+        level = spdlog::level::info;
         break;
     case LOG_WARNING:
-        LOG->warn(message);
+        level = spdlog::level::warn;
         break;
     case LOG_ERROR:
-        LOG->error(message);
+        level = spdlog::level::err;
         break;
     case LOG_FATAL:
-        LOG->critical(message);
+        level = spdlog::level::critical;
         break;
     default:
-        break;
+        return;
+    }
+    // Skip formatting messages the logger would drop
+    spdlog::logger& logger = main_logger();
+    if (!logger.should_log(level)) {
+        return;
     }
+
+    char message[MAX_TRACELOG_MSG_LENGTH] = { 0 };
+    vsnprintf(message, sizeof(message), text, args);
+    logger.log(level, spdlog::string_view_t(message));
 }
 #endif
 
@@ -0,0 +1,115 @@
+#include "metrics_server.hpp"
+
+#include <stdexcept>
+#include <string_view>
+
+#if !defined(_WIN32)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace util {
+
+#if defined(_WIN32)
+
+MetricsServer::MetricsServer(uint16_t, std::function<std::string()>)
+{
+    throw std::runtime_error("Serving metrics is not supported on this platform");
+}
+
+MetricsServer::~MetricsServer() = default;
+
+void MetricsServer::serve()
+{
+}
+
+void MetricsServer::respond(int)
+{
+}
+
+#else
+
+MetricsServer::MetricsServer(uint16_t port, std::function<std::string()> body)
+    : m_body(std::move(body))
+{
+    m_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (m_socket < 0) {
+        throw std::runtime_error("Unable to create metrics socket");
+    }
+    const int reuse = 1;
+    setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in address {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(m_socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(m_socket, 4) != 0) {
+        close(m_socket);
+        throw std::runtime_error("Unable to listen for metrics on port " + std::to_string(port));
+    }
+    m_thread = std::thread([this] { serve(); });
+}
+
+MetricsServer::~MetricsServer()
+{
+    m_stopping.store(true);
+    m_thread.join();
+    close(m_socket);
+}
+
+void MetricsServer::serve()
+{
+    while (!m_stopping.load()) {
+        // Wake up now and then to see if the server is stopping
+        pollfd listening { .fd = m_socket, .events = POLLIN, .revents = 0 };
+        if (poll(&listening, 1, 100) <= 0) {
+            continue;
+        }
+        const int client = accept(m_socket, nullptr, nullptr);
+        if (client < 0) {
+            continue;
+        }
+        respond(client);
+        close(client);
+    }
+}
+
+void MetricsServer::respond(int client)
+{
+    // The request line is all that matters and fits in the first read of any real client
+    char request[1024];
+    pollfd readable { .fd = client, .events = POLLIN, .revents = 0 };
+    if (poll(&readable, 1, 1000) <= 0) {
+        return;
+    }
+    const ssize_t size = recv(client, request, sizeof(request) - 1, 0);
+    if (size <= 0) {
+        return;
+    }
+    const std::string_view line(request, static_cast<std::size_t>(size));
+
+    std::string response;
+    if (line.starts_with("GET /metrics ") || line.starts_with("GET /metrics?")) {
+        const std::string body = m_body();
+        response = "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+            + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+    }
+    else {
+        response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    }
+    std::size_t sent = 0;
+    while (sent < response.size()) {
+        const ssize_t result = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (result <= 0) {
+            return;
+        }
+        sent += static_cast<std::size_t>(result);
+    }
+}
+
+#endif
+
+}
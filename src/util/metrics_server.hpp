@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+
+namespace util {
+
+/**
+ * @brief Minimal HTTP server on the loopback interface that answers GET /metrics with text from a callback, for
+ * Prometheus to scrape. Requests are answered one at a time on a thread of its own.
+ */
+class MetricsServer {
+public:
+    /**
+     * @brief Start listening
+     * @param body - Called on the server thread for every scrape, must be safe to call from there
+     * @throws std::runtime_error if the port can't be listened on
+     */
+    MetricsServer(uint16_t port, std::function<std::string()> body);
+
+    ~MetricsServer();
+
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+private:
+    int m_socket = -1;
+    std::function<std::string()> m_body;
+    std::atomic<bool> m_stopping { false };
+    std::thread m_thread;
+
+    void serve();
+
+    void respond(int client);
+};
+
+}
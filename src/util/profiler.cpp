@@ -0,0 +1,181 @@
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+namespace util {
+
+inline constexpr std::size_t k_profile_ring_size = 1 << 16;
+
+// Fields are written and read atomically so write_trace() can copy a ring while its thread keeps recording
+struct ZoneRecord {
+    const char* name;
+    int64_t start_ns;
+    int64_t end_ns;
+
+    void store(const ZoneRecord& record)
+    {
+        std::atomic_ref(name).store(record.name, std::memory_order_relaxed);
+        std::atomic_ref(start_ns).store(record.start_ns, std::memory_order_relaxed);
+        std::atomic_ref(end_ns).store(record.end_ns, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] ZoneRecord load() const
+    {
+        auto& self = const_cast<ZoneRecord&>(*this);
+        return { std::atomic_ref(self.name).load(std::memory_order_relaxed),
+            std::atomic_ref(self.start_ns).load(std::memory_order_relaxed),
+            std::atomic_ref(self.end_ns).load(std::memory_order_relaxed) };
+    }
+};
+
+struct ThreadZones {
+    int id = 0;
+    std::string name {};
+    std::array<ZoneRecord, k_profile_ring_size> ring {};
+    std::atomic<uint64_t> count { 0 };
+};
+
+// Buffers outlive their threads so zones of finished threads can still be exported
+struct ProfilerRegistry {
+    std::mutex mutex {};
+    std::vector<std::unique_ptr<ThreadZones>> threads {};
+};
+
+static ProfilerRegistry& registry()
+{
+    static ProfilerRegistry registry;
+    return registry;
+}
+
+static thread_local ThreadZones* t_zones = nullptr;
+
+static ThreadZones& thread_zones()
+{
+    if (t_zones == nullptr) {
+        ProfilerRegistry& reg = registry();
+        std::lock_guard lock(reg.mutex);
+        auto zones = std::make_unique<ThreadZones>();
+        zones->id = static_cast<int>(reg.threads.size());
+        zones->name = "thread " + std::to_string(zones->id);
+        t_zones = zones.get();
+        reg.threads.push_back(std::move(zones));
+    }
+    return *t_zones;
+}
+
+static int64_t now_ns()
+{
+    static const auto epoch = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+ProfileZone::ProfileZone(const char* name)
+    : m_name(name)
+    , m_start_ns(now_ns())
+{
+}
+
+ProfileZone::~ProfileZone()
+{
+    ThreadZones& zones = thread_zones();
+    const uint64_t count = zones.count.load(std::memory_order_relaxed);
+    // Orders the count published by the last zone before the slot is overwritten, so a reader that sees any of the new
+    // record also sees a count that tells it the slot was reused
+    std::atomic_thread_fence(std::memory_order_release);
+    zones.ring[count % k_profile_ring_size].store({ m_name, m_start_ns, now_ns() });
+    zones.count.store(count + 1, std::memory_order_release);
+}
+
+void set_profiler_thread_name(const std::string& name)
+{
+    ThreadZones& zones = thread_zones();
+    std::lock_guard lock(registry().mutex);
+    zones.name = name;
+}
+
+/**
+ * @brief Write a string as a quoted JSON string
+ */
+static void write_json_string(std::ostream& out, std::string_view string)
+{
+    static constexpr char k_hex_digits[] = "0123456789abcdef";
+    out << '"';
+    for (const char c : string) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20) {
+            out << "\\u00" << k_hex_digits[c >> 4] << k_hex_digits[c & 0xf];
+        }
+        else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+/**
+ * @brief Copy the newest zones of a thread while it may still be recording, leaving out slots it overwrote meanwhile
+ */
+static std::vector<ZoneRecord> copy_zones(const ThreadZones& zones)
+{
+    const uint64_t count = zones.count.load(std::memory_order_acquire);
+    const uint64_t first = count - std::min<uint64_t>(count, k_profile_ring_size);
+    std::vector<ZoneRecord> records;
+    records.reserve(count - first);
+    for (uint64_t i = first; i < count; i++) {
+        records.push_back(zones.ring[i % k_profile_ring_size].load());
+    }
+    // Zone i is overwritten by zone i + k_profile_ring_size, which may be under way once the count reaches it
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint64_t count_after = zones.count.load(std::memory_order_relaxed);
+    const uint64_t intact = count_after + 1 > k_profile_ring_size ? count_after + 1 - k_profile_ring_size : 0;
+    const uint64_t skipped = std::min(count, std::max(first, intact)) - first;
+    records.erase(records.begin(), records.begin() + static_cast<std::ptrdiff_t>(skipped));
+    return records;
+}
+
+int write_trace(const std::string& path)
+{
+    std::ofstream file(path);
+    if (!file) {
+        return -1;
+    }
+
+    ProfilerRegistry& reg = registry();
+    std::lock_guard lock(reg.mutex);
+    int zone_count = 0;
+    file << std::fixed << std::setprecision(3);
+    file << "{\"traceEvents\":[";
+    bool first = true;
+    for (const std::unique_ptr<ThreadZones>& zones : reg.threads) {
+        file << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << zones->id
+             << ",\"args\":{\"name\":";
+        write_json_string(file, zones->name);
+        file << "}}";
+        first = false;
+
+        for (const ZoneRecord& zone : copy_zones(*zones)) {
+            file << ",\n{\"name\":";
+            write_json_string(file, zone.name);
+            file << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << zones->id
+                 << ",\"ts\":" << static_cast<double>(zone.start_ns) / 1000.0
+                 << ",\"dur\":" << static_cast<double>(zone.end_ns - zone.start_ns) / 1000.0 << "}";
+            zone_count++;
+        }
+    }
+    file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    return zone_count;
+}
+
+}
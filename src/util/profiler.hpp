@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace util {
+
+/**
+ * @brief Zone of code timed from construction to destruction. Zones are recorded into a ring buffer of the thread
+ * they run on, so recording takes no locks. Use through PROFILE_ZONE so zones compile out without POP_PROFILING.
+ */
+class ProfileZone {
+public:
+    /**
+     * @brief Start a zone
+     * @param name - Name shown in the trace, has to outlive the export
+     */
+    explicit ProfileZone(const char* name);
+
+    ~ProfileZone();
+
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+
+private:
+    const char* m_name;
+    int64_t m_start_ns;
+};
+
+/**
+ * @brief Name the calling thread in exported traces
+ */
+void set_profiler_thread_name(const std::string& name);
+
+/**
+ * @brief Check if zones are recorded in this build
+ */
+[[nodiscard]] constexpr bool profiling_enabled()
+{
+#ifdef POP_PROFILING
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Write the zones recorded on every thread in the Chrome trace event format, for chrome://tracing or Perfetto.
+ * Only the newest zones of each thread are kept. Threads may keep recording while the trace is written, zones they
+ * overwrite meanwhile are left out.
+ * @return - Number of zones written, or -1 if the file couldn't be opened
+ */
+int write_trace(const std::string& path);
+
+}
+
+#ifdef POP_PROFILING
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+/**
+ * @brief Time the rest of the enclosing scope
+ */
+#define PROFILE_ZONE(name) const util::ProfileZone PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+#define PROFILE_THREAD(name) util::set_profiler_thread_name(name)
+#else
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_THREAD(name) ((void)0)
+#endif
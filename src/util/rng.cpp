@@ -0,0 +1,84 @@
+#include "rng.hpp"
+
+#include <utility>
+
+namespace util {
+
+static uint64_t rotl(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+uint64_t mix64(uint64_t value)
+{
+    value += 0x9e3779b97f4a7c15;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111eb;
+    return value ^ (value >> 31);
+}
+
+Rng::Rng(uint64_t seed)
+{
+    this->seed(seed);
+}
+
+void Rng::seed(uint64_t seed)
+{
+    for (uint64_t& state : m_state) {
+        seed = mix64(seed);
+        state = seed;
+    }
+}
+
+uint64_t Rng::next()
+{
+    const uint64_t result = rotl(m_state[1] * 5, 7) * 9;
+    const uint64_t t = m_state[1] << 17;
+    m_state[2] ^= m_state[0];
+    m_state[3] ^= m_state[1];
+    m_state[1] ^= m_state[2];
+    m_state[0] ^= m_state[3];
+    m_state[2] ^= t;
+    m_state[3] = rotl(m_state[3], 45);
+    return result;
+}
+
+int Rng::range(int min, int max)
+{
+    if (min > max) {
+        std::swap(min, max);
+    }
+    auto span = static_cast<uint64_t>(static_cast<int64_t>(max) - min + 1);
+    // Multiply-shift maps 32 random bits onto the span without a division
+    return min + static_cast<int>(((next() >> 32) * span) >> 32);
+}
+
+WideRng::WideRng(uint64_t seed)
+{
+    this->seed(seed);
+}
+
+void WideRng::seed(uint64_t seed)
+{
+    for (int i = 0; i < lanes; i++) {
+        seed = mix64(seed);
+        m_state0[i] = seed;
+        seed = mix64(seed);
+        m_state1[i] = seed | 1;
+    }
+}
+
+const std::array<uint64_t, WideRng::lanes>& WideRng::next()
+{
+    for (int i = 0; i < lanes; i++) {
+        uint64_t s1 = m_state0[i];
+        const uint64_t s0 = m_state1[i];
+        m_state0[i] = s0;
+        s1 ^= s1 << 23;
+        m_state1[i] = s1 ^ s0 ^ (s1 >> 17) ^ (s0 >> 26);
+        m_out[i] = m_state1[i] + s0;
+    }
+    return m_out;
+}
+
+}
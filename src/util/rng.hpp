@@ -0,0 +1,74 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace util {
+
+/**
+ * @brief Small and fast pseudo-random number generator (xoshiro256**)
+ */
+class Rng {
+public:
+    /**
+     * @brief Construct Rng
+     * @param seed - Seed, any value is fine including 0
+     */
+    explicit Rng(uint64_t seed = 0);
+
+    /**
+     * @brief Reset the state from a seed
+     */
+    void seed(uint64_t seed);
+
+    /**
+     * @brief Get the next 64 random bits
+     */
+    uint64_t next();
+
+    /**
+     * @brief Get a random integer
+     * @return - Value between min and max, both inclusive
+     */
+    int range(int min, int max);
+
+private:
+    std::array<uint64_t, 4> m_state {};
+};
+
+/**
+ * @brief Four interleaved xorshift128+ streams stepped in lockstep. The update is plain shifts, xors and adds over
+ * arrays so the compiler vectorizes it; used where many random bits are needed at once.
+ */
+class WideRng {
+public:
+    static constexpr int lanes = 4;
+
+    /**
+     * @brief Construct WideRng
+     * @param seed - Seed, any value is fine including 0
+     */
+    explicit WideRng(uint64_t seed = 0);
+
+    /**
+     * @brief Reset the state from a seed
+     */
+    void seed(uint64_t seed);
+
+    /**
+     * @brief Get the next 64 random bits of each lane
+     */
+    const std::array<uint64_t, lanes>& next();
+
+private:
+    std::array<uint64_t, lanes> m_state0 {};
+    std::array<uint64_t, lanes> m_state1 {};
+    std::array<uint64_t, lanes> m_out {};
+};
+
+/**
+ * @brief Mix a 64-bit value (splitmix64 finalizer), useful for seeding and hashing
+ */
+uint64_t mix64(uint64_t value);
+
+}
@@ -0,0 +1,129 @@
+#include "task_graph.hpp"
+
+#include <stdexcept>
+#include <thread>
+
+namespace util {
+
+TaskGraph::TaskId TaskGraph::add(std::string name, std::function<void()> func, Affinity affinity)
+{
+    m_tasks.push_back({ .name = std::move(name), .func = std::move(func), .affinity = affinity });
+    return static_cast<TaskId>(m_tasks.size() - 1);
+}
+
+void TaskGraph::depend(TaskId task, TaskId on)
+{
+    m_tasks.at(on).dependents.push_back(task);
+    m_tasks.at(task).dependency_count++;
+}
+
+int TaskGraph::task_count() const
+{
+    return static_cast<int>(m_tasks.size());
+}
+
+const std::string& TaskGraph::name(TaskId task) const
+{
+    return m_tasks.at(task).name;
+}
+
+const TaskGraph::Timing& TaskGraph::timing(TaskId task) const
+{
+    return m_tasks.at(task).timing;
+}
+
+// Called with the mutex held
+void TaskGraph::make_ready(TaskId task)
+{
+    switch (m_tasks[task].affinity) {
+    case Affinity::e_worker:
+        m_ready_worker.push_back(task);
+        break;
+    case Affinity::e_main:
+        m_ready_main.push_back(task);
+        break;
+    case Affinity::e_exclusive:
+        m_ready_exclusive.push_back(task);
+        break;
+    }
+}
+
+void TaskGraph::execute(TaskId task)
+{
+    Task& t = m_tasks[task];
+    auto start = std::chrono::steady_clock::now();
+    t.func();
+    auto end = std::chrono::steady_clock::now();
+    t.timing.start_ms = std::chrono::duration<double, std::milli>(start - m_start).count();
+    t.timing.duration_ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+    std::lock_guard lock(m_mutex);
+    for (TaskId dependent : t.dependents) {
+        if (--m_tasks[dependent].remaining == 0) {
+            make_ready(dependent);
+        }
+    }
+    m_in_flight--;
+    m_done++;
+}
+
+// Worker and main tasks, until none are left to start that this worker may take and none are running that could make
+// more ready
+void TaskGraph::run_shared(int worker)
+{
+    while (true) {
+        TaskId task = -1;
+        {
+            std::lock_guard lock(m_mutex);
+            if (worker == 0 && !m_ready_main.empty()) {
+                task = m_ready_main.back();
+                m_ready_main.pop_back();
+            }
+            else if (!m_ready_worker.empty()) {
+                task = m_ready_worker.back();
+                m_ready_worker.pop_back();
+            }
+            else if (m_in_flight == 0) {
+                return;
+            }
+            if (task != -1) {
+                m_in_flight++;
+            }
+        }
+        if (task == -1) {
+            std::this_thread::yield();
+            continue;
+        }
+        execute(task);
+    }
+}
+
+void TaskGraph::run(WorkerPool& pool)
+{
+    m_start = std::chrono::steady_clock::now();
+    m_done = 0;
+    m_in_flight = 0;
+    for (TaskId task = 0; task < task_count(); task++) {
+        m_tasks[task].remaining = m_tasks[task].dependency_count;
+        if (m_tasks[task].remaining == 0) {
+            make_ready(task);
+        }
+    }
+
+    while (m_done < task_count()) {
+        if (!m_ready_exclusive.empty()) {
+            TaskId task = m_ready_exclusive.back();
+            m_ready_exclusive.pop_back();
+            m_in_flight++;
+            execute(task);
+            continue;
+        }
+        if (m_ready_worker.empty() && m_ready_main.empty()) {
+            // Whatever is left waits on itself
+            throw std::runtime_error("Task graph has a dependency cycle");
+        }
+        pool.parallel_for(0, pool.worker_count(), [this](int, int, int worker) { run_shared(worker); }, 1);
+    }
+}
+
+}
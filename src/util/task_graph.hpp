@@ -0,0 +1,89 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "worker_pool.hpp"
+
+namespace util {
+
+/**
+ * @brief Graph of tasks with explicit dependencies, run as a whole on a worker pool. The graph is built once and can be
+ * run any number of times. Each run records when every task started and how long it took.
+ */
+class TaskGraph {
+public:
+    using TaskId = int;
+
+    enum class Affinity {
+        // Any worker
+        e_worker,
+        // Only the thread calling run(), alongside worker tasks. For work that has to stay on one thread like
+        // graphics calls.
+        e_main,
+        // Only the thread calling run(), with nothing else running, so the task may run loops on the pool itself
+        e_exclusive,
+    };
+
+    struct Timing {
+        // Time from the start of the run
+        double start_ms;
+        double duration_ms;
+    };
+
+    /**
+     * @brief Add a task
+     * @param name - Name shown in timings, tasks of the same kind can share one
+     */
+    TaskId add(std::string name, std::function<void()> func, Affinity affinity = Affinity::e_worker);
+
+    /**
+     * @brief Make a task wait for another to finish
+     */
+    void depend(TaskId task, TaskId on);
+
+    /**
+     * @brief Run every task once, each after the tasks it depends on
+     */
+    void run(WorkerPool& pool);
+
+    [[nodiscard]] int task_count() const;
+
+    [[nodiscard]] const std::string& name(TaskId task) const;
+
+    /**
+     * @brief Get the timing of a task during the last run
+     */
+    [[nodiscard]] const Timing& timing(TaskId task) const;
+
+private:
+    struct Task {
+        std::string name;
+        std::function<void()> func;
+        Affinity affinity;
+        std::vector<TaskId> dependents {};
+        int dependency_count = 0;
+        int remaining = 0;
+        Timing timing {};
+    };
+
+    std::vector<Task> m_tasks {};
+    std::mutex m_mutex {};
+    std::vector<TaskId> m_ready_worker {};
+    std::vector<TaskId> m_ready_main {};
+    std::vector<TaskId> m_ready_exclusive {};
+    int m_in_flight = 0;
+    int m_done = 0;
+    std::chrono::steady_clock::time_point m_start {};
+
+    void execute(TaskId task);
+
+    void make_ready(TaskId task);
+
+    void run_shared(int worker);
+};
+
+}
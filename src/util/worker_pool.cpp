@@ -0,0 +1,168 @@
+#include "worker_pool.hpp"
+
+#include <algorithm>
+#include <string>
+
+#include "profiler.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define WORKER_POOL_PAUSE() _mm_pause()
+#else
+#define WORKER_POOL_PAUSE() std::this_thread::yield()
+#endif
+
+namespace util {
+
+// Busy spins, then spins that yield in case the thread waited on needs this core, then parking
+static constexpr int k_spin_count = 256;
+static constexpr int k_yield_count = 64;
+
+// Grains per worker when the grain is picked automatically, enough for stealing to even out uneven work
+static constexpr int k_grains_per_worker = 8;
+
+static constexpr std::size_t k_min_block_size = 64 * 1024;
+
+void spin_wait(const std::atomic<uint32_t>& value, uint32_t old)
+{
+    for (int i = 0; i < k_spin_count; i++) {
+        if (value.load(std::memory_order_acquire) != old) {
+            return;
+        }
+        WORKER_POOL_PAUSE();
+    }
+    for (int i = 0; i < k_yield_count; i++) {
+        if (value.load(std::memory_order_acquire) != old) {
+            return;
+        }
+        std::this_thread::yield();
+    }
+    while (value.load(std::memory_order_acquire) == old) {
+        value.wait(old, std::memory_order_acquire);
+    }
+}
+
+void ScratchArena::reset()
+{
+    m_block = 0;
+    m_used = 0;
+}
+
+void* ScratchArena::allocate_bytes(std::size_t size, std::size_t alignment)
+{
+    while (m_block < m_blocks.size()) {
+        Block& block = m_blocks[m_block];
+        std::size_t start = (m_used + alignment - 1) / alignment * alignment;
+        if (start + size <= block.size) {
+            m_used = start + size;
+            return block.data.get() + start;
+        }
+        m_block++;
+        m_used = 0;
+    }
+    std::size_t block_size = std::max(k_min_block_size, size + alignment);
+    m_blocks.push_back({ std::make_unique<std::byte[]>(block_size), block_size });
+    m_block = m_blocks.size() - 1;
+    m_used = 0;
+    return allocate_bytes(size, alignment);
+}
+
+WorkerPool::WorkerPool()
+    : WorkerPool(static_cast<int>(std::max(1u, std::thread::hardware_concurrency())))
+{
+}
+
+WorkerPool::WorkerPool(int thread_count)
+    : m_slots(std::make_unique<Slot[]>(std::max(1, thread_count)))
+    , m_worker_count(std::max(1, thread_count))
+{
+    for (int worker = 1; worker < m_worker_count; worker++) {
+        m_threads.emplace_back([this, worker] { worker_main(worker); });
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    m_stopping.store(true, std::memory_order_release);
+    m_generation.fetch_add(1, std::memory_order_release);
+    m_generation.notify_all();
+    for (std::thread& thread : m_threads) {
+        thread.join();
+    }
+}
+
+int WorkerPool::worker_count() const
+{
+    return m_worker_count;
+}
+
+ScratchArena& WorkerPool::scratch(int worker)
+{
+    return m_slots[worker].scratch;
+}
+
+void WorkerPool::run(Job job, int begin, int end, int grain)
+{
+    if (begin >= end) {
+        return;
+    }
+    const int size = end - begin;
+    m_grain = grain > 0 ? grain : std::max(1, size / (m_worker_count * k_grains_per_worker));
+    m_job = job;
+    for (int worker = 0; worker < m_worker_count; worker++) {
+        Slot& slot = m_slots[worker];
+        slot.next.store(begin + static_cast<int>(int64_t(size) * worker / m_worker_count), std::memory_order_relaxed);
+        slot.end = begin + static_cast<int>(int64_t(size) * (worker + 1) / m_worker_count);
+        slot.scratch.reset();
+    }
+
+    if (m_worker_count == 1) {
+        work(0);
+        return;
+    }
+    m_pending.store(m_worker_count - 1, std::memory_order_relaxed);
+    m_generation.fetch_add(1, std::memory_order_release);
+    m_generation.notify_all();
+
+    work(0);
+
+    uint32_t pending = m_pending.load(std::memory_order_acquire);
+    while (pending != 0) {
+        spin_wait(m_pending, pending);
+        pending = m_pending.load(std::memory_order_acquire);
+    }
+}
+
+void WorkerPool::work(int worker)
+{
+    // Own range first, then steal from the others in turn
+    for (int i = 0; i < m_worker_count; i++) {
+        Slot& slot = m_slots[(worker + i) % m_worker_count];
+        while (true) {
+            const int start = slot.next.fetch_add(m_grain, std::memory_order_relaxed);
+            if (start >= slot.end) {
+                break;
+            }
+            m_job.invoke(m_job.context, start, std::min(start + m_grain, slot.end), worker);
+        }
+    }
+}
+
+void WorkerPool::worker_main(int worker)
+{
+    PROFILE_THREAD("worker " + std::to_string(worker));
+    uint32_t generation = 0;
+    while (true) {
+        spin_wait(m_generation, generation);
+        generation = m_generation.load(std::memory_order_acquire);
+        if (m_stopping.load(std::memory_order_acquire)) {
+            return;
+        }
+        work(worker);
+        if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            m_pending.notify_one();
+        }
+    }
+}
+
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace util {
+
+/**
+ * @brief Spin on an atomic for a short while, then park the thread until the value changes
+ * @param old - Value to wait to change away from
+ */
+void spin_wait(const std::atomic<uint32_t>& value, uint32_t old);
+
+/**
+ * @brief Bump allocator over blocks that are kept between resets, for short-lived buffers that shouldn't hit the heap
+ * every tick
+ */
+class ScratchArena {
+public:
+    /**
+     * @brief Get uninitialized memory for count values of a trivial type, valid until the next reset
+     */
+    template <typename T>
+    std::span<T> allocate(std::size_t count)
+    {
+        static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>);
+        return { static_cast<T*>(allocate_bytes(count * sizeof(T), alignof(T))), count };
+    }
+
+    /**
+     * @brief Release everything allocated, keeping the memory
+     */
+    void reset();
+
+private:
+    struct Block {
+        std::unique_ptr<std::byte[]> data;
+        std::size_t size;
+    };
+
+    std::vector<Block> m_blocks {};
+    std::size_t m_block = 0;
+    std::size_t m_used = 0;
+
+    void* allocate_bytes(std::size_t size, std::size_t alignment);
+};
+
+/**
+ * @brief Persistent pool of workers for fork-join loops. The calling thread joins in as worker 0. A loop's range is
+ * split evenly between workers up front and workers that run out steal grains from the others, so uneven work still
+ * balances. Idle workers spin before parking and jobs are passed without allocating, so a loop costs little more than
+ * its work even when run several times per tick. Only one thread may run loops on a pool at a time.
+ */
+class WorkerPool {
+public:
+    /**
+     * @brief Construct WorkerPool with a worker per hardware thread
+     */
+    WorkerPool();
+
+    /**
+     * @brief Construct WorkerPool
+     * @param thread_count - Number of workers including the calling thread
+     */
+    explicit WorkerPool(int thread_count);
+
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    /**
+     * @brief Get the number of workers including the calling thread
+     */
+    [[nodiscard]] int worker_count() const;
+
+    /**
+     * @brief Scratch memory of a worker, reset at the start of every loop
+     */
+    [[nodiscard]] ScratchArena& scratch(int worker);
+
+    /**
+     * @brief Call func(start, end, worker) over subranges of [begin, end) on every worker and wait for all of them
+     * @param grain - Size of the subranges, 0 to pick one from the range and worker count
+     */
+    template <typename F>
+    void parallel_for(int begin, int end, F&& func, int grain = 0)
+    {
+        using Func = std::remove_reference_t<F>;
+        run({ [](void* context, int start, int end, int worker) { (*static_cast<Func*>(context))(start, end, worker); },
+                static_cast<void*>(&func) },
+            begin, end, grain);
+    }
+
+private:
+    struct Job {
+        void (*invoke)(void* context, int start, int end, int worker);
+        void* context;
+    };
+
+    struct alignas(64) Slot {
+        std::atomic<int> next { 0 };
+        int end = 0;
+        ScratchArena scratch {};
+    };
+
+    std::vector<std::thread> m_threads {};
+    std::unique_ptr<Slot[]> m_slots;
+    int m_worker_count;
+    Job m_job {};
+    int m_grain = 1;
+    std::atomic<uint32_t> m_generation { 0 };
+    std::atomic<uint32_t> m_pending { 0 };
+    std::atomic<bool> m_stopping { false };
+
+    void run(Job job, int begin, int end, int grain);
+
+    void work(int worker);
+
+    void worker_main(int worker);
+};
+
+/**
+ * @brief Run a loop on a pool, or as a single range on the calling thread if there is no pool
+ */
+template <typename F>
+void parallel_for(WorkerPool* pool, int begin, int end, F&& func)
+{
+    if (pool == nullptr) {
+        if (begin < end) {
+            func(begin, end, 0);
+        }
+        return;
+    }
+    pool->parallel_for(begin, end, func);
+}
+
+}
@@ -0,0 +1,251 @@
+#include "validate.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+
+#include "powder_playground.hpp"
+#include "simulation.hpp"
+#include "util/logger.hpp"
+#include "util/rng.hpp"
+#include "util/worker_pool.hpp"
+
+namespace pop {
+
+static constexpr int k_validate_width = 256;
+static constexpr int k_validate_height = 192;
+static constexpr int k_validate_ticks = 1200;
+static constexpr int k_sample_interval = 50;
+
+// Tolerances against the serial engine. The serial engine itself drifts up to 5.7 rows across seeds, and the chunked
+// and optimistic engines up to 9.6 rows in the mixed scene.
+static constexpr double k_mass_tolerance = 0.1;
+static constexpr double k_center_of_mass_tolerance = 0.065 * k_validate_height;
+static constexpr double k_profile_tolerance = 3.0;
+
+/**
+ * @brief How far an engine may stray from the serial engine
+ */
+struct Tolerances {
+    // Largest difference in the mass of an element, as a fraction of all mass, in scenes that react
+    double mass = k_mass_tolerance;
+    // Largest difference in the mean row of an element, in cells
+    double center_of_mass = k_center_of_mass_tolerance;
+    // Mean difference in the height of a column, in cells
+    double profile = k_profile_tolerance;
+};
+
+// Bounds are set about a third above the largest difference measured over several seeds, so they fail on regressions
+// rather than on noise
+static Tolerances tolerances_of(std::string_view engine_name)
+{
+    if (engine_name == "intent") {
+        // Moves are settled against the previous frame, so a particle can't follow the one below it down in the same
+        // tick and falls about half as fast as with the serial engine. Measured up to 28.8 rows.
+        return { .center_of_mass = 0.2 * k_validate_height };
+    }
+    if (engine_name == "margolus") {
+        // Blocks move by their own rules and don't react, measured up to 0.25 of the mass, 39.7 rows of center of
+        // mass and 12.8 cells of profile
+        return { .mass = 0.33, .center_of_mass = 0.27 * k_validate_height, .profile = 17.0 };
+    }
+    return {};
+}
+
+struct ValidationScene {
+    const char* name;
+    // Whether elements react in the scene, otherwise every element keeps its exact mass
+    bool reactive;
+    std::function<void(Simulation&, util::Rng&)> fill;
+};
+
+struct Invariants {
+    ElementId air = 0;
+    // Cells of each element, indexed by element id
+    std::vector<int> mass {};
+    // Mean row of each element at every sample, NAN where the element has no cells
+    std::vector<std::vector<double>> center_of_mass {};
+    // Height of the topmost powder or solid cell of each column, after the last tick
+    std::vector<int> profile {};
+    // Checksum of the grid after every tick
+    std::vector<uint64_t> checksums {};
+};
+
+// Powders poured into a walled basin, with nothing to react
+static void fill_pile(Simulation& simulation, util::Rng& rng)
+{
+    const ElementId wall = simulation.id_of("wall");
+    const ElementId salt = simulation.id_of("salt");
+    const ElementId stone = simulation.id_of("stone");
+    const int width = simulation.width();
+    const int height = simulation.height();
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            if (y == height - 1 || ((x == width / 4 || x == width * 3 / 4) && y > height * 2 / 3)) {
+                simulation.particle_at({ x, y }).element_id = wall;
+            }
+            else if (y < height / 3 && x > width / 3 && x < width * 2 / 3 && rng.range(0, 9) < 6) {
+                simulation.particle_at({ x, y }).element_id = rng.range(0, 1) == 0 ? salt : stone;
+            }
+        }
+    }
+}
+
+// Water poured over lava with salt and steam mixed in, so reactions run alongside movement
+static void fill_mixed(Simulation& simulation, util::Rng& rng)
+{
+    const std::array<ElementId, 4> ids { simulation.id_of("water"), simulation.id_of("lava"), simulation.id_of("salt"),
+        simulation.id_of("steam") };
+    for (int y = 0; y < simulation.height() / 2; y++) {
+        for (int x = 0; x < simulation.width(); x++) {
+            if (rng.range(0, 9) < 5) {
+                simulation.particle_at({ x, y }).element_id = ids[rng.range(0, 3)];
+            }
+        }
+    }
+}
+
+static Invariants measure(std::string_view engine_name, const ValidationScene& scene, int ticks, util::WorkerPool* pool)
+{
+    Simulation simulation(k_validate_width, k_validate_height);
+    init_elements(simulation);
+    simulation.clear_to("air");
+    simulation.set_bitsliced_powders(true);
+    simulation.set_engine(make_engine(engine_name));
+    simulation.set_worker_pool(pool);
+    simulation.set_seed(1);
+    simulation.set_deterministic(true);
+    simulation.set_checksums(true);
+    util::Rng rng(1);
+    scene.fill(simulation, rng);
+
+    const int element_slots = simulation.element_count() + 1;
+    Invariants invariants;
+    invariants.air = simulation.id_of("air");
+    for (int tick = 0; tick <= ticks; tick++) {
+        if (tick % k_sample_interval == 0) {
+            std::vector<double> row_sums(element_slots);
+            invariants.mass.assign(element_slots, 0);
+            for (int y = 0; y < simulation.height(); y++) {
+                for (int x = 0; x < simulation.width(); x++) {
+                    ElementId id = simulation.id_at({ x, y });
+                    row_sums[id] += y;
+                    invariants.mass[id]++;
+                }
+            }
+            for (int id = 0; id < element_slots; id++) {
+                row_sums[id] = invariants.mass[id] > 0 ? row_sums[id] / invariants.mass[id] : NAN;
+            }
+            invariants.center_of_mass.push_back(std::move(row_sums));
+        }
+        if (tick < ticks) {
+            simulation.update();
+            invariants.checksums.push_back(simulation.checksum());
+        }
+    }
+
+    for (int x = 0; x < simulation.width(); x++) {
+        int top = simulation.height();
+        for (int y = 0; y < simulation.height(); y++) {
+            ElementType type = simulation.type_at({ x, y });
+            if (type == ElementType::e_powder || type == ElementType::e_solid) {
+                top = y;
+                break;
+            }
+        }
+        invariants.profile.push_back(simulation.height() - top);
+    }
+    return invariants;
+}
+
+static bool compare(std::string_view engine_name, const ValidationScene& scene, const Invariants& initial,
+    const Invariants& reference, const Invariants& invariants)
+{
+    const Tolerances tolerances = tolerances_of(engine_name);
+
+    // Every engine only moves and changes cells, so nothing may appear or vanish
+    int initial_mass = 0;
+    int mass = 0;
+    for (int id = 0; id < static_cast<int>(invariants.mass.size()); id++) {
+        if (id != static_cast<int>(initial.air)) {
+            initial_mass += initial.mass[id];
+            mass += invariants.mass[id];
+        }
+    }
+    bool mass_conserved = mass == initial_mass;
+    double mass_error = 0.0;
+    for (int id = 0; id < static_cast<int>(invariants.mass.size()); id++) {
+        if (!scene.reactive) {
+            mass_conserved &= invariants.mass[id] == initial.mass[id];
+            continue;
+        }
+        // Reactions are random, so element masses only have to land near the serial engine's
+        double error = std::abs(invariants.mass[id] - reference.mass[id]) / std::max(1.0, double(initial_mass));
+        mass_error = std::max(mass_error, error);
+    }
+    const bool mass_ok = mass_error <= tolerances.mass;
+
+    double center_of_mass_drift = 0.0;
+    for (int sample = 0; sample < static_cast<int>(invariants.center_of_mass.size()); sample++) {
+        for (int id = 0; id < static_cast<int>(invariants.mass.size()); id++) {
+            double drift = std::abs(invariants.center_of_mass[sample][id] - reference.center_of_mass[sample][id]);
+            if (!std::isnan(drift)) {
+                center_of_mass_drift = std::max(center_of_mass_drift, drift);
+            }
+        }
+    }
+    const bool center_of_mass_ok = center_of_mass_drift <= tolerances.center_of_mass;
+
+    double profile_difference = 0.0;
+    for (int x = 0; x < static_cast<int>(invariants.profile.size()); x++) {
+        profile_difference += std::abs(invariants.profile[x] - reference.profile[x]);
+    }
+    profile_difference /= static_cast<double>(invariants.profile.size());
+    const bool profile_ok = profile_difference <= tolerances.profile;
+
+    POP_LOG_INFO("{:<6} {:<11} mass {} ({} -> {}, error {:.3f} {}), center of mass drift {:.2f} ({}), profile "
+                 "difference {:.2f} ({})",
+        scene.name, engine_name, mass_conserved ? "conserved" : "FAIL", initial_mass, mass, mass_error,
+        mass_ok ? "ok" : "FAIL", center_of_mass_drift, center_of_mass_ok ? "ok" : "FAIL", profile_difference,
+        profile_ok ? "ok" : "FAIL");
+    return mass_conserved && mass_ok && center_of_mass_ok && profile_ok;
+}
+
+bool run_validation(const std::vector<std::string_view>& engine_names)
+{
+    const std::array<ValidationScene, 2> scenes { { { "pile", false, fill_pile }, { "mixed", true, fill_mixed } } };
+    util::WorkerPool pool;
+
+    util::main_logger().set_level(spdlog::level::info);
+    bool passed = true;
+    for (const ValidationScene& scene : scenes) {
+        const Invariants initial = measure("serial", scene, 0, &pool);
+        const Invariants reference = measure("serial", scene, k_validate_ticks, &pool);
+        for (std::string_view engine_name : engine_names) {
+            const Invariants invariants = measure(engine_name, scene, k_validate_ticks, &pool);
+            passed &= compare(engine_name, scene, initial, reference, invariants);
+            if (!make_engine(engine_name)->deterministic()) {
+                continue;
+            }
+            // A deterministic engine has to step to the same grids on the calling thread as on the pool
+            const Invariants single = measure(engine_name, scene, k_validate_ticks, nullptr);
+            auto mismatch
+                = std::mismatch(single.checksums.begin(), single.checksums.end(), invariants.checksums.begin());
+            if (mismatch.first != single.checksums.end()) {
+                POP_LOG_INFO("{:<6} {:<11} determinism FAIL, checksums diverge at tick {}", scene.name, engine_name,
+                    mismatch.first - single.checksums.begin() + 1);
+                passed = false;
+            }
+            else {
+                POP_LOG_INFO("{:<6} {:<11} determinism ok, checksum {:016x}", scene.name, engine_name,
+                    single.checksums.back());
+            }
+        }
+    }
+    return passed;
+}
+
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+
+namespace pop {
+
+/**
+ * @brief Run the same seeded scenes through engines and compare their statistical invariants against the serial
+ * engine: per-element mass, center of mass trajectories and settled pile profiles. Results are logged.
+ * @param engine_names - Engines to check, the serial engine is always run as the reference
+ * @return - True if every engine stayed within its own tolerances on every scene
+ */
+bool run_validation(const std::vector<std::string_view>& engine_names);
+
+}
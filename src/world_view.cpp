@@ -0,0 +1,108 @@
+#include "world_view.hpp"
+
+#include <algorithm>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "util/profiler.hpp"
+
+namespace pop {
+
+WorldView::WorldView(Simulation& simulation, ChunkStore& store, Vector2i origin, util::WorkerPool* pool)
+    : m_simulation(simulation)
+    , m_store(store)
+    , m_size { (simulation.width() + k_chunk_size - 1) / k_chunk_size,
+        (simulation.height() + k_chunk_size - 1) / k_chunk_size }
+{
+    const std::optional<Vector2i> world_size = store.size();
+    if (world_size.has_value() && (m_size.x > world_size->x || m_size.y > world_size->y)) {
+        throw std::runtime_error("World is smaller than the simulation");
+    }
+    m_origin = clamp(origin);
+    page_in(pool);
+}
+
+void WorldView::move_to(Vector2i origin, util::WorkerPool* pool)
+{
+    origin = clamp(origin);
+    if (origin.x == m_origin.x && origin.y == m_origin.y) {
+        return;
+    }
+    page_out(pool);
+    m_origin = origin;
+    page_in(pool);
+}
+
+void WorldView::save(util::WorkerPool* pool)
+{
+    page_out(pool);
+    m_store.flush();
+}
+
+Vector2i WorldView::origin() const
+{
+    return m_origin;
+}
+
+Vector2i WorldView::size() const
+{
+    return m_size;
+}
+
+Vector2i WorldView::clamp(Vector2i origin) const
+{
+    const std::optional<Vector2i> world_size = m_store.size();
+    if (!world_size.has_value()) {
+        return origin;
+    }
+    return { std::clamp(origin.x, 0, world_size->x - m_size.x), std::clamp(origin.y, 0, world_size->y - m_size.y) };
+}
+
+void WorldView::page_in(util::WorkerPool* pool)
+{
+    PROFILE_ZONE("page_in");
+    util::parallel_for(pool, 0, m_size.x * m_size.y, [&](int start, int end, int) {
+        std::vector<Particle> cells(k_chunk_size * k_chunk_size);
+        for (int c = start; c < end; c++) {
+            const Vector2i chunk { c % m_size.x, c / m_size.x };
+            m_store.read({ m_origin.x + chunk.x, m_origin.y + chunk.y }, cells);
+            const int width = std::min(k_chunk_size, m_simulation.width() - chunk.x * k_chunk_size);
+            const int height = std::min(k_chunk_size, m_simulation.height() - chunk.y * k_chunk_size);
+            for (int y = 0; y < height; y++) {
+                // Rows of a chunk are contiguous
+                std::copy_n(cells.begin() + y * k_chunk_size, width,
+                    &m_simulation.particle_at({ chunk.x * k_chunk_size, chunk.y * k_chunk_size + y }));
+            }
+        }
+    });
+    m_simulation.rebuild_occupancy();
+    m_simulation.mark_all_changed();
+}
+
+void WorldView::page_out(util::WorkerPool* pool)
+{
+    PROFILE_ZONE("page_out");
+    util::parallel_for(pool, 0, m_size.x * m_size.y, [&](int start, int end, int) {
+        std::vector<Particle> cells(k_chunk_size * k_chunk_size);
+        for (int c = start; c < end; c++) {
+            const Vector2i chunk { c % m_size.x, c / m_size.x };
+            const Vector2i world_chunk { m_origin.x + chunk.x, m_origin.y + chunk.y };
+            const int width = std::min(k_chunk_size, m_simulation.width() - chunk.x * k_chunk_size);
+            const int height = std::min(k_chunk_size, m_simulation.height() - chunk.y * k_chunk_size);
+            // Chunks cut by the edge of the simulation keep the cells past it
+            if (width < k_chunk_size || height < k_chunk_size) {
+                m_store.read(world_chunk, cells);
+            }
+            for (int y = 0; y < height; y++) {
+                const Particle* row
+                    = &std::as_const(m_simulation).particle_at({ chunk.x * k_chunk_size, chunk.y * k_chunk_size + y });
+                std::copy_n(row, width, cells.begin() + y * k_chunk_size);
+            }
+            m_store.write(world_chunk, cells);
+        }
+    });
+}
+
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "chunk_store.hpp"
+#include "simulation.hpp"
+#include "util/worker_pool.hpp"
+
+namespace pop {
+
+/**
+ * @brief Window of a world that a simulation steps. The simulation holds the chunks under the window and the store
+ * holds the rest of the world, so only the window is resident. Chunks outside the window don't step until the window
+ * comes back over them.
+ */
+class WorldView {
+public:
+    /**
+     * @brief Page in the chunks under the window
+     * @param origin - Chunk at the top left of the window
+     */
+    WorldView(Simulation& simulation, ChunkStore& store, Vector2i origin, util::WorkerPool* pool);
+
+    /**
+     * @brief Page the window out and the chunks under it at another origin in. The origin is clamped so the window
+     * stays inside the world, if it is bounded.
+     * @param pool - Pool to page chunks on, or nullptr to page them on the calling thread
+     */
+    void move_to(Vector2i origin, util::WorkerPool* pool);
+
+    /**
+     * @brief Page out the window without moving it and flush the store
+     */
+    void save(util::WorkerPool* pool);
+
+    /**
+     * @brief Get the chunk at the top left of the window
+     */
+    [[nodiscard]] Vector2i origin() const;
+
+    /**
+     * @brief Get the size of the window in chunks, the last row and column may be cut by the edge of the simulation
+     */
+    [[nodiscard]] Vector2i size() const;
+
+private:
+    Simulation& m_simulation;
+    ChunkStore& m_store;
+    Vector2i m_origin {};
+    Vector2i m_size;
+
+    [[nodiscard]] Vector2i clamp(Vector2i origin) const;
+
+    void page_in(util::WorkerPool* pool);
+
+    void page_out(util::WorkerPool* pool);
+};
+
+}